@@ -0,0 +1,504 @@
+#include "countShard.hpp"
+#include "workPool.hpp"
+#include <cstdio>
+#include <sys/stat.h>
+
+static bool EndsWith(const string& s, const string& suffix)
+{
+  return (s.length() >= suffix.length()) && (s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0);
+}
+
+/*
+  Opens fname + SHARD_TMP_SUFFIX and writes a placeholder header and the vocabulary (words in string order, so local
+  id k is words[k-1]). The caller then streams each order's records, noting header.recordsOffset/nRecords, and
+  calls FinishShard().
+*/
+static bool BeginShard(const string& fname, fstream& out, ShardHeader& header, const vector<string>& words)
+{
+  U64 k;
+  vector<U32> strOffsets;
+  string pool;
+
+  out.open((fname + SHARD_TMP_SUFFIX).c_str(), ios::out | ios::binary | ios::trunc);
+  if(!out){
+    cout << "ERROR could not open count shard for writing: " << fname << SHARD_TMP_SUFFIX << endl;
+    return false;
+  }
+
+  for(k = 0; k < words.size(); k++){
+    strOffsets.push_back(pool.length());
+    pool += words[k];
+  }
+  strOffsets.push_back(pool.length());
+
+  memset(&header, 0, sizeof(header));
+  header.version = SHARD_VERSION;
+  header.nWords = words.size();
+  header.strOffsetsOffset = AlignUp(sizeof(ShardHeader));
+  header.poolOffset = header.strOffsetsOffset + AlignUp(strOffsets.size() * sizeof(U32));
+  header.poolSize = pool.length();
+
+  WritePadded(out, &header, sizeof(header));  //magic stays 0 until FinishShard()
+  WritePadded(out, strOffsets.data(), strOffsets.size() * sizeof(U32));
+  WritePadded(out, pool.data(), pool.length());
+
+  return (bool)out;
+}
+
+static void FlushRecords(fstream& out, vector<ShardRecord>& buf)
+{
+  if(!buf.empty()){
+    out.write((const char*)buf.data(), buf.size() * sizeof(ShardRecord));
+    buf.clear();
+  }
+}
+
+//completes the header, and renames the finished shard into place so readers never see a partial one
+static bool FinishShard(const string& fname, fstream& out, ShardHeader& header)
+{
+  string tmpName = fname + SHARD_TMP_SUFFIX;
+
+  header.magic = SHARD_MAGIC;
+  header.fileSize = (U64)out.tellp();
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  out.close();
+
+  if(!out){
+    cout << "ERROR count shard write to " << tmpName << " failed" << endl;
+    remove(tmpName.c_str());
+    return false;
+  }
+  if(rename(tmpName.c_str(), fname.c_str()) != 0){
+    cout << "ERROR could not rename " << tmpName << " to " << fname << endl;
+    remove(tmpName.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+CountShardReader::CountShardReader()
+{
+  memset(&header, 0, sizeof(header));
+  bufPos = 0;
+  left = 0;
+}
+
+bool CountShardReader::Open(const string& fname)
+{
+  U64 k;
+  struct stat st;
+  vector<U32> strOffsets;
+  string pool;
+
+  Close();
+  name = fname;
+  in.open(fname.c_str(), ios::in | ios::binary);
+  if(!in){
+    cout << "ERROR could not open count shard " << fname << endl;
+    return false;
+  }
+
+  in.read((char*)&header, sizeof(header));
+  if(!in || (header.magic != SHARD_MAGIC) || (header.version != SHARD_VERSION)){
+    cout << "ERROR " << fname << " is not a complete count shard (version " << SHARD_VERSION << ")" << endl;
+    Close();
+    return false;
+  }
+  if((stat(fname.c_str(), &st) != 0) || ((U64)st.st_size != header.fileSize)){
+    cout << "ERROR count shard " << fname << " is truncated: expected " << header.fileSize << " bytes" << endl;
+    Close();
+    return false;
+  }
+
+  strOffsets.resize(header.nWords + 1);
+  pool.resize(header.poolSize);
+  in.seekg(header.strOffsetsOffset);
+  in.read((char*)strOffsets.data(), strOffsets.size() * sizeof(U32));
+  in.seekg(header.poolOffset);
+  in.read(&pool[0], pool.length());
+  if(!in || (strOffsets[header.nWords] != header.poolSize)){
+    cout << "ERROR could not read the vocabulary of count shard " << fname << endl;
+    Close();
+    return false;
+  }
+  words.clear();
+  for(k = 0; k < header.nWords; k++){
+    words.push_back(pool.substr(strOffsets[k], strOffsets[k+1] - strOffsets[k]));
+  }
+
+  return true;
+}
+
+void CountShardReader::Close(void)
+{
+  if(in.is_open()){
+    in.close();
+  }
+  in.clear();
+  words.clear();
+  buf.clear();
+  bufPos = 0;
+  left = 0;
+}
+
+bool CountShardReader::Rewind(int n)
+{
+  if(!in.is_open() || (n < 1) || (n > NGRAMS)){
+    return false;
+  }
+
+  in.clear();
+  in.seekg(header.recordsOffset[n]);
+  buf.clear();
+  bufPos = 0;
+  left = header.nRecords[n];
+
+  return (bool)in;
+}
+
+bool CountShardReader::Next(ShardRecord& record)
+{
+  U64 cnt;
+
+  if(bufPos == buf.size()){
+    if(left == 0){
+      return false;
+    }
+    cnt = (left < SHARD_BUF_RECORDS) ? left : SHARD_BUF_RECORDS;
+    buf.resize(cnt);
+    in.read((char*)buf.data(), cnt * sizeof(ShardRecord));
+    if(!in){
+      cout << "ERROR read failed in count shard " << name << endl;
+      buf.clear();
+      left = 0;
+      return false;
+    }
+    left -= cnt;
+    bufPos = 0;
+  }
+  record = buf[bufPos++];
+
+  return true;
+}
+
+//maps every 16-bit word field of an order-n record from local to merged ids; false if an id is out of range
+static bool RemapRecord(ShardRecord& record, int n, const vector<IntKey>& toMerged)
+{
+  int f, nFields;
+  U64 id, context;
+
+  nFields = (n > 1) ? (n - 1) : 1;  //unigram records are keyed by the word itself
+  context = 0;
+  for(f = 0; f < nFields; f++){
+    id = (record.context >> (16 * f)) & 0xFFFF;
+    if(id >= toMerged.size()){
+      return false;
+    }
+    context |= (U64)toMerged[id] << (16 * f);
+  }
+  if(record.word >= toMerged.size()){
+    return false;
+  }
+  record.context = context;
+  record.word = toMerged[record.word];
+
+  return true;
+}
+
+//(context, word) order of the record streams
+static bool RecordLess(const ShardRecord& a, const ShardRecord& b)
+{
+  return (a.context < b.context) || ((a.context == b.context) && (a.word < b.word));
+}
+
+/*
+  Merges shards into one shard at fname. The vocabularies are unioned in string order and each shard gets a
+  local-to-merged id table; since both orders agree, each order is then a single k-way merge of the remapped record
+  streams, summing the counts of equal (context, word) records. Inputs still being written (SHARD_TMP_SUFFIX) and
+  fname itself are skipped, so a shared output directory can be passed as is.
+*/
+bool MergeCountShards(const vector<string>& shardFiles, const string& fname)
+{
+  int n;
+  U32 s, k;
+  bool ok;
+  ShardHeader header;
+  ShardRecord merged;
+  fstream out;
+  vector<CountShardReader*> readers;
+  vector<vector<IntKey> > toMerged;
+  vector<string> words;
+  vector<ShardRecord> heads, outBuf;
+  vector<U32> heap;
+  vector<U64> nTaken;  //records of the current order taken from each shard
+
+  ok = true;
+  for(s = 0; ok && (s < shardFiles.size()); s++){
+    if(EndsWith(shardFiles[s], SHARD_TMP_SUFFIX) || (shardFiles[s] == fname)){
+      continue;
+    }
+    readers.push_back(new CountShardReader);
+    ok = readers.back()->Open(shardFiles[s]);
+  }
+  if(ok && readers.empty()){
+    cout << "ERROR no count shards to merge" << endl;
+    ok = false;
+  }
+
+  if(ok){
+    for(s = 0; s < readers.size(); s++){
+      words.insert(words.end(), readers[s]->words.begin(), readers[s]->words.end());
+    }
+    sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    if(words.size() >= U16_MAX){
+      cout << "ERROR merged vocabulary of " << words.size() << " words does not fit 16-bit word keys" << endl;
+      ok = false;
+    }
+  }
+
+  if(ok){
+    toMerged.resize(readers.size());
+    for(s = 0; s < readers.size(); s++){
+      toMerged[s].push_back(0);
+      for(k = 0; k < readers[s]->words.size(); k++){
+        toMerged[s].push_back((IntKey)(std::lower_bound(words.begin(), words.end(), readers[s]->words[k]) - words.begin() + 1));
+      }
+    }
+    ok = BeginShard(fname, out, header, words);
+  }
+
+  //min-heap of shard indices by their head record
+  auto later = [&heads](U32 a, U32 b){ return RecordLess(heads[b], heads[a]); };
+  heads.resize(readers.size());
+  nTaken.resize(readers.size());
+  for(n = 1; ok && (n <= NGRAMS); n++){
+    header.recordsOffset[n] = (U64)out.tellp();
+    heap.clear();
+    for(s = 0; s < readers.size(); s++){
+      nTaken[s] = 0;
+      if(!readers[s]->Rewind(n)){
+        cout << "ERROR could not seek to the " << n << "-gram records of count shard " << s << endl;
+        ok = false;
+      }
+      else if(readers[s]->Next(heads[s])){
+        nTaken[s]++;
+        if(!RemapRecord(heads[s], n, toMerged[s])){
+          cout << "ERROR word id out of range in count shard " << s << endl;
+          ok = false;
+        }
+        heap.push_back(s);
+      }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while(ok && !heap.empty()){
+      std::pop_heap(heap.begin(), heap.end(), later);
+      s = heap.back();
+      heap.pop_back();
+      if(outBuf.empty() || RecordLess(outBuf.back(), heads[s])){
+        if(outBuf.size() == SHARD_BUF_RECORDS){
+          FlushRecords(out, outBuf);
+        }
+        memset(&merged, 0, sizeof(merged));
+        merged.context = heads[s].context;
+        merged.word = heads[s].word;
+        outBuf.push_back(merged);
+        header.nRecords[n]++;
+      }
+      outBuf.back().count += heads[s].count;
+
+      if(readers[s]->Next(heads[s])){
+        nTaken[s]++;
+        if(!RemapRecord(heads[s], n, toMerged[s])){
+          cout << "ERROR word id out of range in count shard " << s << endl;
+          ok = false;
+        }
+        heap.push_back(s);
+        std::push_heap(heap.begin(), heap.end(), later);
+      }
+    }
+    FlushRecords(out, outBuf);
+
+    //Next() also stops on a read error, so a stream that ended early is a failed read, not a shorter order
+    for(s = 0; ok && (s < readers.size()); s++){
+      if(nTaken[s] != readers[s]->header.nRecords[n]){
+        cout << "ERROR count shard " << s << " ended after " << nTaken[s] << " of its " << readers[s]->header.nRecords[n]
+             << " " << n << "-gram records" << endl;
+        ok = false;
+      }
+    }
+  }
+
+  if(ok){
+    ok = FinishShard(fname, out, header);
+  }
+  else if(out.is_open()){
+    out.close();
+    remove((fname + SHARD_TMP_SUFFIX).c_str());  //a partial merge is never renamed into place
+  }
+  if(ok){
+    cout << "Merged " << readers.size() << " count shards into " << fname << ": " << words.size() << " words";
+    for(n = 1; n <= NGRAMS; n++){
+      cout << ", " << header.nRecords[n] << " " << n << "-grams";
+    }
+    cout << endl;
+  }
+  for(s = 0; s < readers.size(); s++){
+    delete readers[s];
+  }
+
+  return ok;
+}
+
+/*
+  Counts one slice of a corpus into a shard. Unlike Train() this does no PruneDocuments(): a word that is rare in
+  one slice need not be rare overall, and only the merged counts can tell.
+*/
+bool NgramModel::WriteCountShard(const vector<string>& paths, const string& fname)
+{
+  vector<vector<string> > docs;
+  vector<vector<IntKey> > keyDocs;
+  WorkStealingPool pool;
+
+  if(!TokenizeCorpus(paths,docs,pool)){
+    return false;
+  }
+  DocumentsToKeySequences(docs,keyDocs,pool);
+  CountDocuments(keyDocs,pool);
+
+  return ExportCountShard(fname);
+}
+
+//writes the raw counts as a shard; call before NormalizeTables(). Renumbers the keys into string order on the way.
+bool NgramModel::ExportCountShard(const string& fname)
+{
+  int n;
+  U32 rank;
+  ShardHeader header;
+  ShardRecord record;
+  fstream out;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  OuterTableIt outer;
+  InnerTableIt inner;
+  StringKeyMapIt sit;
+  vector<string> words;
+  vector<IntKey> newKey(idCounter, 0);
+  vector<ShardRecord> buf;
+  vector<vector<IntKey> > noDocs;
+  WorkStealingPool pool;
+
+  rank = 0;
+  for(sit = StringKeyTable.begin(); sit != StringKeyTable.end(); ++sit){
+    newKey[sit->second] = (IntKey)(++rank);
+    words.push_back(sit->first);
+  }
+  RemapKeys(newKey,noDocs,pool);
+
+  if(!BeginShard(fname, out, header, words)){
+    return false;
+  }
+  memset(&record, 0, sizeof(record));
+  for(n = 1; n <= NGRAMS; n++){
+    header.recordsOffset[n] = (U64)out.tellp();
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+        if(buf.size() == SHARD_BUF_RECORDS){
+          FlushRecords(out, buf);
+        }
+        record.context = outer->first;
+        record.word = inner->first;
+        record.count = (U64)inner->second;
+        buf.push_back(record);
+        header.nRecords[n]++;
+      }
+    }
+    FlushRecords(out, buf);
+  }
+  if(!FinishShard(fname, out, header)){
+    return false;
+  }
+
+  cout << "Wrote count shard " << fname << ": " << words.size() << " words";
+  for(n = 1; n <= NGRAMS; n++){
+    cout << ", " << header.nRecords[n] << " " << n << "-grams";
+  }
+  cout << endl;
+
+  return true;
+}
+
+/*
+  Loads a (usually merged) shard's counts into empty tables, then finishes training as Train() does. Records arrive
+  sorted, so every row and entry is appended at the end of its map.
+*/
+bool NgramModel::TrainFromCountShard(const string& fname, const vector<string>& heldOut)
+{
+  int n;
+  U64 k, nRead;
+  IntKey key;
+  CountShardReader reader;
+  ShardRecord record;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  OuterTableIt row;
+  vector<U64> freqs;
+  vector<vector<IntKey> > noDocs;
+  WorkStealingPool pool;
+
+  if(!reader.Open(fname)){
+    return false;
+  }
+  if(reader.header.nWords >= U16_MAX){
+    cout << "ERROR count shard " << fname << " has too many words (" << reader.header.nWords << ") for 16-bit word keys" << endl;
+    return false;
+  }
+
+  tablesFrozen = false;
+  KeyStringTable.clear();
+  StringKeyTable.clear();
+  idCounter = 1;
+  for(k = 0; k < reader.words.size(); k++){
+    AllocKey(reader.words[k],key);  //words are unique and in order, so key == k+1
+  }
+
+  for(n = 1; n <= NGRAMS; n++){
+    tables[n]->clear();
+    if(!reader.Rewind(n)){
+      cout << "ERROR could not seek to the " << n << "-gram records of count shard " << fname << endl;
+      return false;
+    }
+    nRead = 0;
+    while(reader.Next(record)){
+      nRead++;
+      if((record.word == 0) || (record.word > reader.header.nWords)){
+        cout << "ERROR word id " << record.word << " out of range in count shard " << fname << endl;
+        return false;
+      }
+      if(tables[n]->empty() || (row->first != record.context)){
+        row = tables[n]->insert(tables[n]->end(), std::make_pair(record.context, NgramRow()));
+      }
+      row->second.insert(row->second.end(), std::make_pair(record.word, (double)record.count));
+    }
+    if(nRead != reader.header.nRecords[n]){  //Next() also stops on a read error
+      cout << "ERROR count shard " << fname << " ended after " << nRead << " of its " << reader.header.nRecords[n] << " " << n
+           << "-gram records" << endl;
+      return false;
+    }
+  }
+  cout << "Loaded count shard " << fname << ": " << reader.words.size() << " words, " << unigramTable.size() << " unigrams, " << bigramTable.size()
+       << " bigram contexts, " << trigramTable.size() << " trigram contexts, " << quadgramTable.size() << " quadgram contexts" << endl;
+
+  if(frequencyRankedKeys){
+    freqs.resize(idCounter, 0);
+    for(row = unigramTable.begin(); row != unigramTable.end(); ++row){
+      freqs[row->first] = (U64)row->second.begin()->second;
+    }
+    RenumberByFrequency(freqs,noDocs,pool);
+  }
+
+  ProcessTables(heldOut);
+
+  return true;
+}
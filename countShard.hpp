@@ -0,0 +1,78 @@
+/*
+  Raw-count shard files, for splitting training across processes or hosts. Each worker counts its own slice of the
+  corpus and writes one shard (NgramModel::WriteCountShard()); MergeCountShards() folds any number of shards into
+  one, and NgramModel::TrainFromCountShard() turns a shard into a model (normalizing, backoff, lambdas). A merged
+  shard is itself a shard, so merges can be staged, eg per host and then across hosts.
+
+  Shard-local word ids are the 1-based positions of the words in byte-wise string order. The merged vocabulary is in
+  the same order, so mapping a shard's ids to merged ids never reorders anything: every shard's record stream,
+  sorted by (context, word), is still sorted after the remap, and the merge is a plain streaming k-way merge.
+  It holds the vocabularies and SHARD_BUF_RECORDS records per input, however large the shards are.
+
+  Layout (every section 8-byte aligned):
+    ShardHeader
+    vocabulary: U32 strOffset[nWords+1] into the string pool (local id k spans [strOffset[k-1],strOffset[k]) )
+                char pool[poolSize], the words in string order, back to back, not null terminated
+    per order 1..NGRAMS: ShardRecord records[nRecords[n]], sorted by (context, word)
+
+  Shards are written under fname + SHARD_TMP_SUFFIX and renamed into place when complete, so workers can share an
+  output directory with a merger scanning it; MergeCountShards() skips the temporary names. Native-endian, like the
+  mapped model files.
+*/
+
+#ifndef COUNT_SHARD_HPP
+#define COUNT_SHARD_HPP
+
+#include "nGram.hpp"
+
+#define SHARD_MAGIC 0x44524148534d5247ULL  //"GRMSHARD"
+#define SHARD_VERSION 1
+#define SHARD_BUF_RECORDS 16384  //records buffered per shard stream while reading or merging
+#define SHARD_TMP_SUFFIX ".tmp"
+
+typedef struct shardHeader{
+  U64 magic;
+  U64 version;
+  U64 fileSize;
+  U64 nWords;          //local ids are [1,nWords]
+  U64 strOffsetsOffset;
+  U64 poolOffset;
+  U64 poolSize;
+  U64 nRecords[NGRAMS+1];  //index by ngram model number
+  U64 recordsOffset[NGRAMS+1];
+} ShardHeader;
+
+typedef struct shardRecord{
+  U64 context;  //packed context key in local ids, as MakeNgramModelKey() builds it; the word itself for unigrams
+  U64 count;
+  IntKey word;
+  U16 pad[3];
+} ShardRecord;
+
+//buffered, validated reader over one shard file
+class CountShardReader{
+  public:
+    ShardHeader header;
+    vector<string> words;  //words[k-1] is local id k
+
+    CountShardReader();
+
+    bool Open(const string& fname);
+    void Close(void);
+    bool Rewind(int n);             //start streaming the order-n records
+    bool Next(ShardRecord& record); //false once the current order is exhausted
+
+  private:
+    fstream in;
+    string name;
+    vector<ShardRecord> buf;
+    U64 bufPos;
+    U64 left;  //records of the current order not yet read into buf
+
+    CountShardReader(const CountShardReader&);
+    CountShardReader& operator=(const CountShardReader&);
+};
+
+bool MergeCountShards(const vector<string>& shardFiles, const string& fname);
+
+#endif
@@ -1,9 +1,23 @@
 #include "nGram.hpp"
+#include "countShard.hpp"
 
-int main(void)
+/*
+  With no arguments, trains on and tests against the Slate corpus. The Slate test file is split in one pass: ten lines
+  in every 500 are held out to fit the lambdas and the rest are tested. Distributed training goes through count shards:
+    nGram count <shard> <corpus paths...>     count one slice of the corpus (files, directories, globs) into a shard
+    nGram merge <shard> <shard paths...>      merge shards (files, directories, globs) into one
+    nGram train-counts <shard>               train from a merged shard, then test as usual
+    nGram split <corpus> <held-out> <test>   split one file by line fractions, eg 0.02 0.1, then train and test on it
+*/
+int main(int argc, char* argv[])
 {
   NgramModel ngModel;
   string s;
+  string cmd = (argc > 1) ? argv[1] : "";
+  vector<string> paths(argv + ((argc > 3) ? 3 : argc), argv + argc);
+  vector<string> files;
+  CorpusSplit split;
+  SplitRule slateRule = {500, 490, 499, 0, 489};
 
   //cout << "sizeof(string) c++ string=" << sizeof(string) << endl;
 
@@ -16,11 +30,38 @@ int main(void)
   else if((sizeof(U64) * 8) != 64){
     cout << "ERROR sizeof U64 = " << (sizeof(U64) * 8) << " not equal to 64 bits on this system" << endl;
   }
+  else if((cmd == "count") && (argc > 3)){
+    return ngModel.WriteCountShard(paths, argv[2]) ? 0 : 1;
+  }
+  else if((cmd == "merge") && (argc > 3)){
+    ngModel.ExpandCorpusPaths(paths, files);
+    return MergeCountShards(files, argv[2]) ? 0 : 1;
+  }
+  else if((cmd == "train-counts") && (argc == 3)){
+    if(!ngModel.SplitCorpus("../../oanc_SlateTestData.txt", slateRule, split) || !ngModel.TrainFromCountShard(argv[2], split.words[SPLIT_HELDOUT])){
+      return 1;
+    }
+    ngModel.Test(split.words[SPLIT_TEST]);
+  }
+  else if((cmd == "split") && (argc == 5)){
+    if(!ngModel.SplitCorpus(argv[2], ngModel.RatioSplit(atof(argv[3]), atof(argv[4])), split)){
+      return 1;
+    }
+    ngModel.Train(split);
+    ngModel.Test(split.words[SPLIT_TEST]);
+  }
+  else if(argc > 1){
+    cout << "ERROR usage: nGram [count <shard> <corpus paths...> | merge <shard> <shard paths...> | train-counts <shard> | split <corpus> <held-out> <test>]" << endl;
+    return 1;
+  }
   else{
     string training = "../../oanc_SlateTrainData.txt";
-    ngModel.Train(training);
     string testing = "../../oanc_SlateTestData.txt";
-    ngModel.Test(testing);
+    if(!ngModel.SplitCorpus(testing, slateRule, split)){
+      return 1;
+    }
+    ngModel.Train(training, split.words[SPLIT_HELDOUT]);
+    ngModel.Test(split.words[SPLIT_TEST]);
   }
 
   return 0;
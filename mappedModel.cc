@@ -0,0 +1,436 @@
+#include "mappedModel.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+U64 AlignUp(U64 n)
+{
+  return (n + 7) & ~(U64)7;
+}
+
+//true if count elements of elemSize bytes at offset lie inside a file of fileSize bytes, offset 8-byte aligned
+static bool ArrayInFile(U64 offset, U64 count, U64 elemSize, U64 fileSize)
+{
+  return (offset % 8 == 0) && (offset <= fileSize) && (count <= (fileSize - offset) / elemSize);
+}
+
+//writes len bytes, then zero pads the stream out to the next 8-byte boundary
+void WritePadded(fstream& out, const void* data, U64 len)
+{
+  char zeros[8] = {0};
+
+  if(len > 0){
+    out.write((const char*)data, len);
+  }
+  out.write(zeros, AlignUp(len) - len);
+}
+
+/*
+  Serializes the normalized tables and vocabulary into the mapped file format described in mappedModel.hpp.
+  Offsets are laid out first, then each section is streamed out in the same order, so the header can be
+  written up front. Call after NormalizeTables().
+*/
+bool NgramModel::ExportMappedModel(const string& fname)
+{
+  int n;
+  U64 k, pos, nEntries;
+  MappedHeader header;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  OuterTableIt outer;
+  KeyStringMapIt kit;
+  StringKeyMapIt sit;
+  vector<U32> strOffsets;
+  vector<IntKey> sortedKeys;
+  FlatTableStore store;
+  FlatTable flat;
+  string pool;
+  fstream out(fname.c_str(), ios::out | ios::binary | ios::trunc);
+
+  if(!out){
+    cout << "ERROR could not open file for mapped model export: " << fname << endl;
+    return false;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = MAPPED_MAGIC;
+  header.version = MAPPED_VERSION;
+  header.maxKey = idCounter;
+  header.nWords = StringKeyTable.size();
+  for(n = 0; n < NLAMBDAS; n++){
+    header.lambdas[n] = lambdas.l[n];
+  }
+
+  //vocabulary: keys index the offset array directly; StringKeyTable is already in string order for the sorted index
+  strOffsets.resize((U64)idCounter + 1);
+  for(k = 0; k < idCounter; k++){
+    strOffsets[k] = pool.length();
+    kit = KeyStringTable.find((IntKey)k);
+    if(kit != KeyStringTable.end()){
+      pool += kit->second;
+    }
+  }
+  strOffsets[idCounter] = pool.length();
+  for(sit = StringKeyTable.begin(); sit != StringKeyTable.end(); ++sit){
+    sortedKeys.push_back(sit->second);
+  }
+
+  pos = AlignUp(sizeof(MappedHeader));
+  header.strOffsetsOffset = pos;
+  pos += AlignUp(strOffsets.size() * sizeof(U32));
+  header.sortedKeysOffset = pos;
+  pos += AlignUp(sortedKeys.size() * sizeof(IntKey));
+  header.poolOffset = pos;
+  header.poolSize = pool.length();
+  pos += AlignUp(pool.length());
+
+  for(n = 1; n <= NGRAMS; n++){
+    nEntries = 0;
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      nEntries += outer->second.size();
+    }
+    if(nEntries > U32_MAX){
+      cout << "ERROR " << n << "-gram table has too many entries (" << nEntries << ") for the mapped format" << endl;
+      return false;
+    }
+    header.nRows[n] = tables[n]->size();
+    header.nEntries[n] = nEntries;
+    header.keysOffset[n] = pos;
+    pos += AlignUp(header.nRows[n] * sizeof(U64));
+    header.rowStartOffset[n] = pos;
+    pos += AlignUp((header.nRows[n] + 1) * sizeof(U32));
+    header.idsOffset[n] = pos;
+    pos += AlignUp(nEntries * sizeof(IntKey));
+    header.probsOffset[n] = pos;
+    pos += AlignUp(nEntries * sizeof(double));
+    header.discountOffset[n] = pos;
+    pos += header.nRows[n] * sizeof(double);
+    header.backoffOffset[n] = pos;
+    pos += header.nRows[n] * sizeof(double);
+  }
+  header.fileSize = pos;
+
+  WritePadded(out, &header, sizeof(header));
+  WritePadded(out, strOffsets.data(), strOffsets.size() * sizeof(U32));
+  WritePadded(out, sortedKeys.data(), sortedKeys.size() * sizeof(IntKey));
+  WritePadded(out, pool.data(), pool.length());
+
+  for(n = 1; n <= NGRAMS; n++){
+    BuildFlatTable(*tables[n], store, flat);
+    WritePadded(out, store.keys.data(), store.keys.size() * sizeof(U64));
+    WritePadded(out, store.rowStart.data(), store.rowStart.size() * sizeof(U32));
+    WritePadded(out, store.ids.data(), store.ids.size() * sizeof(IntKey));
+    WritePadded(out, store.probs.data(), store.probs.size() * sizeof(double));
+    WritePadded(out, store.discount.data(), store.discount.size() * sizeof(double));
+    WritePadded(out, store.backoff.data(), store.backoff.size() * sizeof(double));
+  }
+
+  if(!out || ((U64)out.tellp() != header.fileSize)){
+    cout << "ERROR mapped model export to " << fname << " failed or was truncated" << endl;
+    return false;
+  }
+  out.close();
+
+  cout << "Exported mapped model to " << fname << " (" << header.fileSize << " bytes)" << endl;
+
+  return true;
+}
+
+MappedModel::MappedModel()
+{
+  base = NULL;
+  mapSize = 0;
+  header = NULL;
+  strOffsets = NULL;
+  sortedKeys = NULL;
+  pool = NULL;
+  memset(tables, 0, sizeof(tables));
+  memset(&lambdas, 0, sizeof(lambdas));
+}
+
+MappedModel::~MappedModel()
+{
+  Close();
+}
+
+void MappedModel::Close(void)
+{
+  if(base != NULL){
+    munmap((void*)base, mapSize);
+  }
+  base = NULL;
+  mapSize = 0;
+  header = NULL;
+  memset(tables, 0, sizeof(tables));
+}
+
+bool MappedModel::Open(const string& fname)
+{
+  int fd, n;
+  struct stat st;
+  void* addr;
+  bool valid;
+  const U32* rowStart;
+
+  Close();
+
+  fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0){
+    cout << "ERROR could not open mapped model: " << fname << endl;
+    return false;
+  }
+  if((fstat(fd, &st) != 0) || ((U64)st.st_size < sizeof(MappedHeader))){
+    cout << "ERROR mapped model " << fname << " is too small to be valid" << endl;
+    close(fd);
+    return false;
+  }
+
+  //shared, read-only: every process mapping this file shares the same page-cache pages
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(addr == MAP_FAILED){
+    cout << "ERROR mmap failed for mapped model: " << fname << endl;
+    return false;
+  }
+  base = (const char*)addr;
+  mapSize = st.st_size;
+  header = (const MappedHeader*)base;
+
+  //every array must lie inside the file, or a truncated or corrupt file would send each process that maps it out of bounds
+  valid = (header->magic == MAPPED_MAGIC) && (header->version == MAPPED_VERSION) && (header->fileSize == mapSize);
+  valid = valid && (header->maxKey >= 1) && (header->maxKey <= (U64)U16_MAX + 1) && (header->nWords < header->maxKey);
+  valid = valid && ArrayInFile(header->strOffsetsOffset, header->maxKey + 1, sizeof(U32), mapSize);
+  valid = valid && ArrayInFile(header->sortedKeysOffset, header->nWords, sizeof(IntKey), mapSize);
+  valid = valid && (header->poolOffset <= mapSize) && (header->poolSize <= mapSize - header->poolOffset);
+  for(n = 1; valid && (n <= NGRAMS); n++){
+    valid = (header->nRows[n] < U32_MAX) && (header->nEntries[n] <= U32_MAX);
+    valid = valid && ArrayInFile(header->keysOffset[n], header->nRows[n], sizeof(U64), mapSize);
+    valid = valid && ArrayInFile(header->rowStartOffset[n], header->nRows[n] + 1, sizeof(U32), mapSize);
+    valid = valid && ArrayInFile(header->idsOffset[n], header->nEntries[n], sizeof(IntKey), mapSize);
+    valid = valid && ArrayInFile(header->probsOffset[n], header->nEntries[n], sizeof(double), mapSize);
+    valid = valid && ArrayInFile(header->discountOffset[n], header->nRows[n], sizeof(double), mapSize);
+    valid = valid && ArrayInFile(header->backoffOffset[n], header->nRows[n], sizeof(double), mapSize);
+  }
+  if(!valid){
+    cout << "ERROR " << fname << " is not a valid mapped model (bad magic, version, size or section offsets)" << endl;
+    Close();
+    return false;
+  }
+
+  strOffsets = (const U32*)(base + header->strOffsetsOffset);
+  sortedKeys = (const IntKey*)(base + header->sortedKeysOffset);
+  pool = base + header->poolOffset;
+
+  //the row and string ends must agree with the header. The vocabulary is at most 64K entries, so its offsets and
+  //keys are checked whole; the table rows are not, as that would touch every page of a large model at open.
+  valid = (strOffsets[header->maxKey] == header->poolSize);
+  for(n = 0; valid && (n < (int)header->maxKey); n++){
+    valid = (strOffsets[n] <= strOffsets[n+1]);
+  }
+  for(n = 0; valid && (n < (int)header->nWords); n++){
+    valid = (sortedKeys[n] < header->maxKey);
+  }
+  for(n = 1; valid && (n <= NGRAMS); n++){
+    rowStart = (const U32*)(base + header->rowStartOffset[n]);
+    valid = (rowStart[0] == 0) && (rowStart[header->nRows[n]] == header->nEntries[n]);
+  }
+  if(!valid){
+    cout << "ERROR " << fname << " is not a valid mapped model (vocabulary or row offsets do not match the header)" << endl;
+    Close();
+    return false;
+  }
+  for(n = 0; n < NLAMBDAS; n++){
+    lambdas.l[n] = header->lambdas[n];
+  }
+  for(n = 1; n <= NGRAMS; n++){
+    tables[n].nRows = header->nRows[n];
+    tables[n].keys = (const U64*)(base + header->keysOffset[n]);
+    tables[n].rowStart = (const U32*)(base + header->rowStartOffset[n]);
+    tables[n].ids = (const IntKey*)(base + header->idsOffset[n]);
+    tables[n].probs = (const double*)(base + header->probsOffset[n]);
+    tables[n].discount = (const double*)(base + header->discountOffset[n]);
+    tables[n].backoff = (const double*)(base + header->backoffOffset[n]);
+  }
+
+  return true;
+}
+
+double MappedModel::GetProb(int nModel, U64 key, U16 subkey) const
+{
+  if((nModel < 1) || (nModel > NGRAMS)){
+    cout << "ERROR model " << nModel << " not found in MappedModel::GetProb" << endl;
+    return 0.0;
+  }
+  if(header == NULL){
+    return 0.0;
+  }
+
+  return GetFlatProb(tables[nModel], key, subkey);
+}
+
+double MappedModel::GetBackoffProb(int model, U64 key, IntKey word) const
+{
+  if((header == NULL) || (model < 1) || (model > NGRAMS)){
+    return 0.0;
+  }
+
+  return GetFlatBackoffProb(tables, model, key, word);
+}
+
+bool MappedModel::KeyToString(IntKey key, string& str) const
+{
+  if((header == NULL) || (key >= header->maxKey) || (strOffsets[key] == strOffsets[key+1])){
+    cout << "ERROR key " << key << " not found in mapped vocabulary." << endl;
+    return false;
+  }
+
+  str.assign(pool + strOffsets[key], strOffsets[key+1] - strOffsets[key]);
+
+  return true;
+}
+
+//binary search over the keys sorted by string; same ordering as std::string::compare, which built the index
+bool MappedModel::LookupKey(const string& word, IntKey& key) const
+{
+  U64 lo, hi, mid, len;
+  int cmp;
+  const char* str;
+
+  if(header == NULL){
+    return false;
+  }
+
+  lo = 0;
+  hi = header->nWords;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    str = pool + strOffsets[sortedKeys[mid]];
+    len = strOffsets[sortedKeys[mid]+1] - strOffsets[sortedKeys[mid]];
+    cmp = word.compare(0, string::npos, str, len);
+    if(cmp == 0){
+      key = sortedKeys[mid];
+      return true;
+    }
+    else if(cmp < 0){
+      hi = mid;
+    }
+    else{
+      lo = mid + 1;
+    }
+  }
+
+  return false;
+}
+
+//compares against the word's bytes in the string pool, without copying the word out
+bool MappedModel::WordHasPrefix(IntKey key, const string& prefix) const
+{
+  U64 len;
+
+  if((header == NULL) || (key >= header->maxKey)){
+    return false;
+  }
+  len = strOffsets[key+1] - strOffsets[key];
+
+  return (len >= prefix.length()) && (memcmp(pool + strOffsets[key], prefix.data(), prefix.length()) == 0);
+}
+
+//context-free completion: the words starting with prefix, which are one contiguous range of sortedKeys, ranked by
+//unigram probability. Appends at most k results, best first.
+void MappedModel::CompleteWord(const string& prefix, U32 k, ResultList& results) const
+{
+  U64 lo, hi, mid, first, len;
+  int cmp;
+  vector<ResultPair> cands;
+
+  if(header == NULL){
+    return;
+  }
+
+  //lower bound of prefix in string order
+  lo = 0;
+  hi = header->nWords;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    len = strOffsets[sortedKeys[mid]+1] - strOffsets[sortedKeys[mid]];
+    cmp = prefix.compare(0, string::npos, pool + strOffsets[sortedKeys[mid]], len);
+    if(cmp > 0){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+
+  for(first = lo; (first < header->nWords) && WordHasPrefix(sortedKeys[first], prefix); first++){
+    cands.push_back(ResultPair(sortedKeys[first], GetFlatUnigramProb(tables[1], sortedKeys[first])));
+  }
+  if(cands.size() > k){
+    std::partial_sort(cands.begin(), cands.begin() + k, cands.end(), [](const ResultPair& a, const ResultPair& b){
+      return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+    });
+    cands.resize(k);
+  }
+  else{
+    sort(cands.begin(), cands.end(), [](const ResultPair& a, const ResultPair& b){
+      return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+    });
+  }
+  results.insert(results.end(), cands.begin(), cands.end());
+}
+
+//Same interpolation and smoothing as NgramModel::Predict(), over the mapped flat rows.
+void MappedModel::Predict(const vector<IntKey>& keySeq, int i, ResultList& results, U32 topK) const
+{
+  int n;
+  U64 keys[NGRAMS+1], row;
+  bool found[NGRAMS+1];
+  FlatRowCursor cursors[NGRAMS+1];
+  const FlatTable& unigrams = tables[1];
+
+  if((i < 3) || (header == NULL)){ //index check
+    return;
+  }
+
+  keys[4] = NgramModel::MakeNgramModelKey(4, keySeq[i-3], keySeq[i-2], keySeq[i-1]);
+  keys[3] = NgramModel::MakeNgramModelKey(3, keySeq[i-2], keySeq[i-1]);
+  keys[2] = NgramModel::MakeNgramModelKey(2, keySeq[i-1]);
+
+  for(n = 2; n <= NGRAMS; n++){
+    found[n] = FindFlatRow(tables[n], keys[n], row);
+    cursors[n].id = cursors[n].end = tables[n].ids;
+    cursors[n].prob = tables[n].probs;
+    if(found[n]){
+      cursors[n].id = tables[n].ids + tables[n].rowStart[row];
+      cursors[n].end = tables[n].ids + tables[n].rowStart[row+1];
+      cursors[n].prob = tables[n].probs + tables[n].rowStart[row];
+    }
+  }
+
+  InterpolateRows(cursors[4], cursors[3], cursors[2], found, [&unigrams](IntKey id){
+    return GetFlatUnigramProb(unigrams, id);
+  }, lambdas.l, results, topK);
+}
+
+void MappedModel::GetProbBatch(int nModel, const U64 keys[], const U16 subkeys[], double out[], U32 n) const
+{
+  U32 q;
+
+  if((header == NULL) || (nModel < 1) || (nModel > NGRAMS)){
+    for(q = 0; q < n; q++){
+      out[q] = 0.0;
+    }
+    return;
+  }
+
+  GetFlatProbs(tables[nModel], keys, subkeys, n, out);
+}
+
+void MappedModel::PredictBatch(const vector<IntKey>& keySeq, int first, int count, ResultList results[]) const
+{
+  if(header == NULL){
+    return;
+  }
+
+  PredictFlatBatch(tables, lambdas.l, keySeq, first, count, results);
+}
@@ -0,0 +1,82 @@
+/*
+  Position-independent, read-only model file. NgramModel::ExportMappedModel() writes the normalized model once;
+  any number of worker processes then mmap it and share the same physical pages through the page cache, so
+  per-process overhead is this object plus whatever page-table entries the queries touch, independent of model size.
+
+  All references inside the file are byte offsets from its start, so it can be mapped at any address.
+  Layout (every section 8-byte aligned):
+    MappedHeader
+    vocabulary: U32 strOffset[maxKey+1] into the string pool (key k spans [strOffset[k],strOffset[k+1]) )
+                IntKey sortedKeys[nWords], keys ordered by their strings for string-to-key binary search
+                char pool[poolSize], the word strings back to back, not null terminated
+    per order 1..NGRAMS, a FlatTable (see nGram.hpp):
+                U64 keys[nRows], U32 rowStart[nRows+1], IntKey ids[nEntries], double probs[nEntries],
+                double discount[nRows], double backoff[nRows] (the NgramRow headers)
+
+  The file is native-endian; it is meant to be shared between processes on one host, not shipped across architectures.
+*/
+
+#ifndef MAPPED_MODEL_HPP
+#define MAPPED_MODEL_HPP
+
+#include "nGram.hpp"
+
+#define MAPPED_MAGIC 0x4c444f4d4d41524eULL  //"NRAMMODL"
+#define MAPPED_VERSION 2
+
+typedef struct mappedHeader{
+  U64 magic;
+  U64 version;
+  U64 fileSize;
+  U64 maxKey;           //keys are in [1,maxKey)
+  U64 nWords;
+  U64 strOffsetsOffset;
+  U64 sortedKeysOffset;
+  U64 poolOffset;
+  U64 poolSize;
+  double lambdas[NLAMBDAS];
+  U64 nRows[NGRAMS+1];  //index by ngram model number, as with NgramModel::stats
+  U64 nEntries[NGRAMS+1];
+  U64 keysOffset[NGRAMS+1];
+  U64 rowStartOffset[NGRAMS+1];
+  U64 idsOffset[NGRAMS+1];
+  U64 probsOffset[NGRAMS+1];
+  U64 discountOffset[NGRAMS+1];
+  U64 backoffOffset[NGRAMS+1];
+} MappedHeader;
+
+class MappedModel{
+  public:
+    lambdaSet lambdas;
+    FlatTable tables[NGRAMS+1];  //tables[1] is the unigram table, etc; tables[0] is unused
+
+    MappedModel();
+    ~MappedModel();
+
+    bool Open(const string& fname);
+    void Close(void);
+
+    //same semantics as the NgramModel methods of the same name, but const and safe for concurrent readers
+    double GetProb(int nModel, U64 key, U16 subkey) const;
+    double GetBackoffProb(int model, U64 key, IntKey word) const;
+    bool KeyToString(IntKey key, string& str) const;
+    bool LookupKey(const string& word, IntKey& key) const;
+    bool WordHasPrefix(IntKey key, const string& prefix) const;
+    void CompleteWord(const string& prefix, U32 k, ResultList& results) const;
+    void Predict(const vector<IntKey>& keySeq, int i, ResultList& results, U32 topK = 0) const;
+    void GetProbBatch(int nModel, const U64 keys[], const U16 subkeys[], double out[], U32 n) const;
+    void PredictBatch(const vector<IntKey>& keySeq, int first, int count, ResultList results[]) const;
+
+  private:
+    const char* base;
+    U64 mapSize;
+    const MappedHeader* header;
+    const U32* strOffsets;
+    const IntKey* sortedKeys;
+    const char* pool;
+
+    MappedModel(const MappedModel&);
+    MappedModel& operator=(const MappedModel&);
+};
+
+#endif
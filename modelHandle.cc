@@ -0,0 +1,123 @@
+#include "modelHandle.hpp"
+#include <thread>
+
+ModelReader::ModelReader(ModelHandle& handle) : owner(handle)
+{
+  slot = owner.PinSlot();
+  model = owner.current.load();
+}
+
+ModelReader::~ModelReader()
+{
+  owner.UnpinSlot(slot);
+}
+
+ModelHandle::ModelHandle(NgramModel* model)
+{
+  int i;
+
+  for(i = 0; i < MAX_READER_SLOTS; i++){
+    slots[i].store(EPOCH_IDLE);
+  }
+  globalEpoch.store(EPOCH_IDLE + 1);
+  if((model != NULL) && !model->tablesFrozen){
+    model->FreezeTables();
+  }
+  current.store(model);
+}
+
+//the handle must outlive its readers, so no synchronization is needed here
+ModelHandle::~ModelHandle()
+{
+  delete current.exchange(NULL);
+}
+
+/*
+  Announce the epoch this reader is entering. The slot is pinned before the model pointer is loaded (both seq_cst),
+  so any writer that swaps the pointer after our load must see our slot when it scans, and the epoch we pinned is
+  necessarily older than the one that writer advances to.
+  Start probing at a per-thread offset to keep concurrent readers off each other's slot cache lines.
+*/
+int ModelHandle::PinSlot(void)
+{
+  int i;
+  U64 idle, epoch;
+
+  i = (int)(std::hash<std::thread::id>()(std::this_thread::get_id()) % MAX_READER_SLOTS);
+  while(true){
+    if(slots[i].load(std::memory_order_relaxed) == EPOCH_IDLE){
+      idle = EPOCH_IDLE;
+      epoch = globalEpoch.load();
+      if(slots[i].compare_exchange_strong(idle,epoch)){
+        return i;
+      }
+    }
+    i = (i + 1) % MAX_READER_SLOTS;
+  }
+}
+
+void ModelHandle::UnpinSlot(int slot)
+{
+  slots[slot].store(EPOCH_IDLE, std::memory_order_release);
+}
+
+//waits until every reader slot is idle or was pinned at/after epoch. Writer side only.
+void ModelHandle::Synchronize(U64 epoch)
+{
+  int i;
+  U64 pinned;
+
+  for(i = 0; i < MAX_READER_SLOTS; i++){
+    pinned = slots[i].load();
+    while((pinned != EPOCH_IDLE) && (pinned < epoch)){
+      std::this_thread::yield();
+      pinned = slots[i].load();
+    }
+  }
+}
+
+void ModelHandle::Publish(NgramModel* model)
+{
+  NgramModel* old;
+  U64 epoch;
+  std::lock_guard<std::mutex> guard(writerLock);
+
+  //the snapshot is built before the model is visible; readers must never be the ones to build it
+  if((model != NULL) && !model->tablesFrozen){
+    model->FreezeTables();
+  }
+  old = current.exchange(model);
+  epoch = globalEpoch.fetch_add(1) + 1;
+
+  //queries that loaded the old model pinned an epoch < epoch; once they drain nobody can reach it
+  if(old != NULL){
+    Synchronize(epoch);
+    delete old;
+  }
+}
+
+U64 ModelHandle::Epoch(void)
+{
+  return globalEpoch.load();
+}
+
+void ModelHandle::Predict(const vector<IntKey>& keySeq, int i, ResultList& results)
+{
+  ModelReader reader(*this);
+
+  if(reader.Get() != NULL){
+    reader->Predict(keySeq,i,results);
+  }
+}
+
+double ModelHandle::GetProb(int nModel, U64 key, U16 subkey)
+{
+  ModelReader reader(*this);
+  double ret = 0.0;
+
+  if(reader.Get() != NULL){
+    ret = reader->GetProb(nModel,key,subkey);
+  }
+
+  return ret;
+}
@@ -0,0 +1,78 @@
+/*
+  A published, swappable handle to a trained NgramModel, so a retrained model can replace the serving one
+  without stopping query traffic. Readers never block: a query pins the current epoch in a reader slot,
+  loads the model pointer, runs, and clears its slot (two atomic stores and a CAS). A writer installs a new
+  model with a single pointer exchange, advances the epoch, and then waits until no reader slot is still
+  pinned to an epoch older than the swap before deleting the old model (the RCU synchronize pattern).
+
+  Only the writer ever waits, and retrains are rare, so this keeps the read path free of locks and reference
+  count cache-line ping-pong. Models handed to Publish() are owned by the handle from then on, and are frozen
+  (see NgramModel::FreezeTables()) before any reader can see them, so readers only ever read.
+
+  NOTE: at most MAX_READER_SLOTS queries can be in flight at once. A reader that finds every slot busy
+  just keeps scanning, which only happens if more threads than slots are querying simultaneously.
+*/
+
+#ifndef MODEL_HANDLE_HPP
+#define MODEL_HANDLE_HPP
+
+#include "nGram.hpp"
+#include <atomic>
+#include <mutex>
+
+#define MAX_READER_SLOTS 256
+#define EPOCH_IDLE 0  //slot value for a reader slot not currently pinned to any epoch
+
+class ModelHandle;
+
+//RAII read-side critical section. The model pointer is valid until the reader goes out of scope.
+class ModelReader{
+  public:
+    ModelReader(ModelHandle& handle);
+    ~ModelReader();
+
+    //readers share the model with every other query, so they only get const access to it
+    const NgramModel* operator->(void){ return model; }
+    const NgramModel& operator*(void){ return *model; }
+    const NgramModel* Get(void){ return model; }
+
+  private:
+    ModelHandle& owner;
+    const NgramModel* model;
+    int slot;
+
+    ModelReader(const ModelReader&);
+    ModelReader& operator=(const ModelReader&);
+};
+
+class ModelHandle{
+  public:
+    ModelHandle(NgramModel* model = NULL);
+    ~ModelHandle();
+
+    //freezes the new model's tables if they are not already, installs it, and frees the previous one once every
+    //in-flight query on it has drained. The model must not be changed after it is published.
+    void Publish(NgramModel* model);
+    U64 Epoch(void);
+
+    //read-side conveniences; each is one pinned critical section
+    void Predict(const vector<IntKey>& keySeq, int i, ResultList& results);
+    double GetProb(int nModel, U64 key, U16 subkey);
+
+  private:
+    friend class ModelReader;
+
+    std::atomic<NgramModel*> current;
+    std::atomic<U64> globalEpoch;
+    std::atomic<U64> slots[MAX_READER_SLOTS];
+    std::mutex writerLock;  //serializes writers only; readers never touch it
+
+    int PinSlot(void);
+    void UnpinSlot(int slot);
+    void Synchronize(U64 epoch);
+
+    ModelHandle(const ModelHandle&);
+    ModelHandle& operator=(const ModelHandle&);
+};
+
+#endif
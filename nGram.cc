@@ -1,8 +1,53 @@
 #include "nGram.hpp"
+#include "workPool.hpp"
+#include "unicodeText.hpp"
+#include <thread>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mutex>
+#include <condition_variable>
+#include <cctype>
+#include <cerrno>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+double WallSeconds(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+//bytes needed to LEB128 varint encode n (7 bits per byte)
+static U32 VarintBytes(U64 n)
+{
+  U32 bytes = 1;
+
+  while(n >= 0x80){
+    n >>= 7;
+    bytes++;
+  }
 
-NgramModel::NgramModel()
+  return bytes;
+}
+
+NgramModel::NgramModel() : unigramTable(TableAllocator(&arena)), bigramTable(TableAllocator(&arena)), trigramTable(TableAllocator(&arena)),
+  quadgramTable(TableAllocator(&arena)), KeyStringTable(KeyStringMap::allocator_type(&arena)), StringKeyTable(StringKeyMap::allocator_type(&arena))
 {
   idCounter = 1;
+  ingestThreads = (int)std::thread::hardware_concurrency() - 1;  //leave a core for the reader thread
+  if(ingestThreads < 1){
+    ingestThreads = 1;
+  }
+  frequencyRankedKeys = true;
+  tablesFrozen = false;
+  memset(frozen, 0, sizeof(frozen));
   phraseDelimiters = "\".?!#;:)(";  // octothorpe is user defined
   rawDelimiters = "\"?!#;:)(, "; //all but period
   wordDelimiters = ", ";
@@ -16,56 +61,89 @@ NgramModel::NgramModel()
     lambdas.l[i] = 1.0;
   }
 
+  memset(stats, 0, sizeof(stats));
+  ResetAccuracy();
   lambdas.l[1] = 0.05;
   lambdas.l[2] = 0.3;
   lambdas.l[3] = 0.4;
   lambdas.l[4] = 0.2;
 }
 
+//the vocabulary's strings own heap memory, so only its nodes come from the arena; it is at most 64K words anyway
 NgramModel::~NgramModel()
 {
-
-  //none of this is necessary, since the destructors of these will be called anyway when the main object goes out of scope...
   KeyStringTable.clear();
   StringKeyTable.clear();
 
-  unigramTable.clear();
-  bigramTable.clear();
-  trigramTable.clear();
-  quadgramTable.clear();
+  ReleaseTable(unigramTable);
+  ReleaseTable(bigramTable);
+  ReleaseTable(trigramTable);
+  ReleaseTable(quadgramTable);
+}
+
+/*
+  Empties a table without walking it, when all of its nodes (rows and their entries alike) are in the model's arena:
+  the old tree is simply left for the arena to unmap. This is what makes tearing down a large model a few munmap()
+  calls instead of tens of millions of frees. A table that was swapped out of the arena is cleared as usual.
+*/
+void NgramModel::ReleaseTable(NgramTable& table)
+{
+  if(table.get_allocator().arena != &arena){
+    table.clear();
+    return;
+  }
+
+  new (&table) NgramTable(TableAllocator(&arena));  //reuses the storage; the abandoned tree has nothing to free but arena memory
 }
 
-void NgramModel::WordToKeySequence(vector<string>& wordVec, vector<IntKey>& keySequence)
+/*
+  Keys a word sequence for evaluation (testing, held-out data, benchmarks) without touching the model: words outside
+  the vocabulary become OOV_KEY rather than being allocated keys, so test text neither grows the vocabulary nor uses
+  up the 16-bit id space, and a trained model can be shared by any number of threads keying text at once (only const
+  lookups are made). Returns the number of OOV words; wordVec is consumed.
+*/
+U64 NgramModel::WordToKeySequence(vector<string>& wordVec, vector<IntKey>& keySequence) const
 {
   int i;
+  U64 nOov = 0;
   IntKey wordKey;
 
   //convert the string/word sequence to a sequence of integer keys
-  for(i = 0; i < wordVec.size()-NGRAM-1; i++){
-    wordKey = StringToKey(wordVec[i]);
+  for(i = 0; i + NGRAM + 1 < (int)wordVec.size(); i++){
+    if(!LookupKey(wordVec[i],wordKey)){
+      wordKey = OOV_KEY;
+      nOov++;
+    }
     keySequence.push_back(wordKey);
   }
   wordVec.clear();
+
+  return nOov;
 }
 
 //prunes words of frequency<=1 from some very long sequence of words. Typically used
 //to reduce the number of keys that need to be stored (eg, to fit al keys in U16, for fewer than 65k unique words, thereby allowing 64bit 4-gram table keys)
 void NgramModel::PruneSequence(vector<string>& wordVec)
 {
-  U32 i, counter1, counter2;
+  vector<vector<string> > docs(1);
+
+  docs[0].swap(wordVec);
+  PruneDocuments(docs);
+  wordVec.swap(docs[0]);
+}
+
+//same as PruneSequence(), but word frequencies are taken over the whole multi-document corpus
+void NgramModel::PruneDocuments(vector<vector<string> >& docs)
+{
+  U32 i, d, counter1, counter2;
   map<string,U32> freqMap;
   map<string,U32>::iterator it;
   vector<string> tempVec;
 
-  //cout << "wordVec.size()=" << wordVec.size() << endl;
   cout << "Beginning low-frequency term (<= 1 count) pruning..." << endl;
-  for(i = 0; i < wordVec.size(); i++){
-    it = freqMap.find(wordVec[i]);
-    if(it == freqMap.end()){
-      freqMap[wordVec[i]] = 1;
-    }
-    else{
-      freqMap[wordVec[i]]++;
+  for(d = 0; d < docs.size(); d++){
+    for(i = 0; i < docs[d].size(); i++){
+      freqMap[docs[d][i]]++;
     }
   }
   counter1 = counter2 = 0;
@@ -80,84 +158,471 @@ void NgramModel::PruneSequence(vector<string>& wordVec)
   //cout << "Nunique=" << freqMap.size() << "  Nelements<1=" << counter1 << "  Nelements<2=" << counter2 << endl;
 
   //now filter infrequent terms
-  for(i = 0; i < wordVec.size(); i++){
-    if(freqMap[wordVec[i]] > 1){
-      tempVec.push_back(wordVec[i]);
+  for(d = 0; d < docs.size(); d++){
+    tempVec.clear();
+    for(i = 0; i < docs[d].size(); i++){
+      if(freqMap[docs[d][i]] > 1){
+        tempVec.push_back(docs[d][i]);
+      }
     }
-  }
-  wordVec.clear();
-  for(i = 0; i < tempVec.size(); i++){
-    wordVec.push_back(tempVec[i]);
+    docs[d].swap(tempVec);
   }
   cout << "Prune completed. " << counter1 << " elements of " << freqMap.size() << " unique elements eliminated, for " << (freqMap.size()-counter1) << " keys" << endl;
-  //cout << "done. wordVec.size()=" << wordVec.size() << endl;
 }
 
-void NgramModel::Train(const string& fname)
+//Trains on a FILE_DELIMITER separated list of files, directories and/or globs, eg "a.txt|corpus/|more/*.txt"
+void NgramModel::Train(const string& fname, const vector<string>& heldOut)
 {
-  int i;
-  IntKey wordKey;
-  U64 bigramKey, trigramKey, quadgramKey;
-  vector<string> wordVec;
-  vector<IntKey> keySequence;
+  U32 i, prev;
+  vector<string> paths;
 
-  TextToWordSequence(fname,wordVec);
-  PruneSequence(wordVec);  //very brutish, but see header. Drops very unlikely terms (freuency==1) from the sequence, freeing many int-keys
-  WordToKeySequence(wordVec,keySequence);
+  for(prev = i = 0; i <= fname.length(); i++){
+    if((i == fname.length()) || (fname[i] == FILE_DELIMITER)){
+      if(i > prev){
+        paths.push_back(fname.substr(prev, i - prev));
+      }
+      prev = i + 1;
+    }
+  }
 
-  cout << "sequence build complete. keySequence.size()=" << keySequence.size() << " KeyStringTable.size()=" << KeyStringTable.size() << " StringKeyTable.size()=" << StringKeyTable.size() << endl;
-  cout << "Building n-gram models..." << endl;
+  Train(paths,heldOut);
+}
+
+/*
+  Multi-file training. Each file is a separate document: n-grams never span two of them.
+  Files, and chunks of large files, are tokenized on a work-stealing pool so a few huge files don't leave the
+  other cores idle; documents are then keyed and counted on the same pool into per-worker tables, which are
+  merged at the end (one thread per order). The lambdas are fit to the heldOut token stream, eg from SplitCorpus().
+*/
+void NgramModel::Train(const vector<string>& paths, const vector<string>& heldOut)
+{
+  vector<vector<string> > docs;
+  WorkStealingPool pool;
+
+  if(!TokenizeCorpus(paths,docs,pool)){
+    return;
+  }
 
-  //build the models, based on the integer key sequence
-  for(i = 0; i < keySequence.size()-NGRAM-1; i++){
-    //uni
-    UpdateUnigramModel(unigramTable,keySequence[i]);
+  TrainDocuments(docs,heldOut,pool);
+}
 
-    //bi
-    bigramKey = MakeNgramModelKey(2,keySequence[i]);
-    UpdateNgramModel(bigramTable,bigramKey,keySequence[i+1]);
+//trains on the training lines of a split as one document, fitting the lambdas to its held-out lines
+void NgramModel::Train(CorpusSplit& split)
+{
+  vector<vector<string> > docs(1);
+  WorkStealingPool pool;
 
-    //tri
-    trigramKey = MakeNgramModelKey(3,keySequence[i],keySequence[i+1]);
-    UpdateNgramModel(trigramTable,trigramKey,keySequence[i+2]);
+  if(split.words[SPLIT_TRAIN].empty()){
+    cout << "ERROR no training lines in corpus split" << endl;
+    return;
+  }
 
-    //quad
-    quadgramKey = MakeNgramModelKey(4,keySequence[i],keySequence[i+1],keySequence[i+2]);
-    UpdateNgramModel(quadgramTable,quadgramKey,keySequence[i+3]);
+  docs[0].swap(split.words[SPLIT_TRAIN]);
+  TrainDocuments(docs,split.words[SPLIT_HELDOUT],pool);
+}
 
-    if(i % 10000 == 9999){
-      cout << "\r" << ((double)(i * 100) / (double)keySequence.size()) << "% complete        " << flush;
-    }
+//prunes, keys and counts tokenized documents, then processes the tables; docs is consumed
+void NgramModel::TrainDocuments(vector<vector<string> >& docs, const vector<string>& heldOut, WorkStealingPool& pool)
+{
+  vector<vector<IntKey> > keyDocs;
+
+  PruneDocuments(docs);  //very brutish, but see header. Drops very unlikely terms (freuency==1) from the sequence, freeing many int-keys
+  DocumentsToKeySequences(docs,keyDocs,pool);
+  if(frequencyRankedKeys){
+    RankKeysByFrequency(keyDocs,pool);
   }
+
+  cout << "sequence build complete. documents=" << keyDocs.size() << " KeyStringTable.size()=" << KeyStringTable.size() << " StringKeyTable.size()=" << StringKeyTable.size() << endl;
+  cout << "Building n-gram models..." << endl;
+  CountDocuments(keyDocs,pool);
   cout << "\nN-gram model training completed, processing tables..." << endl;
 
+  ProcessTables(heldOut);
+}
+
+//normalizes freshly counted tables into the final model: probabilities, backoff weights, flat snapshot, lambdas
+void NgramModel::ProcessTables(const vector<string>& heldOut)
+{
+  U64 nOov;
+  vector<string> wordVec(heldOut);
+  vector<IntKey> keySeq;
+
   //converts all tables to conditional log-probability space. This means lower values (logs) are more likely, which can be problematic
   //for linear interpolation, which sums estimates from multiple models: if a model returns no value (zero), then it boosts
   //that particular prediction's value by having the effect of lowering the sum.
   //TablesToLogSpace();
   NormalizeTables();
+  ComputeBackoffWeights();
+  PrintModelStats();
+  FreezeTables();
   cout << "Processing complete." << endl;
 
   cout << "Beginning lambda expectation-maximization..." << endl;
-  LambdaEM();
+  nOov = WordToKeySequence(wordVec,keySeq);
+  cout << "held-out words: " << keySeq.size() << ", OOV: " << nOov << " (" << (keySeq.empty() ? 0.0 : (100.0 * nOov / keySeq.size())) << "%)" << endl;
+  LambdaEM(keySeq);
+}
+
+//reads and tokenizes every file under paths into docs, one document per file; false if there was nothing to read
+bool NgramModel::TokenizeCorpus(const vector<string>& paths, vector<vector<string> >& docs, WorkStealingPool& pool)
+{
+  U32 i;
+  U64 nWords;
+  vector<string> files;
+  vector<CorpusChunk> chunks;
+  vector<U64> costs;
+  vector<vector<string> > chunkWords;
+
+  ExpandCorpusPaths(paths,files);
+  if(files.size() == 0){
+    cout << "ERROR no training files found" << endl;
+    return false;
+  }
+  ChunkCorpus(files,chunks);
+  cout << "Tokenizing " << files.size() << " files (" << chunks.size() << " chunks) on " << pool.NumWorkers() << " threads..." << endl;
+
+  chunkWords.resize(chunks.size());
+  for(i = 0; i < chunks.size(); i++){
+    costs.push_back(chunks[i].end - chunks[i].start);
+  }
+  pool.Run(costs, [&](int task, int worker){
+    TextRangeToWordSequence(chunks[task].fname, chunks[task].start, chunks[task].end, chunkWords[task]);
+  });
+
+  //stitch each file's chunks back together, in order; chunks are generated in file then offset order
+  nWords = 0;
+  docs.resize(files.size());
+  for(i = 0; i < chunks.size(); i++){
+    vector<string>& doc = docs[chunks[i].doc];
+    if(doc.empty()){
+      doc.swap(chunkWords[i]);
+    }
+    else{
+      doc.insert(doc.end(), chunkWords[i].begin(), chunkWords[i].end());
+    }
+    nWords += chunkWords[i].size();
+    vector<string>().swap(chunkWords[i]);
+  }
+  cout << "Tokenized " << nWords << " words" << endl;
+
+  return true;
+}
+
+static bool HasGlobChars(const string& path)
+{
+  return path.find_first_of("*?[") != string::npos;
+}
+
+//expands globs and recurses into directories; the result is sorted within each directory so training is deterministic
+void NgramModel::ExpandCorpusPaths(const vector<string>& paths, vector<string>& files)
+{
+  U32 i;
+  size_t j;
+  struct stat st;
+  glob_t globbed;
+  DIR* dir;
+  struct dirent* entry;
+  vector<string> expanded, children;
+  string name;
+
+  for(i = 0; i < paths.size(); i++){
+    if(HasGlobChars(paths[i])){
+      expanded.clear();
+      if(glob(paths[i].c_str(), 0, NULL, &globbed) == 0){
+        for(j = 0; j < globbed.gl_pathc; j++){
+          expanded.push_back(globbed.gl_pathv[j]);
+        }
+      }
+      else{
+        cout << "WARN no files match " << paths[i] << endl;
+      }
+      globfree(&globbed);
+      ExpandCorpusPaths(expanded,files);
+    }
+    else if(stat(paths[i].c_str(), &st) != 0){
+      cout << "ERROR could not stat corpus path: " << paths[i] << endl;
+    }
+    else if(S_ISDIR(st.st_mode)){
+      children.clear();
+      dir = opendir(paths[i].c_str());
+      while((dir != NULL) && ((entry = readdir(dir)) != NULL)){
+        name = entry->d_name;
+        if((name != ".") && (name != "..")){
+          children.push_back(paths[i] + "/" + name);
+        }
+      }
+      if(dir != NULL){
+        closedir(dir);
+      }
+      sort(children.begin(), children.end());
+      ExpandCorpusPaths(children,files);
+    }
+    else if(S_ISREG(st.st_mode)){
+      files.push_back(paths[i]);
+    }
+  }
+}
+
+//splits files larger than CORPUS_CHUNK_SZ into byte ranges; ranges are realigned to line starts when read
+void NgramModel::ChunkCorpus(const vector<string>& files, vector<CorpusChunk>& chunks)
+{
+  U32 i;
+  U64 pos;
+  struct stat st;
+  CorpusChunk chunk;
+
+  for(i = 0; i < files.size(); i++){
+    if(stat(files[i].c_str(), &st) != 0){
+      continue;
+    }
+    chunk.fname = files[i];
+    chunk.doc = i;
+    pos = 0;
+    do{
+      chunk.start = pos;
+      pos += CORPUS_CHUNK_SZ;
+      chunk.end = (pos < (U64)st.st_size) ? pos : (U64)st.st_size;
+      chunks.push_back(chunk);
+    }while(pos < (U64)st.st_size);
+  }
+}
+
+/*
+  Streams fname once, tokenizing each non-blank line straight into the token stream of the set the rule assigns it
+  to, so the sets are never written out, re-read or re-parsed. Lines longer than BUFSIZE go through in BUFSIZE pieces.
+*/
+bool NgramModel::SplitCorpus(const string& fname, const SplitRule& rule, CorpusSplit& split)
+{
+  int set;
+  U32 residue;
+  U64 i, lineNum;
+  string line;
+  fstream infile;
+  bool heldOutEmpty = rule.heldOutFirst > rule.heldOutLast;
+  bool testEmpty = rule.testFirst > rule.testLast;
+
+  if((rule.period == 0) || (!heldOutEmpty && (rule.heldOutLast >= rule.period)) || (!testEmpty && (rule.testLast >= rule.period))){
+    cout << "ERROR split rule residues out of range for period " << rule.period << endl;
+    return false;
+  }
+  if(!heldOutEmpty && !testEmpty && (rule.heldOutFirst <= rule.testLast) && (rule.testFirst <= rule.heldOutLast)){
+    cout << "ERROR split rule held-out and test residues overlap" << endl;
+    return false;
+  }
+
+  infile.open(fname.c_str(), ios::in);
+  if(!infile){
+    cout << "ERROR could not open file: " << fname << endl;
+    return false;
+  }
+
+  for(set = 0; set < SPLIT_SETS; set++){
+    split.words[set].clear();
+    split.lines[set] = 0;
+  }
+
+  lineNum = 0;
+  while(getline(infile,line)){
+    for(i = 0; (i < line.length()) && isspace((unsigned char)line[i]); i++);
+    if(i == line.length()){
+      continue;
+    }
+
+    lineNum++;
+    residue = lineNum % rule.period;
+    if((residue >= rule.heldOutFirst) && (residue <= rule.heldOutLast)){
+      set = SPLIT_HELDOUT;
+    }
+    else if((residue >= rule.testFirst) && (residue <= rule.testLast)){
+      set = SPLIT_TEST;
+    }
+    else{
+      set = SPLIT_TRAIN;
+    }
+
+    split.lines[set]++;
+    LongLineToWords(line.data(), line.length(), split.words[set]);
+  }
+  infile.close();
+
+  cout << "Split " << fname << " (lines/words): train " << split.lines[SPLIT_TRAIN] << "/" << split.words[SPLIT_TRAIN].size()
+       << "  held-out " << split.lines[SPLIT_HELDOUT] << "/" << split.words[SPLIT_HELDOUT].size()
+       << "  test " << split.lines[SPLIT_TEST] << "/" << split.words[SPLIT_TEST].size() << endl;
+
+  return true;
+}
+
+//a rule holding out about heldOutFraction and testing on about testFraction of the lines, spread evenly through the file
+SplitRule NgramModel::RatioSplit(double heldOutFraction, double testFraction)
+{
+  U32 nHeldOut, nTest;
+  SplitRule rule;
+
+  if((heldOutFraction < 0.0) || (testFraction < 0.0) || (heldOutFraction + testFraction > 1.0)){
+    cout << "ERROR split fractions " << heldOutFraction << " and " << testFraction << " out of range, training on everything" << endl;
+    heldOutFraction = testFraction = 0.0;
+  }
+
+  nHeldOut = (U32)(heldOutFraction * SPLIT_RATIO_PERIOD + 0.5);
+  nTest = (U32)(testFraction * SPLIT_RATIO_PERIOD + 0.5);
+  if(nHeldOut + nTest > SPLIT_RATIO_PERIOD){
+    nTest = SPLIT_RATIO_PERIOD - nHeldOut;
+  }
+
+  //the last residues of each cycle test, the ones just before them are held out; empty ranges have first > last
+  rule.period = SPLIT_RATIO_PERIOD;
+  rule.testFirst = SPLIT_RATIO_PERIOD - nTest;
+  rule.testLast = SPLIT_RATIO_PERIOD - 1;
+  rule.heldOutFirst = rule.testFirst - nHeldOut;
+  rule.heldOutLast = rule.testFirst - 1;
+  if(nHeldOut == 0){
+    rule.heldOutFirst = 1;
+    rule.heldOutLast = 0;
+  }
+
+  return rule;
+}
+
+/*
+  Keys are allocated in first-appearance order, as WordToKeySequence() does, but only each document's unique words
+  go through the (serial) allocator. The per-document uniquing and the final encoding are parallel, since
+  StringKeyTable is only read while they run.
+*/
+void NgramModel::DocumentsToKeySequences(vector<vector<string> >& docs, vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool)
+{
+  U32 d, i;
+  IntKey key;
+  vector<U64> costs;
+  vector<vector<string> > uniqueWords(docs.size());
+
+  for(d = 0; d < docs.size(); d++){
+    costs.push_back(docs[d].size());
+  }
+  pool.Run(costs, [&](int task, int worker){
+    unordered_set<string> seen;
+    for(U32 j = 0; j < docs[task].size(); j++){
+      if(seen.insert(docs[task][j]).second){
+        uniqueWords[task].push_back(docs[task][j]);
+      }
+    }
+  });
+
+  for(d = 0; d < docs.size(); d++){
+    for(i = 0; i < uniqueWords[d].size(); i++){
+      if(!AllocKey(uniqueWords[d][i],key)){
+        cout << "ERROR could not alloc new key in DocumentsToKeySequences" << endl;
+      }
+    }
+    vector<string>().swap(uniqueWords[d]);
+  }
+
+  keyDocs.resize(docs.size());
+  pool.Run(costs, [&](int task, int worker){
+    StringKeyMapIt it;
+    keyDocs[task].reserve(docs[task].size());
+    for(U32 j = 0; j < docs[task].size(); j++){
+      it = StringKeyTable.find(docs[task][j]);
+      keyDocs[task].push_back((it != StringKeyTable.end()) ? it->second : 0);
+    }
+    vector<string>().swap(docs[task]);
+  });
+}
+
+//counts every complete n-gram window inside one document into the given tables (indexed by model number)
+void NgramModel::CountSequence(const vector<IntKey>& keySeq, NgramTable* tables[])
+{
+  U64 i;
+
+  for(i = 0; i + NGRAM <= keySeq.size(); i++){
+    UpdateUnigramModel(*tables[1],keySeq[i]);
+    UpdateNgramModel(*tables[2],MakeNgramModelKey(2,keySeq[i]),keySeq[i+1]);
+    UpdateNgramModel(*tables[3],MakeNgramModelKey(3,keySeq[i],keySeq[i+1]),keySeq[i+2]);
+    UpdateNgramModel(*tables[4],MakeNgramModelKey(4,keySeq[i],keySeq[i+1],keySeq[i+2]),keySeq[i+3]);
+  }
+}
+
+void NgramModel::CountDocuments(const vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool)
+{
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+
+  tablesFrozen = false;
+  CountDocuments(keyDocs,pool,tables);
+}
+
+/*
+  Counts documents into per-worker tables, then merges those into modelTables (by order) with one thread per order.
+  Merged worker tables in this model's arena are abandoned (ReleaseTable()) rather than freed: freeing walks every
+  node through the arena lock, and would put the other mergers' allocations on the free lists behind the same lock.
+  Their memory stays mapped until the model goes, so counting costs up to the worker tables' size again in arena
+  footprint, once per CountDocuments() call.
+*/
+void NgramModel::CountDocuments(const vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool, NgramTable* modelTables[])
+{
+  int w, n;
+  U32 d;
+  vector<U64> costs;
+  vector<std::thread> mergers;
+  vector<NgramTable> workerTables;
+
+  //the workers count into tables on the model tables' allocators, so the first of them can be swapped in whole
+  for(w = 0; w < pool.NumWorkers(); w++){
+    for(n = 0; n <= NGRAMS; n++){
+      workerTables.push_back(NgramTable(modelTables[(n > 0) ? n : 1]->get_allocator()));
+    }
+  }
+  for(d = 0; d < keyDocs.size(); d++){
+    costs.push_back(keyDocs[d].size());
+  }
+  pool.Run(costs, [&](int task, int worker){
+    NgramTable* tables[NGRAMS+1];
+    for(int k = 0; k <= NGRAMS; k++){
+      tables[k] = &workerTables[worker * (NGRAMS + 1) + k];
+    }
+    CountSequence(keyDocs[task],tables);
+  });
+
+  for(n = 1; n <= NGRAMS; n++){
+    mergers.push_back(std::thread([&,n](){
+      OuterTableIt outer;
+      InnerTableIt inner;
+      for(int k = 0; k < pool.NumWorkers(); k++){
+        NgramTable& local = workerTables[k * (NGRAMS + 1) + n];
+        if(modelTables[n]->empty()){
+          modelTables[n]->swap(local);
+          continue;
+        }
+        for(outer = local.begin(); outer != local.end(); ++outer){
+          NgramRow& row = (*modelTables[n])[outer->first];
+          for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+            row[inner->first] += inner->second;
+          }
+        }
+        ReleaseTable(local);
+      }
+    }));
+  }
+  for(w = 0; w < (int)mergers.size(); w++){
+    mergers[w].join();
+  }
 }
 
 U64 NgramModel::MakeNgramModelKey(int model, IntKey w1, IntKey w2, IntKey w3)
 {
   U64 ret = 0;
 
+  //each word keeps all 16 bits, so a context's key with its first word masked off is the key of its suffix context
   switch(model){
     case 1:
     case 2:
-        ret = 0x000000FF & (U64)w1;
+        ret = 0x000000000000FFFF & (U64)w1;
       break;
     case 3:
         ret = ((U64)w1 << 16) | (U64)w2;
-        ret &= 0x0000FFFF;
+        ret &= 0x00000000FFFFFFFF;
       break;
     case 4:
         ret = ((U64)w1 << 32) | ((U64)w2 << 16) | (U64)w3;
-        ret &= 0x00FFFFFF;
+        ret &= 0x0000FFFFFFFFFFFF;
       break;
     default:
         cout << "ERROR model# " << model << " not found in BuildNgramModelKey()" << endl;
@@ -167,6 +632,145 @@ U64 NgramModel::MakeNgramModelKey(int model, IntKey w1, IntKey w2, IntKey w3)
   return ret;
 }
 
+/*
+  AllocKey() hands out ids in order of first appearance, which scatters the hottest words ("the", "of", ...) across
+  the key space. Renumbering by descending corpus frequency puts the most used rows and entries next to each other
+  in every table, and keeps the deltas between the sorted ids of a row small (see PrintModelStats()).
+  Ties keep their first-appearance order, so the ranking is deterministic.
+*/
+void NgramModel::RankKeysByFrequency(vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool)
+{
+  int w;
+  U32 d, k;
+  vector<U64> costs;
+  vector<vector<U64> > workerFreqs(pool.NumWorkers(), vector<U64>(idCounter, 0));
+  vector<U64> freqs(idCounter, 0);
+
+  for(d = 0; d < keyDocs.size(); d++){
+    costs.push_back(keyDocs[d].size());
+  }
+  pool.Run(costs, [&](int task, int worker){
+    vector<U64>& freq = workerFreqs[worker];
+    for(U32 j = 0; j < keyDocs[task].size(); j++){
+      freq[keyDocs[task][j]]++;
+    }
+  });
+  for(w = 0; w < pool.NumWorkers(); w++){
+    for(k = 0; k < idCounter; k++){
+      freqs[k] += workerFreqs[w][k];
+    }
+  }
+
+  RenumberByFrequency(freqs,keyDocs,pool);
+}
+
+//renumbers keys 1.. in descending freqs[key] order (ties by current key) through RemapKeys()
+void NgramModel::RenumberByFrequency(const vector<U64>& freqs, vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool)
+{
+  U32 k;
+  vector<IntKey> order;
+  vector<IntKey> newKey(idCounter, 0);
+
+  for(k = 1; k < idCounter; k++){
+    order.push_back((IntKey)k);
+  }
+  std::stable_sort(order.begin(), order.end(), [&freqs](IntKey a, IntKey b){ return freqs[a] > freqs[b]; });
+  for(k = 0; k < order.size(); k++){
+    newKey[order[k]] = (IntKey)(k + 1);
+  }
+
+  RemapKeys(newKey,keyDocs,pool);
+  cout << "Keys ranked by frequency, " << order.size() << " keys" << endl;
+}
+
+//renumbers every key k to newKey[k] in the vocabulary, the key sequences and any tables already built. Key 0 stays 0.
+void NgramModel::RemapKeys(const vector<IntKey>& newKey, vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool)
+{
+  U32 d;
+  KeyStringMap remappedStrings(KeyStringTable.get_allocator());
+  KeyStringMapIt kit;
+  StringKeyMapIt sit;
+  vector<U64> costs;
+
+  tablesFrozen = false;
+
+  for(kit = KeyStringTable.begin(); kit != KeyStringTable.end(); ++kit){
+    remappedStrings[newKey[kit->first]].swap(kit->second);
+  }
+  KeyStringTable.swap(remappedStrings);
+  for(sit = StringKeyTable.begin(); sit != StringKeyTable.end(); ++sit){
+    sit->second = newKey[sit->second];
+  }
+
+  for(d = 0; d < keyDocs.size(); d++){
+    costs.push_back(keyDocs[d].size());
+  }
+  pool.Run(costs, [&](int task, int worker){
+    for(U32 j = 0; j < keyDocs[task].size(); j++){
+      keyDocs[task][j] = newKey[keyDocs[task][j]];
+    }
+  });
+
+  RemapTable(unigramTable,1,newKey);
+  RemapTable(bigramTable,2,newKey);
+  RemapTable(trigramTable,3,newKey);
+  RemapTable(quadgramTable,4,newKey);
+}
+
+//rebuilds an order-model table under new keys: each 16-bit word field of the context key, and every entry id
+void NgramModel::RemapTable(NgramTable& table, int model, const vector<IntKey>& newKey)
+{
+  int f, nFields;
+  U64 key;
+  NgramTable remapped(table.get_allocator());
+  OuterTableIt outer;
+  InnerTableIt inner;
+
+  nFields = (model > 1) ? (model - 1) : 1;  //unigram rows are keyed by the word itself
+  for(outer = table.begin(); outer != table.end(); ++outer){
+    key = 0;
+    for(f = 0; f < nFields; f++){
+      key |= (U64)newKey[(outer->first >> (16 * f)) & 0xFFFF] << (16 * f);
+    }
+    NgramRow& row = remapped[key];
+    row.count = outer->second.count;
+    row.discount = outer->second.discount;
+    row.unseenMass = outer->second.unseenMass;
+    row.backoff = outer->second.backoff;
+    row.logBackoff = outer->second.logBackoff;
+    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+      row[newKey[inner->first]] = inner->second;
+    }
+  }
+  table.swap(remapped);
+}
+
+//size of a table's word ids if each row's sorted id list were delta + varint coded, the first id against 0
+U64 NgramModel::DeltaVarintIdBytes(NgramTable& table)
+{
+  U64 bytes;
+  IntKey prev;
+  OuterTableIt outer;
+  InnerTableIt inner;
+
+  bytes = 0;
+  for(outer = table.begin(); outer != table.end(); ++outer){
+    prev = 0;
+    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+      bytes += VarintBytes(inner->first - prev);
+      prev = inner->first;
+    }
+  }
+
+  return bytes;
+}
+
+//key of the order (model-1) context that backs off from this order-model context key, eg "a b c" -> "b c"
+U64 NgramModel::SuffixContextKey(int model, U64 key)
+{
+  return (model > 2) ? (key & ((1ULL << (16 * (model - 2))) - 1)) : 0;
+}
+
 //a special case, since the unigram model only tracks, well, unigrams. There are no subkeys, the primary keys are stored redundantly as subkeys
 void NgramModel::UpdateNgramModel(NgramTable& table, U64 key, IntKey nextWord)
 {
@@ -195,23 +799,64 @@ void NgramModel::UpdateUnigramModel(NgramTable& unigrams, IntKey key)
 
 void NgramModel::Test(const string& fname)
 {
-  int i;
   vector<string> wordVec;
-  vector<IntKey> keySequence;
-  ResultList results;
 
   TextToWordSequence(fname,wordVec);
-  WordToKeySequence(wordVec,keySequence);
+  Test(wordVec);
+}
+
+//tests on a token stream, eg the test set of SplitCorpus(); words is consumed
+void NgramModel::Test(vector<string>& words)
+{
+  int i, j, count, nPositions;
+  U64 nOov;
+  vector<IntKey> keySequence;
+  U32 ranks[PREDICT_BATCH_SZ];
+
+  nOov = WordToKeySequence(words,keySequence);
+
+  //only the rank of the actual word is needed, so this goes through the sort-free RankBatch(), PREDICT_BATCH_SZ contexts at a time
+  nPositions = (keySequence.size() > NGRAM + 1) ? (int)(keySequence.size() - NGRAM - 1) : 0;
+  for(i = 0; i < nPositions; i += count){
+    count = (nPositions - i < PREDICT_BATCH_SZ) ? (nPositions - i) : PREDICT_BATCH_SZ;
+    RankBatch(keySequence, i, count, ranks);
+    for(j = 0; j < count; j++){
+      ScoreRank(ranks[j]);
+
+      if((i + j) % 100 == 99){
+        PrintResults();
+      }
+    }
+  }
+  cout << "test words: " << keySequence.size() << ", OOV: " << nOov << " (" << (keySequence.empty() ? 0.0 : (100.0 * nOov / keySequence.size())) << "%)" << endl;
+}
 
-  for(i = 0; i < keySequence.size()-NGRAM-1; i++){
-    Predict(keySequence,i,results);
-    ScoreResult(keySequence[i], results);
-    results.clear();
+void NgramModel::ResetAccuracy(void)
+{
+  lambdas.boolAccuracy = 0.0;
+  lambdas.realAccuracy = 0.0;
+  lambdas.recall = 0.0;
+  lambdas.topSevenAccuracy = 0.0;
+  lambdas.nPredictions = 0.0;
+}
 
-    if(i % 100 == 99){
-      PrintResults();
+//quiet version of Test() over an already-keyed sequence; resets the accuracy counters and returns the top-7 rate
+double NgramModel::TopSevenAccuracy(const vector<IntKey>& keySequence)
+{
+  int i, j, count, nPositions;
+  U32 ranks[PREDICT_BATCH_SZ];
+
+  ResetAccuracy();
+  nPositions = (keySequence.size() > NGRAM + 1) ? (int)(keySequence.size() - NGRAM - 1) : 0;
+  for(i = 0; i < nPositions; i += count){
+    count = (nPositions - i < PREDICT_BATCH_SZ) ? (nPositions - i) : PREDICT_BATCH_SZ;
+    RankBatch(keySequence, i, count, ranks);
+    for(j = 0; j < count; j++){
+      ScoreRank(ranks[j]);
     }
   }
+
+  return (lambdas.nPredictions > 0.0) ? (lambdas.topSevenAccuracy / lambdas.nPredictions) : 0.0;
 }
 
 void NgramModel::PrintResults(void)
@@ -224,24 +869,27 @@ void NgramModel::PrintResults(void)
   cout << "top7 accuracy: " << (100 * (lambdas.topSevenAccuracy / lambdas.nPredictions)) << "%" << endl;
 }
 
-//converts raw integer frequency counts to direct conditional probabilities (or likelihoods)
+//converts raw integer frequency counts to direct conditional probabilities (or likelihoods), filling stats[] on the way
 void NgramModel::NormalizeTables(void)
 {
-  NormalizeUnigramTable(unigramTable);
-  NormalizeTable(bigramTable);
-  NormalizeTable(trigramTable);
-  NormalizeTable(quadgramTable);
+  tablesFrozen = false;
+  NormalizeUnigramTable(unigramTable,stats[1]);
+  NormalizeTable(bigramTable,stats[2]);
+  NormalizeTable(trigramTable,stats[3]);
+  NormalizeTable(quadgramTable,stats[4]);
 }
 
-//a special case, since the unigram table's structure is a little different
-void NgramModel::NormalizeUnigramTable(NgramTable& unitable)
+//a special case, since the unigram table's structure is a little different. The whole table is a single "context".
+void NgramModel::NormalizeUnigramTable(NgramTable& unitable, ModelStat& stat)
 {
-  double sum;
+  double sum, sumCLogC;
   OuterTableIt outer;
 
-  sum = 0.0;
+  sum = sumCLogC = 0.0;
   for(outer = unitable.begin(); outer != unitable.end(); ++outer){  
-    sum += outer->second.begin()->second;
+    outer->second.count = outer->second.begin()->second;
+    sum += outer->second.count;
+    sumCLogC += outer->second.count * log2(outer->second.count);
   }
 
   if(sum > 0.0){
@@ -249,35 +897,608 @@ void NgramModel::NormalizeUnigramTable(NgramTable& unitable)
     for(outer = unitable.begin(); outer != unitable.end(); ++outer){  
       outer->second.begin()->second /= sum;
     }
+    stat.sumFrequency = sum;
+    stat.totalEntropy = log2(sum) - sumCLogC / sum;
+    stat.expectedSubEntropy = stat.meanSubEntropy = stat.totalEntropy;
+    stat.totalPerplexity = stat.expectedSubPerplexity = pow(2.0, stat.totalEntropy);
   }
   else{
     cout << "ERROR div zero attempted in UnigramTableToCondProbs" << endl;
   }
 }
 
-//Converts a table of raw frequency counts to conditional probability entries
-void NgramModel::NormalizeTable(NgramTable& table)
-{
-  double sum;
+/*
+  Converts a table of raw frequency counts to conditional probability entries, in parallel over blocks of rows,
+  and computes the table's entropy stats in the same pass. With N the table total and c(h) a context's total,
+  everything follows from per-row sums of c and c*log2(c) gathered while the row is being normalized anyway:
+    H(w|h)             = log2 c(h) - sum_w c log2 c / c(h)            (a context's sub-entropy)
+    totalEntropy       = log2 N - sum_{h,w} c log2 c / N              (entropy of the joint n-gram distribution)
+    expectedSubEntropy = sum_h (c(h)/N) H(w|h),  meanSubEntropy = mean_h H(w|h)
+*/
+void NgramModel::NormalizeTable(NgramTable& table, ModelStat& stat)
+{
+  int w;
+  U64 i, nBlocks;
+  double N, sumCLogC, weightedSub, sumSub;
   OuterTableIt outer;
-  InnerTableIt inner;
+  vector<OuterTableIt> rows;
+  vector<U64> costs;
+  vector<double> partials;
+  WorkStealingPool pool;
 
+  rows.reserve(table.size());
   for(outer = table.begin(); outer != table.end(); ++outer){
-    sum = 0.0;
-    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
-      sum += inner->second;
+    rows.push_back(outer);
+  }
+  nBlocks = (rows.size() + TABLE_BLOCK_SZ - 1) / TABLE_BLOCK_SZ;
+  costs.resize(nBlocks, 0);
+  for(i = 0; i < rows.size(); i++){
+    costs[i / TABLE_BLOCK_SZ] += rows[i]->second.size();
+  }
+
+  //per worker: N, sum c log2 c, sum_h c(h) H(w|h), sum_h H(w|h)
+  partials.resize(pool.NumWorkers() * 4, 0.0);
+  pool.Run(costs, [&](int task, int worker){
+    double sum, rowCLogC, subEntropy;
+    InnerTableIt inner;
+    double* part = &partials[worker * 4];
+    U64 end = ((U64)(task + 1) * TABLE_BLOCK_SZ < rows.size()) ? (U64)(task + 1) * TABLE_BLOCK_SZ : rows.size();
+
+    for(U64 r = (U64)task * TABLE_BLOCK_SZ; r < end; r++){
+      NgramRow& row = rows[r]->second;
+      sum = rowCLogC = 0.0;
+      for(inner = row.begin(); inner != row.end(); ++inner){
+        sum += inner->second;
+        rowCLogC += inner->second * log2(inner->second);
+      }
+      row.count = sum;
+
+      //div zero check
+      if(sum > 0.0){
+        //normalize this subset of vals
+        for(inner = row.begin(); inner != row.end(); ++inner){
+          inner->second /= sum;
+        }
+        subEntropy = log2(sum) - rowCLogC / sum;
+        part[0] += sum;
+        part[1] += rowCLogC;
+        part[2] += sum * subEntropy;
+        part[3] += subEntropy;
+      }
+      else{
+        cout << "ERROR div zero attempted in TableToCondProbs" << endl;
+      }
     }
+  });
+
+  N = sumCLogC = weightedSub = sumSub = 0.0;
+  for(w = 0; w < pool.NumWorkers(); w++){
+    N += partials[w * 4];
+    sumCLogC += partials[w * 4 + 1];
+    weightedSub += partials[w * 4 + 2];
+    sumSub += partials[w * 4 + 3];
+  }
+  if(N > 0.0){
+    stat.sumFrequency = N;
+    stat.totalEntropy = log2(N) - sumCLogC / N;
+    stat.expectedSubEntropy = weightedSub / N;
+    stat.meanSubEntropy = sumSub / (double)rows.size();
+    stat.totalPerplexity = pow(2.0, stat.totalEntropy);
+    stat.expectedSubPerplexity = pow(2.0, stat.expectedSubEntropy);
+  }
+}
 
-    //div zero check
-    if(sum > 0.0){
-      //normalize this subset of vals
+//sparsity report over the stats filled by NormalizeTables()
+void NgramModel::PrintModelStats(void)
+{
+  int n;
+  U64 nEntries;
+  OuterTableIt outer;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+
+  cout << "~~~~~~~~~~~~~~~~~~~~~~~~" << endl;
+  for(n = 1; n <= NGRAMS; n++){
+    nEntries = 0;
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      nEntries += outer->second.size();
+    }
+    cout << n << "-gram: contexts=" << tables[n]->size() << " entries=" << nEntries << " N=" << stats[n].sumFrequency
+         << " delta-varint ids=" << DeltaVarintIdBytes(*tables[n]) << " bytes (" << (nEntries * sizeof(IntKey)) << " raw)" << endl;
+    cout << "  total entropy=" << stats[n].totalEntropy << " (perplexity " << stats[n].totalPerplexity << ")" << endl;
+    cout << "  expected sub-entropy=" << stats[n].expectedSubEntropy << " (perplexity " << stats[n].expectedSubPerplexity << ")"
+         << "  mean sub-entropy=" << stats[n].meanSubEntropy << endl;
+  }
+  cout << "table arena: " << (arena.MappedBytes() >> 20) << " MB mapped in " << arena.NumChunks() << " chunks, " << arena.NumSlabs() << " slabs"
+       << ((arena.pageMode == ARENA_PAGES_NORMAL) ? "" : ((arena.pageMode == ARENA_PAGES_EXPLICIT) ? ", explicit huge pages" : ", transparent huge pages")) << endl;
+}
+
+/*
+  Offline pass over the normalized tables that fills each context row's header for backoff scoring:
+  absolute discounting in the Kneser-Ney style, with one discount per order estimated from the count-of-counts
+  (D = n1 / (n1 + 2*n2)), and Katz-style backoff weights so the distribution of each context still sums to one:
+    P(w|h) = p(w|h) - D/c(h)          if w was seen after h
+           = backoff(h) * P(w|h')     otherwise, h' being h without its first word
+    backoff(h) = (D*N1+(h)/c(h)) / (1 - sum over seen w of P(w|h'))
+  Orders are processed upward, since each backoff weight needs the finished lower-order model.
+  With the weights stored, GetBackoffProb() needs at most one probe per order and never scans a row.
+*/
+void NgramModel::ComputeBackoffWeights(void)
+{
+  int n;
+  double D, c, n1, n2;
+  OuterTableIt outer;
+  InnerTableIt inner;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+
+  tablesFrozen = false;
+
+  for(n = 2; n <= NGRAMS; n++){
+    n1 = n2 = 0.0;
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
       for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
-        inner->second /= sum;
+        c = floor(inner->second * outer->second.count + 0.5);
+        if(c == 1.0){
+          n1++;
+        }
+        else if(c == 2.0){
+          n2++;
+        }
       }
     }
+    D = ((n1 > 0.0) && (n2 > 0.0)) ? (n1 / (n1 + 2.0 * n2)) : 0.5;
+
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      NgramRow& row = outer->second;
+      row.discount = D / row.count;
+      row.unseenMass = D * (double)row.size() / row.count;
+      ComputeRowBackoff(n, outer->first, row);
+    }
+    cout << n << "-gram backoff weights computed, discount D=" << D << endl;
+  }
+}
+
+//backoff(h) = unseenMass(h) / (1 - sum over seen w of P(w|h')), from the finished order n-1 model
+void NgramModel::ComputeRowBackoff(int n, U64 key, NgramRow& row)
+{
+  double lowerMass, denom;
+  U64 suffix;
+  InnerTableIt inner;
+
+  lowerMass = 0.0;
+  suffix = SuffixContextKey(n, key);
+  for(inner = row.begin(); inner != row.end(); ++inner){
+    lowerMass += GetBackoffProb(n-1, suffix, inner->first);
+  }
+  denom = 1.0 - lowerMass;
+  if(denom < BACKOFF_MIN_DENOM){
+    denom = BACKOFF_MIN_DENOM;
+  }
+  row.backoff = row.unseenMass / denom;
+  row.logBackoff = log2(row.backoff);
+}
+
+/*
+  Relative-entropy pruning (Stolcke, "Entropy-based Pruning of Backoff Language Models"). Removing the explicit
+  estimate of w after context h hands its mass to the backoff path: P'(w|h) = a'(h)P(w|h'), where
+  a'(h) = (unseenMass(h) + P(w|h)) / (1 - lowerMass(h) + P(w|h')). Only the distribution of context h changes, so the
+  KL divergence between the full and pruned model is
+    D = -P(h) * [ P(w|h)(log P'(w|h) - log P(w|h)) + (log a'(h) - log a(h)) * unseenMass(h) ]
+  with unseenMass(h) the mass h already backs off. P(h) is taken as the context's relative frequency c(h)/N.
+  Every n-gram is scored against the unpruned model and those with D < threshold are removed, one order at a time
+  from the top down; contexts left with no entries are dropped entirely (their backoff weight would be exactly 1).
+  Each pruned context keeps its count and discount, takes the pruned mass into unseenMass, and has its backoff weight
+  recomputed bottom-up once all orders are done. The context rows of an order are scored in parallel.
+
+  If testFile is given, top-7 accuracy over it is measured before and after, to help pick the threshold.
+*/
+void NgramModel::PruneTables(double threshold, const string& testFile)
+{
+  int n;
+  U64 rowsBefore[NGRAMS+1], entriesBefore[NGRAMS+1], rowsAfter, entriesAfter;
+  double top7Before, top7After;
+  OuterTableIt outer;
+  vector<string> wordVec;
+  vector<IntKey> keySequence;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  WorkStealingPool pool;
+
+  top7Before = top7After = 0.0;
+  if(!tablesFrozen){
+    FreezeTables();
+  }
+  if(!testFile.empty()){
+    TextToWordSequence(testFile,wordVec);
+    WordToKeySequence(wordVec,keySequence);
+    top7Before = TopSevenAccuracy(keySequence);
+  }
+
+  for(n = 2; n <= NGRAMS; n++){
+    rowsBefore[n] = tables[n]->size();
+    entriesBefore[n] = 0;
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      entriesBefore[n] += outer->second.size();
+    }
+  }
+
+  for(n = NGRAMS; n >= 2; n--){
+    PruneTable(n, threshold, pool);
+  }
+  for(n = 2; n <= NGRAMS; n++){
+    RecomputeBackoffWeights(n, pool);
+  }
+  FreezeTables();  //the pruned model is ready to query again
+
+  cout << "~~~~~~~~~~~~~~~~~~~~~~~~" << endl;
+  cout << "Entropy pruning, threshold=" << threshold << endl;
+  for(n = 2; n <= NGRAMS; n++){
+    rowsAfter = tables[n]->size();
+    entriesAfter = 0;
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      entriesAfter += outer->second.size();
+    }
+    cout << n << "-gram: contexts " << rowsBefore[n] << " -> " << rowsAfter << ", entries " << entriesBefore[n] << " -> " << entriesAfter;
+    if(entriesBefore[n] > 0){
+      cout << " (" << (100.0 * (double)(entriesBefore[n] - entriesAfter) / (double)entriesBefore[n]) << "% removed)";
+    }
+    cout << endl;
+  }
+
+  if(!testFile.empty()){
+    top7After = TopSevenAccuracy(keySequence);
+    cout << "top7 accuracy: " << (100 * top7Before) << "% -> " << (100 * top7After) << "% (" << (100 * (top7After - top7Before)) << " points)" << endl;
+  }
+}
+
+//scores and removes the order-n entries below threshold; see PruneTables(). Returns the number of entries removed.
+U64 NgramModel::PruneTable(int n, double threshold, WorkStealingPool& pool)
+{
+  U64 i, nBlocks, nPruned;
+  OuterTableIt outer;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  NgramTable& table = *tables[n];
+  vector<OuterTableIt> rows;
+  vector<U64> costs;
+  vector<U64> pruned;
+  double N = stats[n].sumFrequency;
+
+  tablesFrozen = false;
+
+  if(N <= 0.0){
+    cout << "ERROR " << n << "-gram stats not computed, normalize the tables before pruning" << endl;
+    return 0;
+  }
+
+  rows.reserve(table.size());
+  for(outer = table.begin(); outer != table.end(); ++outer){
+    rows.push_back(outer);
+  }
+  nBlocks = (rows.size() + TABLE_BLOCK_SZ - 1) / TABLE_BLOCK_SZ;
+  costs.resize(nBlocks, 0);
+  for(i = 0; i < rows.size(); i++){
+    costs[i / TABLE_BLOCK_SZ] += rows[i]->second.size();
+  }
+
+  //lower orders are only read here, and each task only modifies its own rows, so erasing inside a row is safe
+  pruned.resize(pool.NumWorkers(), 0);
+  pool.Run(costs, [&](int task, int worker){
+    U64 suffix;
+    double pH, p, q, lowerMass, denom, alpha, alphaPruned, delta;
+    InnerTableIt inner;
+    vector<double> lowerProbs;
+    vector<IntKey> victims;
+    U64 end = ((U64)(task + 1) * TABLE_BLOCK_SZ < rows.size()) ? (U64)(task + 1) * TABLE_BLOCK_SZ : rows.size();
+
+    for(U64 r = (U64)task * TABLE_BLOCK_SZ; r < end; r++){
+      NgramRow& row = rows[r]->second;
+      suffix = SuffixContextKey(n, rows[r]->first);
+      pH = row.count / N;
+
+      lowerProbs.clear();
+      lowerMass = 0.0;
+      for(inner = row.begin(); inner != row.end(); ++inner){
+        lowerProbs.push_back(GetBackoffProb(n-1, suffix, inner->first));
+        lowerMass += lowerProbs.back();
+      }
+      denom = 1.0 - lowerMass;
+      if(denom < BACKOFF_MIN_DENOM){
+        denom = BACKOFF_MIN_DENOM;
+      }
+      alpha = row.unseenMass / denom;
+
+      victims.clear();
+      for(i = 0, inner = row.begin(); inner != row.end(); ++inner, i++){
+        p = inner->second - row.discount;
+        q = lowerProbs[i];
+        if((p <= 0.0) || (q <= 0.0)){
+          continue;
+        }
+        alphaPruned = (row.unseenMass + p) / (denom + q);
+        delta = -pH * (p * (log2(alphaPruned * q) - log2(p)) + (log2(alphaPruned) - log2(alpha)) * row.unseenMass);
+        if(delta < threshold){
+          victims.push_back(inner->first);
+        }
+      }
+
+      for(i = 0; i < victims.size(); i++){
+        inner = row.find(victims[i]);
+        row.unseenMass += inner->second - row.discount;
+        row.erase(inner);
+      }
+      pruned[worker] += victims.size();
+    }
+  });
+
+  //emptied contexts go serially, the outer map is shared
+  for(i = 0; i < rows.size(); i++){
+    if(rows[i]->second.empty()){
+      table.erase(rows[i]);
+    }
+  }
+
+  nPruned = 0;
+  for(i = 0; i < pruned.size(); i++){
+    nPruned += pruned[i];
+  }
+
+  return nPruned;
+}
+
+//refreshes the order-n backoff weights after the tables changed, keeping each row's count, discount and unseenMass
+void NgramModel::RecomputeBackoffWeights(int n, WorkStealingPool& pool)
+{
+  U64 i, nBlocks;
+  OuterTableIt outer;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  vector<OuterTableIt> rows;
+  vector<U64> costs;
+
+  tablesFrozen = false;
+
+  rows.reserve(tables[n]->size());
+  for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+    rows.push_back(outer);
+  }
+  nBlocks = (rows.size() + TABLE_BLOCK_SZ - 1) / TABLE_BLOCK_SZ;
+  costs.resize(nBlocks, 0);
+  for(i = 0; i < rows.size(); i++){
+    costs[i / TABLE_BLOCK_SZ] += rows[i]->second.size();
+  }
+
+  pool.Run(costs, [&](int task, int worker){
+    U64 end = ((U64)(task + 1) * TABLE_BLOCK_SZ < rows.size()) ? (U64)(task + 1) * TABLE_BLOCK_SZ : rows.size();
+    for(U64 r = (U64)task * TABLE_BLOCK_SZ; r < end; r++){
+      ComputeRowBackoff(n, rows[r]->first, rows[r]->second);
+    }
+  });
+}
+
+//Backoff probability of word after the order-model context key: one row probe and one entry probe per order.
+//Returns 0.0 only for words without a unigram entry.
+double NgramModel::GetBackoffProb(int model, U64 key, IntKey word) const
+{
+  int n;
+  double weight;
+  OuterTableConstIt outer;
+  InnerTableConstIt inner;
+  const NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+
+  weight = 1.0;
+  for(n = model; n >= 2; n--){
+    outer = tables[n]->find(key);
+    if(outer != tables[n]->end()){
+      inner = outer->second.find(word);
+      if(inner != outer->second.end()){
+        return weight * (inner->second - outer->second.discount);
+      }
+      weight *= outer->second.backoff;
+    }
+    key = SuffixContextKey(n, key);
+  }
+
+  outer = unigramTable.find((U64)word);
+  if(outer != unigramTable.end()){
+    return weight * outer->second.begin()->second;
+  }
+
+  return 0.0;
+}
+
+//P(keySeq[i] | up to three preceding words)
+double NgramModel::GetBackoffProb(const vector<IntKey>& keySeq, int i) const
+{
+  if(i >= 3){
+    return GetBackoffProb(4, MakeNgramModelKey(4, keySeq[i-3], keySeq[i-2], keySeq[i-1]), keySeq[i]);
+  }
+  else if(i == 2){
+    return GetBackoffProb(3, MakeNgramModelKey(3, keySeq[i-2], keySeq[i-1]), keySeq[i]);
+  }
+  else if(i == 1){
+    return GetBackoffProb(2, MakeNgramModelKey(2, keySeq[i-1]), keySeq[i]);
+  }
+
+  return GetBackoffProb(1, 0, keySeq[i]);
+}
+
+//log2 of GetBackoffProb(): sums the stored log2 backoff weights instead of multiplying, and takes one log2 of the
+//probability found. False if word has no probability.
+bool NgramModel::GetBackoffLog2Prob(int model, U64 key, IntKey word, double& log2Prob) const
+{
+  int n;
+  double logWeight;
+  OuterTableConstIt outer;
+  InnerTableConstIt inner;
+  const NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+
+  logWeight = 0.0;
+  for(n = model; n >= 2; n--){
+    outer = tables[n]->find(key);
+    if(outer != tables[n]->end()){
+      inner = outer->second.find(word);
+      if(inner != outer->second.end()){
+        log2Prob = logWeight + log2(inner->second - outer->second.discount);
+        return true;
+      }
+      logWeight += outer->second.logBackoff;
+    }
+    key = SuffixContextKey(n, key);
+  }
+
+  outer = unigramTable.find((U64)word);
+  if((outer != unigramTable.end()) && (outer->second.begin()->second > 0.0)){
+    log2Prob = logWeight + log2(outer->second.begin()->second);
+    return true;
+  }
+
+  return false;
+}
+
+//read-only vocabulary lookup; unlike StringToKey() it never allocates a key for an unseen word
+bool NgramModel::LookupKey(const string& word, IntKey& key) const
+{
+  StringKeyMapConstIt it = StringKeyTable.find(word);
+
+  if(it != StringKeyTable.end()){
+    key = it->second;
+    return true;
+  }
+
+  return false;
+}
+
+//scores one sentence; each word is conditioned on up to three preceding words of the same sentence
+void NgramModel::ScoreSentence(const IntKey* keys, U32 len, SentenceScore& score) const
+{
+  U32 i;
+  U64 key;
+  double logProb;
+
+  score.log2Prob = 0.0;
+  score.nTokens = len;
+  score.nOov = 0;
+  for(i = 0; i < len; i++){
+    if(i >= 3){
+      key = MakeNgramModelKey(4, keys[i-3], keys[i-2], keys[i-1]);
+    }
+    else if(i == 2){
+      key = MakeNgramModelKey(3, keys[i-2], keys[i-1]);
+    }
+    else if(i == 1){
+      key = MakeNgramModelKey(2, keys[i-1]);
+    }
     else{
-      cout << "ERROR div zero attempted in TableToCondProbs" << endl;
+      key = 0;
+    }
+
+    if(GetBackoffLog2Prob((i < 3) ? (i + 1) : NGRAMS, key, keys[i], logProb)){
+      score.log2Prob += logProb;
     }
+    else{
+      score.nOov++;
+    }
+  }
+
+  if(score.nTokens > score.nOov){
+    score.perplexity = pow(2.0, -score.log2Prob / (double)(score.nTokens - score.nOov));
+  }
+  else{
+    score.perplexity = INF_PERPLEXITY;
+  }
+}
+
+/*
+  Bulk scoring of already-keyed sentences, in blocks of SCORE_BLOCK_SZ sentences on the work-stealing pool.
+  Read-only over the model, and nothing is allocated per token. Each token probes the map tables, not the frozen
+  snapshot: a row and an entry find per order it backs off through, then one log2 of the probability found. Needs
+  ComputeBackoffWeights() only, so it also runs on a model that was never frozen.
+*/
+void NgramModel::ScoreSentences(const vector<vector<IntKey> >& sentences, vector<SentenceScore>& scores, int nThreads) const
+{
+  U64 i, nBlocks;
+  vector<U64> costs;
+  WorkStealingPool pool(nThreads);
+
+  scores.resize(sentences.size());
+  nBlocks = (sentences.size() + SCORE_BLOCK_SZ - 1) / SCORE_BLOCK_SZ;
+  costs.resize(nBlocks, 0);
+  for(i = 0; i < sentences.size(); i++){
+    costs[i / SCORE_BLOCK_SZ] += sentences[i].size();
+  }
+
+  pool.Run(costs, [&](int task, int worker){
+    U64 end = ((U64)(task + 1) * SCORE_BLOCK_SZ < sentences.size()) ? (U64)(task + 1) * SCORE_BLOCK_SZ : sentences.size();
+    for(U64 j = (U64)task * SCORE_BLOCK_SZ; j < end; j++){
+      ScoreSentence(sentences[j].data(), sentences[j].size(), scores[j]);
+    }
+  });
+}
+
+//Bulk scoring of raw text sentences, eg ASR/OCR hypotheses, tokenized by SentenceToWords() (short hypotheses count, long
+//ones are not truncated). Words outside the vocabulary become OOV_KEY, which no table contains, so they count as OOV.
+void NgramModel::ScoreSentences(const vector<string>& sentences, vector<SentenceScore>& scores, int nThreads) const
+{
+  U64 i, nBlocks;
+  vector<U64> costs;
+  WorkStealingPool pool(nThreads);
+
+  scores.resize(sentences.size());
+  nBlocks = (sentences.size() + SCORE_BLOCK_SZ - 1) / SCORE_BLOCK_SZ;
+  costs.resize(nBlocks, 0);
+  for(i = 0; i < sentences.size(); i++){
+    costs[i / SCORE_BLOCK_SZ] += sentences[i].length();
+  }
+
+  pool.Run(costs, [&](int task, int worker){
+    vector<string> words;
+    vector<IntKey> keys;
+    IntKey key;
+    U64 end = ((U64)(task + 1) * SCORE_BLOCK_SZ < sentences.size()) ? (U64)(task + 1) * SCORE_BLOCK_SZ : sentences.size();
+
+    for(U64 j = (U64)task * SCORE_BLOCK_SZ; j < end; j++){
+      words.clear();
+      keys.clear();
+      SentenceToWords(sentences[j],words);
+      for(U32 k = 0; k < words.size(); k++){
+        keys.push_back(LookupKey(words[k],key) ? key : OOV_KEY);
+      }
+      ScoreSentence(keys.data(), keys.size(), scores[j]);
+    }
+  });
+}
+
+//scores every line of fname as one sentence and reports corpus perplexity and throughput
+void NgramModel::ScoreFile(const string& fname)
+{
+  U64 i, nTokens, nOov;
+  double log2Prob, t0, secs;
+  string line;
+  vector<string> sentences;
+  vector<SentenceScore> scores;
+  fstream infile(fname.c_str(), ios::in);
+
+  if(!infile){
+    cout << "ERROR could not open file: " << fname << endl;
+    return;
+  }
+  while(getline(infile,line)){
+    sentences.push_back(line);
+  }
+  infile.close();
+
+  t0 = WallSeconds();
+  ScoreSentences(sentences,scores);
+  secs = WallSeconds() - t0;
+
+  nTokens = nOov = 0;
+  log2Prob = 0.0;
+  for(i = 0; i < scores.size(); i++){
+    nTokens += scores[i].nTokens;
+    nOov += scores[i].nOov;
+    log2Prob += scores[i].log2Prob;
+  }
+  cout << "Scored " << scores.size() << " sentences, " << nTokens << " tokens (" << nOov << " OOV) in " << secs << "s, "
+       << ((double)nTokens / secs) << " tokens/s" << endl;
+  if(nTokens > nOov){
+    cout << "log2 prob: " << log2Prob << "  perplexity: " << pow(2.0, -log2Prob / (double)(nTokens - nOov)) << endl;
   }
 }
 
@@ -332,10 +1553,11 @@ void NgramModel::UnigramTableToLogSpace(NgramTable& unigrams)
 //converts tables to a log-probability, to help offset underflow risks
 void NgramModel::TablesToLogSpace(void)
 {
-  TableToLogSpace(unigramTable);
+  UnigramTableToLogSpace(unigramTable);
   TableToLogSpace(bigramTable);
   TableToLogSpace(trigramTable);
   TableToLogSpace(quadgramTable);
+  tablesFrozen = false;
 }
 
 bool byLogProb(const ResultPair& left, const ResultPair& right)
@@ -343,102 +1565,279 @@ bool byLogProb(const ResultPair& left, const ResultPair& right)
   return left.second < right.second;
 }
 
-bool byRealProb(const ResultPair& left, const ResultPair& right)
+bool byRealProb(const ResultPair& left, const ResultPair& right)
+{
+  return left.second > right.second;
+}
+
+/*
+  Scoring and ranking passes of InterpolateRows(), over whole candidate rows. Each has a scalar version and an AVX2
+  version picked at runtime, so the binary still runs on CPUs without AVX2. The AVX2 scoring uses separate multiplies
+  and adds rather than FMA: both versions then round identically, and a ranking never depends on the CPU it ran on.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+static bool HasAvx2(void)
+{
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+
+  return avx2;
+}
+#else
+static bool HasAvx2(void)
+{
+  return false;
+}
+#endif
+
+//score = l1*uni + l2*p2 + l3*x3 + l4*x4, summed in that order; NaN x3/x4 take this context's min3/min4
+static void ScoreCandidatesScalar(CandidateRows& cands, U32 from, double min3, double min4, const double l[NLAMBDAS])
+{
+  U32 i;
+  double x3, x4, score;
+
+  for(i = from; i < cands.ids.size(); i++){
+    x3 = (cands.x3[i] != cands.x3[i]) ? min3 : cands.x3[i];
+    x4 = (cands.x4[i] != cands.x4[i]) ? min4 : cands.x4[i];
+    score = l[1] * cands.uni[i];
+    score += l[2] * cands.p2[i];
+    score += l[3] * x3;
+    score += l[4] * x4;
+    cands.score[i] = score;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void ScoreCandidatesAvx2(CandidateRows& cands, double min3, double min4, const double l[NLAMBDAS])
+{
+  U32 i, n;
+  __m256d l1, l2, l3, l4, m3, m4, x3, x4, score;
+
+  n = cands.ids.size() & ~3U;
+  l1 = _mm256_set1_pd(l[1]);
+  l2 = _mm256_set1_pd(l[2]);
+  l3 = _mm256_set1_pd(l[3]);
+  l4 = _mm256_set1_pd(l[4]);
+  m3 = _mm256_set1_pd(min3);
+  m4 = _mm256_set1_pd(min4);
+  for(i = 0; i < n; i += 4){
+    x3 = _mm256_loadu_pd(&cands.x3[i]);
+    x4 = _mm256_loadu_pd(&cands.x4[i]);
+    x3 = _mm256_blendv_pd(x3, m3, _mm256_cmp_pd(x3, x3, _CMP_UNORD_Q));
+    x4 = _mm256_blendv_pd(x4, m4, _mm256_cmp_pd(x4, x4, _CMP_UNORD_Q));
+    score = _mm256_mul_pd(l1, _mm256_loadu_pd(&cands.uni[i]));
+    score = _mm256_add_pd(score, _mm256_mul_pd(l2, _mm256_loadu_pd(&cands.p2[i])));
+    score = _mm256_add_pd(score, _mm256_mul_pd(l3, x3));
+    score = _mm256_add_pd(score, _mm256_mul_pd(l4, x4));
+    _mm256_storeu_pd(&cands.score[i], score);
+  }
+  ScoreCandidatesScalar(cands, n, min3, min4, l);
+}
+#endif
+
+void ScoreCandidates(CandidateRows& cands, double min3, double min4, const double l[NLAMBDAS])
+{
+  cands.score.resize(cands.ids.size());
+#if defined(__x86_64__) || defined(__i386__)
+  if(HasAvx2()){
+    ScoreCandidatesAvx2(cands, min3, min4, l);
+    return;
+  }
+#endif
+  ScoreCandidatesScalar(cands, 0, min3, min4, l);
+}
+
+//offers candidate i to the top-k heap, whose front is the worst kept candidate; returns the new admission threshold
+static double OfferCandidate(vector<U32>& heap, U32 i, const CandidateRank& better, const CandidateRows& cands)
+{
+  if(better(i, heap.front())){
+    std::pop_heap(heap.begin(), heap.end(), better);
+    heap.back() = i;
+    std::push_heap(heap.begin(), heap.end(), better);
+  }
+
+  return cands.score[heap.front()];
+}
+
+static void FilterTopKScalar(const CandidateRows& cands, U32 from, vector<U32>& heap, const CandidateRank& better)
+{
+  U32 i;
+  double threshold = cands.score[heap.front()];
+
+  for(i = from; i < cands.ids.size(); i++){
+    if(cands.score[i] >= threshold){
+      threshold = OfferCandidate(heap, i, better, cands);
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//four scores per compare against the current k-th best; only lanes at or above it reach the heap
+__attribute__((target("avx2")))
+static void FilterTopKAvx2(const CandidateRows& cands, U32 from, vector<U32>& heap, const CandidateRank& better)
+{
+  U32 i, n;
+  int mask, lane;
+  double threshold = cands.score[heap.front()];
+  const double* score = cands.score.data();
+
+  n = from + ((cands.ids.size() - from) & ~3U);
+  for(i = from; i < n; i += 4){
+    mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(score + i), _mm256_set1_pd(threshold), _CMP_GE_OQ));
+    for(lane = 0; mask != 0; lane++, mask >>= 1){
+      if(mask & 1){
+        threshold = OfferCandidate(heap, i + lane, better, cands);
+      }
+    }
+  }
+  FilterTopKScalar(cands, n, heap, better);
+}
+#endif
+
+//ranked gets the indices of the best topK candidates (all of them if topK is 0), best first
+void RankCandidates(const CandidateRows& cands, U32 topK, vector<U32>& ranked)
+{
+  U32 i, n;
+  CandidateRank better;
+
+  better.cands = &cands;
+  n = cands.ids.size();
+  ranked.clear();
+  if((topK == 0) || (topK >= n)){
+    for(i = 0; i < n; i++){
+      ranked.push_back(i);
+    }
+    sort(ranked.begin(), ranked.end(), better);
+    return;
+  }
+
+  for(i = 0; i < topK; i++){
+    ranked.push_back(i);
+  }
+  std::make_heap(ranked.begin(), ranked.end(), better);
+#if defined(__x86_64__) || defined(__i386__)
+  if(HasAvx2()){
+    FilterTopKAvx2(cands, topK, ranked, better);
+  }
+  else{
+    FilterTopKScalar(cands, topK, ranked, better);
+  }
+#else
+  FilterTopKScalar(cands, topK, ranked, better);
+#endif
+  sort(ranked.begin(), ranked.end(), better);
+}
+
+//number of candidates in [from,end) ranked ahead of candidate idx; only exact score ties need the full comparator
+static U32 CountAheadScalar(const CandidateRows& cands, U32 from, U32 idx, const CandidateRank& better)
+{
+  U32 i, ahead;
+  double s = cands.score[idx];
+
+  ahead = 0;
+  for(i = from; i < cands.ids.size(); i++){
+    ahead += (cands.score[i] > s) || ((cands.score[i] == s) && better(i, idx));
+  }
+
+  return ahead;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,popcnt")))
+static U32 CountAheadAvx2(const CandidateRows& cands, U32 idx, const CandidateRank& better)
+{
+  U32 i, n, ahead;
+  int eq, lane;
+  __m256d s, score;
+  const double* scores = cands.score.data();
+
+  n = cands.ids.size() & ~3U;
+  s = _mm256_set1_pd(scores[idx]);
+  ahead = 0;
+  for(i = 0; i < n; i += 4){
+    score = _mm256_loadu_pd(scores + i);
+    ahead += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(score, s, _CMP_GT_OQ)));
+    eq = _mm256_movemask_pd(_mm256_cmp_pd(score, s, _CMP_EQ_OQ));
+    for(lane = 0; eq != 0; lane++, eq >>= 1){
+      if(eq & 1){
+        ahead += better(i + lane, idx);
+      }
+    }
+  }
+
+  return ahead + CountAheadScalar(cands, n, idx, better);
+}
+#endif
+
+/*
+  1-based position of word actual in RankCandidates(cands, 0, ...), without ranking: cands is in id order (as the
+  merge leaves it), so actual is found by binary search, and its rank is one plus the number of candidates that
+  CandidateRank puts ahead of it (higher score; on an exact tie, higher order, then lower id). Returns 0 if actual
+  is not a candidate.
+*/
+U32 CandidateRankOf(const CandidateRows& cands, IntKey actual)
+{
+  U32 idx;
+  CandidateRank better;
+  vector<IntKey>::const_iterator it;
+
+  it = std::lower_bound(cands.ids.begin(), cands.ids.end(), actual);
+  if((it == cands.ids.end()) || (*it != actual)){
+    return 0;
+  }
+  idx = (U32)(it - cands.ids.begin());
+  better.cands = &cands;
+
+#if defined(__x86_64__) || defined(__i386__)
+  if(HasAvx2()){
+    return 1 + CountAheadAvx2(cands, idx, better);
+  }
+#endif
+  return 1 + CountAheadScalar(cands, 0, idx, better);
+}
+
+//points a cursor at the row for key, or at an empty row if the context was never seen
+static void OpenRowCursor(const NgramTable& table, U64 key, MapRowCursor& cursor, bool& found)
 {
-  return left.second > right.second;
+  static const NgramRowMap emptyRow;
+  OuterTableConstIt outer = table.find(key);
+
+  found = (outer != table.end());
+  cursor.it = found ? outer->second.begin() : emptyRow.begin();
+  cursor.end = found ? outer->second.end() : emptyRow.end();
 }
 
 //predicts based on linear interpolation over 1, 2, 3, and 4-gram log probabilities.
 //uses simple smoothing, but nothing fancy.
 //Since the models were all trained in the same data, the 4-gram model can be used
 //to project the results across the lesser models, but this is not valid otherwise.
-//Thus, look up the 4-gram result set; then for each of these, sum across the lesser model values.
-void NgramModel::Predict(vector<IntKey> keySeq, int i, ResultList& results)
+//Each order's context row is found once, then InterpolateRows() merge-joins the rows (see nGram.hpp).
+void NgramModel::Predict(const vector<IntKey>& keySeq, int i, ResultList& results, U32 topK) const
 {
-  double min3, min4;
-  U64 key4g, key3g, key2g, key1g;
-  OuterTableIt outer;
-  InnerTableIt inner;
-  unordered_set<IntKey> dupeSet;
+  bool found[NGRAMS+1];
+  MapRowCursor c4, c3, c2;
+  const NgramTable& unigrams = unigramTable;
+  const FlatTable& flatUnigrams = frozen[1];
 
   if(i < 3){ //index check
     return;
   }
 
-  //get all the keys
-  key4g = MakeNgramModelKey(4, keySeq[i-3], keySeq[i-2], keySeq[i-1]);
-  key3g = MakeNgramModelKey(3, keySeq[i-2], keySeq[i-1]);
-  key2g = MakeNgramModelKey(2, keySeq[i-1]);
-
-  // (very) simple smoothing parameters for missing data
-  min3 = min4 = 99999;
+  OpenRowCursor(quadgramTable, MakeNgramModelKey(4, keySeq[i-3], keySeq[i-2], keySeq[i-1]), c4, found[4]);
+  OpenRowCursor(trigramTable, MakeNgramModelKey(3, keySeq[i-2], keySeq[i-1]), c3, found[3]);
+  OpenRowCursor(bigramTable, MakeNgramModelKey(2, keySeq[i-1]), c2, found[2]);
 
-  //interpolate over 4 grams
-  outer = quadgramTable.find(key4g);
-  if(outer != quadgramTable.end()){
-    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
-      //Add all four-gram results to the dupe set, so we don't re-estimate these words for the 3- and 2-gram queries
-      //We can add "all" only because this is the first model being queried, and it contains no duplicate
-      dupeSet.insert(inner->second);
-
-      ResultPair result(inner,0);
-      result.second  = lambdas.l[1] * GetProb(1,(U64)inner->first,inner->first);
-      result.second += lambdas.l[2] * GetProb(2,key2g,inner->first);
-      result.second += lambdas.l[3] * GetProb(3,key3g,inner->first);
-      result.second += lambdas.l[4] * inner->second;
-      results.push_back(result);
-      if(inner->second < min4){
-        min4 = inner->second;
-      }
-    }
-  }
-  else{
-    min4 = 0.0;
-    //min4 = 2 / (quadgramTable.size() + 1);  //laplace smooothing, if no results
-  }
-
-  //add 3 gram model results
-  outer = trigramTable.find(key3g);
-  if(outer != trigramTable.end()){
-    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
-      if(dupeSet.count(inner->second) == 0){
-        dupeSet.insert(inner->second);
-        ResultPair result(inner,0);
-        result.second  = lambdas.l[1] * GetProb(1,(U64)inner->first,inner->first);
-        result.second += lambdas.l[2] * GetProb(2,key2g,inner->first);
-        result.second += lambdas.l[3] * inner->second;
-        result.second += lambdas.l[4] * min4;  //smooth missing data by the minimal four-gram estimate 
-        results.push_back(result);
-        if(inner->second < min3){
-          min3 = inner->second;
-        }
-      }
-    }
+  //the unigram probability is wanted for every candidate, so it comes from the snapshot's dense array when there is one
+  if(tablesFrozen){
+    InterpolateRows(c4, c3, c2, found, [&flatUnigrams](IntKey id){
+      return GetFlatUnigramProb(flatUnigrams, id);
+    }, lambdas.l, results, topK);
   }
   else{
-    min3 = 0.0;
-    //min3 = 2 / (trigramTable.size() + 1);
-  }
-
-  //add the 2 gram results
-  outer = bigramTable.find(key2g);
-  if(outer != bigramTable.end()){
-    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
-      if(dupeSet.count(inner->second) == 0){
-        dupeSet.insert(inner->second);
-        ResultPair result(inner,0);
-        result.second  = lambdas.l[1] * GetProb(1,(U64)inner->first,inner->first);
-        result.second += lambdas.l[2] * inner->second;
-        result.second += lambdas.l[3] * min3;  //smooth both the missing four gram and three gram data
-        result.second += lambdas.l[4] * min4;
-        results.push_back(result);
-      }
-    }
-  }
-
-  //lastly sort the results
-  if(results.size() > 0){
-    results.sort(byRealProb);
+    InterpolateRows(c4, c3, c2, found, [&unigrams](IntKey id){
+      OuterTableConstIt uni = unigrams.find((U64)id);
+      return (uni != unigrams.end()) ? uni->second.begin()->second : 0.0;
+    }, lambdas.l, results, topK);
   }
 
   /*
@@ -453,7 +1852,7 @@ void NgramModel::Predict(vector<IntKey> keySeq, int i, ResultList& results)
 
   int j = 0;
   for(ResultListIt it = results.begin(); it != results.end() && j < 50; ++it, j++){
-    if(KeyToString(it->first->first,temp)){
+    if(KeyToString(it->first,temp)){
       cout << j << ": <" << temp << "|" << it->second << ">" << endl;
     }
     else{
@@ -478,27 +1877,33 @@ void NgramModel::Predict(vector<IntKey> keySeq, int i, ResultList& results)
   it is hard-coded, and would be difficult to extend due to the mathematical complexity of EM. It 
   is very similar to Branch and Bound tasks of searching through the parameter space for the optimal parameter set.
 */
-void NgramModel::LambdaEM(void)
+void NgramModel::LambdaEM(const vector<IntKey>& keySeq)
 {
   int i;
-  U64 key;
   double biCt, triCt, quadCt, normal;
-  vector<string> wordVec;
-  vector<U16> keySeq;
+  vector<U64> keys;
+  vector<IntKey> maxes;
 
-  string fname = "../../oanc_SlateLambdaTraining.txt";
-  TextToWordSequence(fname,wordVec);
-  WordToKeySequence(wordVec,keySeq);
-  wordVec.clear();
+  if(keySeq.size() <= 2 * (NGRAM + 1)){
+    cout << "WARN too little held-out data (" << keySeq.size() << " words) to estimate lambdas, keeping the current ones" << endl;
+    return;
+  }
 
   biCt = triCt = quadCt = 0.0;
 
+  //the contexts of each pass are looked up together with GetMaxBatch(), which overlaps their cache misses
+  //an unseen context's max is 0, the same as OOV_KEY, so OOV words are never counted as predicted
   cout << "Calculating bigram model precision..." << endl;
   //get expected value of bigram model predictions
+  keys.clear();
+  for(i = NGRAM + 1; i < (keySeq.size() - NGRAM - 1); i++){
+    keys.push_back(MakeNgramModelKey(2,keySeq[i])); // IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
+  }
+  maxes.resize(keys.size());
+  GetMaxBatch(2, keys.data(), maxes.data(), keys.size());
   for(i = NGRAM + 1; i < (keySeq.size() - NGRAM - 1); i++){
-    key = MakeNgramModelKey(2,keySeq[i]); // IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
     //track only boolean accuracy. Check if max prediction exactly matches next word.
-    if(keySeq[i+1] == GetMax(bigramTable,key)){
+    if((keySeq[i+1] != OOV_KEY) && (keySeq[i+1] == maxes[i-NGRAM-1])){
       biCt++;
     }
   }
@@ -507,10 +1912,14 @@ void NgramModel::LambdaEM(void)
   cout << "trigram model.size()=" << trigramTable.size() << endl;
   cout << "Done. Calculating trigram model precision..." << endl;
   //get expected value of trigram model predictions
+  keys.clear();
+  for(i = NGRAM + 1; i < (keySeq.size() - NGRAM - 1); i++){
+    keys.push_back(MakeNgramModelKey(3,keySeq[i-1], keySeq[i])); // IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
+  }
+  GetMaxBatch(3, keys.data(), maxes.data(), keys.size());
   for(i = NGRAM + 1; i < (keySeq.size() - NGRAM - 1); i++){
-    key = MakeNgramModelKey(3,keySeq[i-1], keySeq[i]); // IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
     //track only boolean accuracy. Check if max prediction exactly matches next word.
-    if(keySeq[i+1] == GetMax(trigramTable,key)){
+    if((keySeq[i+1] != OOV_KEY) && (keySeq[i+1] == maxes[i-NGRAM-1])){
       triCt++;
     }
   }
@@ -519,10 +1928,14 @@ void NgramModel::LambdaEM(void)
   cout << "qgram model.size()=" << quadgramTable.size() << endl;
   cout << "Done. Calculating quadgram model precision..." << endl;
   //get expected value of quadgram model predictions
+  keys.clear();
+  for(i = NGRAM + 1; i < (keySeq.size() - NGRAM - 1); i++){
+    keys.push_back(MakeNgramModelKey(4,keySeq[i-2],keySeq[i-1],keySeq[i])); // IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
+  }
+  GetMaxBatch(4, keys.data(), maxes.data(), keys.size());
   for(i = NGRAM + 1; i < (keySeq.size() - NGRAM - 1); i++){
-    key = MakeNgramModelKey(4,keySeq[i-2],keySeq[i-1],keySeq[i]); // IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
     //track only boolean accuracy. Check if max prediction exactly matches next word.
-    if(keySeq[i+1] == GetMax(quadgramTable,key)){
+    if((keySeq[i+1] != OOV_KEY) && (keySeq[i+1] == maxes[i-NGRAM-1])){
       quadCt++;
     }
   }
@@ -569,7 +1982,7 @@ void NgramModel::LambdaEM(void)
           Predict(keySeq,i,results);
           //score each result by real score only, which gives a decent real-value of method accuracy
           for(rank = 0.0, found = false, it = results.begin(); !found && it != results.end(); rank++, ++it){
-            if(it->first->first == keySeq[i+1]){
+            if(it->first == keySeq[i+1]){
               realScores[iteration] += (1.0 - (rank / (double)results.size()));
               found = true;
             }
@@ -639,11 +2052,25 @@ U16 NgramModel::GetMax(NgramTable& table, U64 outerKey)
 }
 
 //Handles table probability lookups, given complete U64/U16 key/subkey. Returns prob if found, else returns 0.0
-double NgramModel::GetProb(int nModel, U64 key, U16 subkey)
+//Once the tables are frozen, unigrams and bigrams are looked up in the snapshot's dense arrays, with no search.
+double NgramModel::GetProb(int nModel, U64 key, U16 subkey) const
+{
+  if(tablesFrozen && (nModel == 1)){
+    return (key == subkey) ? GetFlatUnigramProb(frozen[1], subkey) : 0.0;
+  }
+  if(tablesFrozen && (nModel == 2)){
+    return GetFlatProb(frozen[2], key, subkey);
+  }
+
+  return GetMapProb(nModel, key, subkey);
+}
+
+//GetProb() against the map tables, whether or not they are frozen
+double NgramModel::GetMapProb(int nModel, U64 key, U16 subkey) const
 {
   double ret;
-  OuterTableIt outer;
-  InnerTableIt inner;
+  OuterTableConstIt outer;
+  InnerTableConstIt inner;
   
   ret = 0.0;  //return 0.0 by default
   switch(nModel){
@@ -655,65 +2082,783 @@ double NgramModel::GetProb(int nModel, U64 key, U16 subkey)
           ret = inner->second;
         }
       }
-      break;
-    case 2:
-      outer = bigramTable.find(key);
-      if(outer != bigramTable.end()){
-        inner = outer->second.find(subkey);
-        if(inner != outer->second.end()){
-          ret = inner->second;
+      break;
+    case 2:
+      outer = bigramTable.find(key);
+      if(outer != bigramTable.end()){
+        inner = outer->second.find(subkey);
+        if(inner != outer->second.end()){
+          ret = inner->second;
+        }
+      }
+      break;
+    case 3:
+      outer = trigramTable.find(key);
+      if(outer != trigramTable.end()){
+        inner = outer->second.find(subkey);
+        if(inner != outer->second.end()){
+          ret = inner->second;
+        }
+      }
+      break;
+    case 4:
+      outer = quadgramTable.find(key);
+      if(outer != quadgramTable.end()){
+        inner = outer->second.find(subkey);
+        if(inner != outer->second.end()){
+          ret = inner->second;
+        }
+      }
+      break;
+    default:
+      cout << "ERROR model " << nModel << " not found in GetProb" << endl;
+  }
+
+  return ret;
+}
+
+//binary search for the row of some outer key in a flat table (a single load if it has a dense index). Returns false
+//if the context was never seen.
+bool FindFlatRow(const FlatTable& table, U64 key, U64& row)
+{
+  const U64* it;
+
+  if(table.denseRow != NULL){
+    if((key < table.nDense) && (table.denseRow[key] != FLAT_NO_ROW)){
+      row = table.denseRow[key];
+      return true;
+    }
+    return false;
+  }
+
+  it = std::lower_bound(table.keys, table.keys + table.nRows, key);
+  if((it != table.keys + table.nRows) && (*it == key)){
+    row = (U64)(it - table.keys);
+    return true;
+  }
+
+  return false;
+}
+
+//flat-table equivalent of GetProb(): returns prob if key/subkey found, else 0.0
+double GetFlatProb(const FlatTable& table, U64 key, IntKey subkey)
+{
+  U64 row;
+  const IntKey *first, *last, *it;
+
+  if(FindFlatRow(table,key,row)){
+    first = table.ids + table.rowStart[row];
+    last = table.ids + table.rowStart[row+1];
+    it = std::lower_bound(first, last, subkey);
+    if((it != last) && (*it == subkey)){
+      return table.probs[it - table.ids];
+    }
+  }
+
+  return 0.0;
+}
+
+//unigram probability of id from a flat unigram table, straight from its dense array if it has one. Otherwise: training
+//keys are handed out densely from 1, so row id-1 is normally the word's own row; the binary search is only the
+//fallback for keys with no unigram entry.
+double GetFlatUnigramProb(const FlatTable& unigrams, IntKey id)
+{
+  if(unigrams.denseProb != NULL){
+    return (id < unigrams.nDense) ? unigrams.denseProb[id] : 0.0;
+  }
+  if((id >= 1) && (id <= unigrams.nRows) && (unigrams.keys[id-1] == (U64)id)){
+    return unigrams.probs[unigrams.rowStart[id-1]];
+  }
+
+  return GetFlatProb(unigrams, (U64)id, id);
+}
+
+//flat-table equivalent of NgramModel::GetBackoffProb(); tables is indexed by model number
+double GetFlatBackoffProb(const FlatTable tables[], int model, U64 key, IntKey word)
+{
+  int n;
+  U64 row;
+  double weight;
+  const IntKey *first, *last, *it;
+
+  weight = 1.0;
+  for(n = model; n >= 2; n--){
+    if(FindFlatRow(tables[n],key,row)){
+      first = tables[n].ids + tables[n].rowStart[row];
+      last = tables[n].ids + tables[n].rowStart[row+1];
+      it = std::lower_bound(first, last, word);
+      if((it != last) && (*it == word)){
+        return weight * (tables[n].probs[it - tables[n].ids] - tables[n].discount[row]);
+      }
+      weight *= tables[n].backoff[row];
+    }
+    key = NgramModel::SuffixContextKey(n, key);
+  }
+
+  return weight * GetFlatProb(tables[1], (U64)word, word);
+}
+
+//copies a table into CSR form in store, and points flat at it
+void BuildFlatTable(NgramTable& table, FlatTableStore& store, FlatTable& flat)
+{
+  OuterTableIt outer;
+  InnerTableIt inner;
+
+  store.keys.clear();
+  store.rowStart.clear();
+  store.ids.clear();
+  store.probs.clear();
+  store.discount.clear();
+  store.backoff.clear();
+  for(outer = table.begin(); outer != table.end(); ++outer){
+    store.keys.push_back(outer->first);
+    store.discount.push_back(outer->second.discount);
+    store.backoff.push_back(outer->second.backoff);
+    store.rowStart.push_back(store.ids.size());
+    for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+      store.ids.push_back(inner->first);
+      store.probs.push_back(inner->second);
+    }
+  }
+  store.rowStart.push_back(store.ids.size());
+
+  flat.nRows = store.keys.size();
+  flat.keys = store.keys.data();
+  flat.rowStart = store.rowStart.data();
+  flat.ids = store.ids.data();
+  flat.probs = store.probs.data();
+  flat.discount = store.discount.data();
+  flat.backoff = store.backoff.data();
+  flat.nDense = 0;
+  flat.denseRow = NULL;
+  flat.denseProb = NULL;
+}
+
+/*
+  Direct-indexed rows for a flat table whose contexts are single word ids (the unigram and bigram orders): denseRow[k]
+  is the row of context k, so FindFlatRow() is one load instead of a binary search. Ids are handed out densely from 1,
+  so the index is about as long as the vocabulary, and never longer than 64K entries. Each unigram row holds only
+  the word itself, so with unigrams set the words' probabilities are also laid out by id in denseProb.
+*/
+void BuildDenseIndex(FlatTableStore& store, FlatTable& flat, bool unigrams)
+{
+  U64 r;
+  const IntKey *first, *last, *it;
+
+  store.denseRow.clear();
+  store.denseProb.clear();
+  if((flat.nRows == 0) || (flat.keys[flat.nRows-1] > U16_MAX)){
+    return;
+  }
+
+  store.denseRow.assign(flat.keys[flat.nRows-1] + 1, FLAT_NO_ROW);
+  for(r = 0; r < flat.nRows; r++){
+    store.denseRow[flat.keys[r]] = (U32)r;
+  }
+  if(unigrams){
+    store.denseProb.assign(store.denseRow.size(), 0.0);
+    for(r = 0; r < flat.nRows; r++){
+      first = flat.ids + flat.rowStart[r];
+      last = flat.ids + flat.rowStart[r+1];
+      it = std::lower_bound(first, last, (IntKey)flat.keys[r]);
+      if((it != last) && (*it == flat.keys[r])){
+        store.denseProb[flat.keys[r]] = flat.probs[it - flat.ids];
+      }
+    }
+    flat.denseProb = store.denseProb.data();
+  }
+  flat.nDense = store.denseRow.size();
+  flat.denseRow = store.denseRow.data();
+}
+
+/*
+  Group-prefetched row search. A single binary search over a large table is a chain of dependent cache misses, so
+  LOOKUP_GROUP_SZ independent searches are advanced in lockstep, one halving step for every query in the group per
+  round, and after each step the next probe of each query is prefetched. The group's misses then overlap instead of
+  being paid one after another. Searches over the same table always take the same number of steps (the branchless
+  lower_bound below only depends on nRows), so the lockstep needs no bookkeeping.
+*/
+void FindFlatRows(const FlatTable& table, const U64 keys[], U32 n, U64 rows[], bool found[])
+{
+  U32 g, q, gEnd;
+  U64 len, half, next;
+  const U64* base[LOOKUP_GROUP_SZ];
+  const U64* b;
+  const U64* end = table.keys + table.nRows;
+
+  if(table.denseRow != NULL){
+    for(q = 0; q < n; q++){
+      found[q] = (keys[q] < table.nDense) && (table.denseRow[keys[q]] != FLAT_NO_ROW);
+      rows[q] = found[q] ? table.denseRow[keys[q]] : 0;
+    }
+    return;
+  }
+
+  for(g = 0; g < n; g += LOOKUP_GROUP_SZ){
+    gEnd = (g + LOOKUP_GROUP_SZ < n) ? (g + LOOKUP_GROUP_SZ) : n;
+    if(table.nRows == 0){
+      for(q = g; q < gEnd; q++){
+        found[q] = false;
+      }
+      continue;
+    }
+
+    for(q = g; q < gEnd; q++){
+      base[q-g] = table.keys;
+    }
+    for(len = table.nRows; len > 1; len -= half){
+      half = len / 2;
+      next = (len - half) / 2;
+      for(q = g; q < gEnd; q++){
+        b = base[q-g];
+        b = (b[half] < keys[q]) ? (b + half) : b;
+        __builtin_prefetch(b + next);
+        base[q-g] = b;
+      }
+    }
+
+    for(q = g; q < gEnd; q++){
+      b = base[q-g];
+      if(*b < keys[q]){
+        b++;
+      }
+      found[q] = (b != end) && (*b == keys[q]);
+      rows[q] = (U64)(b - table.keys);
+    }
+  }
+}
+
+//batched GetFlatProb(): rows are found with FindFlatRows(), then the subkey searches of the group run interleaved the same way
+void GetFlatProbs(const FlatTable& table, const U64 keys[], const IntKey subkeys[], U32 n, double out[])
+{
+  U32 g, q, i, cnt;
+  U32 len[LOOKUP_GROUP_SZ], half;
+  U64 rows[LOOKUP_GROUP_SZ];
+  bool found[LOOKUP_GROUP_SZ], active;
+  const IntKey* base[LOOKUP_GROUP_SZ];
+  const IntKey* last[LOOKUP_GROUP_SZ];
+  const IntKey* b;
+
+  for(g = 0; g < n; g += LOOKUP_GROUP_SZ){
+    cnt = (g + LOOKUP_GROUP_SZ < n) ? LOOKUP_GROUP_SZ : (n - g);
+    FindFlatRows(table, keys + g, cnt, rows, found);
+
+    for(i = 0; i < cnt; i++){
+      if(found[i]){
+        __builtin_prefetch(table.rowStart + rows[i]);
+      }
+    }
+    for(i = 0; i < cnt; i++){
+      len[i] = 0;
+      if(found[i]){
+        base[i] = table.ids + table.rowStart[rows[i]];
+        last[i] = table.ids + table.rowStart[rows[i]+1];
+        len[i] = last[i] - base[i];
+        __builtin_prefetch(base[i] + len[i] / 2);
+      }
+    }
+
+    //rows differ in length, so each query drops out of the lockstep when its range is down to one entry
+    do{
+      active = false;
+      for(i = 0; i < cnt; i++){
+        if(len[i] > 1){
+          half = len[i] / 2;
+          b = base[i];
+          b = (b[half] < subkeys[g+i]) ? (b + half) : b;
+          len[i] -= half;
+          __builtin_prefetch(b + len[i] / 2);
+          base[i] = b;
+          active = true;
+        }
+      }
+    }while(active);
+
+    for(i = 0; i < cnt; i++){
+      q = g + i;
+      out[q] = 0.0;
+      if(len[i] == 1){
+        b = (*base[i] < subkeys[q]) ? (base[i] + 1) : base[i];
+        if((b != last[i]) && (*b == subkeys[q])){
+          out[q] = table.probs[b - table.ids];
+        }
+      }
+    }
+  }
+}
+
+/*
+  Resolves the context rows of keySeq[first] .. keySeq[first+count-1] for the whole batch with FindFlatRows(), then
+  calls visit(j, cursors, found) for each position j in [0,count) with its rows open, prefetching the next position's
+  rows while visit works. Positions below 3 have no context and are skipped, as in Predict().
+*/
+template<class Visit>
+static void VisitFlatContexts(const FlatTable tables[], const vector<IntKey>& keySeq, int first, int count, Visit visit)
+{
+  int j, k, n, i, cnt;
+  U64 row;
+  bool found[NGRAMS+1];
+  FlatRowCursor cursors[NGRAMS+1];
+  vector<U64> keys[NGRAMS+1];
+  vector<U64> rows[NGRAMS+1];
+  vector<char> hits[NGRAMS+1];
+  bool hitBuf[LOOKUP_GROUP_SZ];
+
+  for(n = 2; n <= NGRAMS; n++){
+    keys[n].resize(count, 0);
+    rows[n].resize(count, 0);
+    hits[n].resize(count, 0);
+  }
+  for(j = 0; j < count; j++){
+    i = first + j;
+    if(i >= 3){
+      keys[4][j] = NgramModel::MakeNgramModelKey(4, keySeq[i-3], keySeq[i-2], keySeq[i-1]);
+      keys[3][j] = NgramModel::MakeNgramModelKey(3, keySeq[i-2], keySeq[i-1]);
+      keys[2][j] = NgramModel::MakeNgramModelKey(2, keySeq[i-1]);
+    }
+  }
+  for(n = 2; n <= NGRAMS; n++){
+    for(j = 0; j < count; j += LOOKUP_GROUP_SZ){
+      cnt = (j + LOOKUP_GROUP_SZ < count) ? LOOKUP_GROUP_SZ : (count - j);
+      FindFlatRows(tables[n], &keys[n][j], cnt, &rows[n][j], hitBuf);
+      for(k = 0; k < cnt; k++){
+        hits[n][j+k] = hitBuf[k];
+      }
+    }
+  }
+
+  for(j = 0; j < count; j++){
+    if(first + j < 3){
+      continue;
+    }
+    if(j + 1 < count){
+      for(n = 2; n <= NGRAMS; n++){
+        if(hits[n][j+1]){
+          row = rows[n][j+1];
+          __builtin_prefetch(tables[n].ids + tables[n].rowStart[row]);
+          __builtin_prefetch(tables[n].probs + tables[n].rowStart[row]);
+        }
+      }
+    }
+
+    for(n = 2; n <= NGRAMS; n++){
+      found[n] = hits[n][j];
+      cursors[n].id = cursors[n].end = tables[n].ids;
+      cursors[n].prob = tables[n].probs;
+      if(found[n]){
+        row = rows[n][j];
+        cursors[n].id = tables[n].ids + tables[n].rowStart[row];
+        cursors[n].end = tables[n].ids + tables[n].rowStart[row+1];
+        cursors[n].prob = tables[n].probs + tables[n].rowStart[row];
+      }
+    }
+
+    visit(j, cursors, found);
+  }
+}
+
+/*
+  Batched Predict() over flat tables, for the contexts ending just before keySeq[first] .. keySeq[first+count-1].
+  Each position runs the same InterpolateRows() kernel as Predict(). Positions below 3 get no results, as in
+  Predict(). Results are appended to results[0..count).
+*/
+void PredictFlatBatch(const FlatTable tables[], const double l[NLAMBDAS], const vector<IntKey>& keySeq, int first, int count, ResultList results[])
+{
+  const FlatTable& unigrams = tables[1];
+
+  VisitFlatContexts(tables, keySeq, first, count, [&](int j, FlatRowCursor cursors[], const bool found[]){
+    InterpolateRows(cursors[4], cursors[3], cursors[2], found, [&unigrams](IntKey id){
+      return GetFlatUnigramProb(unigrams, id);
+    }, l, results[j]);
+  });
+}
+
+/*
+  Evaluation-only counterpart of PredictFlatBatch(): ranks[j] gets the rank keySeq[first+j] would have in the
+  Predict() results of its context (see CandidateRankOf()), or 0 if it is not among them or the position has no
+  context. The candidates are merged and scored as usual but never sorted, and no ResultList is built.
+*/
+void RankFlatBatch(const FlatTable tables[], const double l[NLAMBDAS], const vector<IntKey>& keySeq, int first, int count, U32 ranks[])
+{
+  CandidateRows cands;
+  const FlatTable& unigrams = tables[1];
+
+  std::fill(ranks, ranks + count, 0);
+  VisitFlatContexts(tables, keySeq, first, count, [&](int j, FlatRowCursor cursors[], const bool found[]){
+    MergeRows(cursors[4], cursors[3], cursors[2], found, [&unigrams](IntKey id){
+      return GetFlatUnigramProb(unigrams, id);
+    }, l, cands);
+    ranks[j] = CandidateRankOf(cands, keySeq[first+j]);
+  });
+}
+
+//(re)builds the flat snapshot of all tables used by the batched lookups
+void NgramModel::FreezeTables(void)
+{
+  int n;
+  NgramTable* tables[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+
+  memset(&frozen[0], 0, sizeof(FlatTable));
+  for(n = 1; n <= NGRAMS; n++){
+    BuildFlatTable(*tables[n], frozenStore[n], frozen[n]);
+  }
+  BuildDenseIndex(frozenStore[1], frozen[1], true);
+  BuildDenseIndex(frozenStore[2], frozen[2], false);
+  tablesFrozen = true;
+}
+
+//the batched and flat-table queries read only the frozen snapshot, and never build it themselves: freezing is a write,
+//so it is the model owner's step (ProcessTables(), PruneTables(), ModelHandle::Publish()), not a reader's
+bool NgramModel::RequireFrozen(const char* caller) const
+{
+  if(!tablesFrozen){
+    cout << "ERROR " << caller << " needs frozen tables; call FreezeTables() after changing the model" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+//GetProb() for n independent key/subkey queries against one order; out[q] is 0.0 where the pair was never seen
+void NgramModel::GetProbBatch(int nModel, const U64 keys[], const U16 subkeys[], double out[], U32 n) const
+{
+  if((nModel < 1) || (nModel > NGRAMS)){
+    cout << "ERROR model " << nModel << " not found in GetProbBatch" << endl;
+    return;
+  }
+  if(!RequireFrozen("GetProbBatch")){
+    std::fill(out, out + n, 0.0);
+    return;
+  }
+
+  GetFlatProbs(frozen[nModel], keys, subkeys, n, out);
+}
+
+//GetMax() for n context keys of one order: out[q] is the most likely next word of keys[q], or 0 if the context is unseen
+void NgramModel::GetMaxBatch(int nModel, const U64 keys[], IntKey out[], U32 n) const
+{
+  U32 g, q, cnt;
+  U32 e;
+  double max;
+  U64 rows[LOOKUP_GROUP_SZ];
+  bool found[LOOKUP_GROUP_SZ];
+
+  if((nModel < 2) || (nModel > NGRAMS)){
+    cout << "ERROR model " << nModel << " not found in GetMaxBatch" << endl;
+    return;
+  }
+  if(!RequireFrozen("GetMaxBatch")){
+    std::fill(out, out + n, 0);
+    return;
+  }
+  const FlatTable& table = frozen[nModel];
+
+  for(g = 0; g < n; g += LOOKUP_GROUP_SZ){
+    cnt = (g + LOOKUP_GROUP_SZ < n) ? LOOKUP_GROUP_SZ : (n - g);
+    FindFlatRows(table, keys + g, cnt, rows, found);
+    for(q = 0; q < cnt; q++){
+      if(found[q]){
+        __builtin_prefetch(table.rowStart + rows[q]);
+      }
+    }
+    //same scan as GetMax(): the first (lowest id) of the maximal entries wins
+    for(q = 0; q < cnt; q++){
+      out[g+q] = 0;
+      if(found[q]){
+        max = 0.0;
+        for(e = table.rowStart[rows[q]]; e < table.rowStart[rows[q]+1]; e++){
+          if(table.probs[e] > max){
+            out[g+q] = table.ids[e];
+            max = table.probs[e];
+          }
+        }
+      }
+    }
+  }
+}
+
+//Predict() for the count consecutive positions starting at first, against the frozen tables; see PredictFlatBatch()
+void NgramModel::PredictBatch(const vector<IntKey>& keySeq, int first, int count, ResultList results[]) const
+{
+  int j;
+
+  if(!RequireFrozen("PredictBatch")){
+    for(j = 0; j < count; j++){
+      results[j].clear();
+    }
+    return;
+  }
+
+  PredictFlatBatch(frozen, lambdas.l, keySeq, first, count, results);
+}
+
+//ranks[j] gets the rank of keySeq[first+j] in PredictBatch()'s results for it, 0 if absent; see RankFlatBatch()
+void NgramModel::RankBatch(const vector<IntKey>& keySeq, int first, int count, U32 ranks[]) const
+{
+  if(!RequireFrozen("RankBatch")){
+    std::fill(ranks, ranks + count, 0);
+    return;
+  }
+
+  RankFlatBatch(frozen, lambdas.l, keySeq, first, count, ranks);
+}
+
+/*
+  Beam search for multi-word suggestions. Each step extends every phrase in the beam with the top k predictions for
+  its last three words and keeps the beamWidth best extensions by summed log2 score. Beams that end in the same three
+  words share one interpolation (memoized by the 4-gram context key), and context rows are resolved once per query
+  (memoized per order), so beams that share a suffix, eg "... of the", never search the tables twice.
+  The elapsed time is checked before every expansion: once budgetMs is spent, the phrases of the last completed step
+  are returned. Context words with key 0 (unknown) simply leave the orders that would need them unmatched.
+  phrases gets the final beam, best first.
+*/
+void NgramModel::CompletePhrase(const vector<IntKey>& context, int maxWords, int beamWidth, int k, vector<PhraseCompletion>& phrases, double budgetMs) const
+{
+  int depth, n, pos;
+  U32 b, j;
+  U64 ctxKey, keys[NGRAMS+1], row;
+  IntKey last[NGRAMS-1];
+  double deadline;
+  bool found[NGRAMS+1], expired;
+  FlatRowCursor cursors[NGRAMS+1];
+  vector<PhraseCompletion> beam, next;
+  PhraseCompletion cand;
+  ResultList* topK;
+  unordered_map<U64,ResultList> topKCache;
+  unordered_map<U64,U64> rowCache[NGRAMS+1];  //key -> row, or U64_MAX for an unseen context
+  unordered_map<U64,U64>::iterator rit;
+  unordered_map<U64,ResultList>::iterator tit;
+
+  deadline = WallSeconds() + budgetMs / 1000.0;
+  phrases.clear();
+  if((maxWords < 1) || (beamWidth < 1) || (k < 1) || !RequireFrozen("CompletePhrase")){
+    return;
+  }
+  const FlatTable& unigrams = frozen[1];
+
+  cand.log2Score = 0.0;
+  beam.push_back(cand);
+  expired = false;
+  for(depth = 0; (depth < maxWords) && !expired; depth++){
+    next.clear();
+    for(b = 0; b < beam.size(); b++){
+      if(WallSeconds() > deadline){
+        expired = true;
+        break;
+      }
+
+      //last three words of context + phrase, oldest first, 0-padded
+      for(j = 0; j < NGRAMS-1; j++){
+        pos = (int)beam[b].words.size() - (NGRAMS-1) + (int)j;
+        if(pos >= 0){
+          last[j] = beam[b].words[pos];
+        }
+        else if((int)context.size() + pos >= 0){
+          last[j] = context[context.size() + pos];
+        }
+        else{
+          last[j] = 0;
         }
       }
-      break;
-    case 3:
-      outer = trigramTable.find(key);
-      if(outer != trigramTable.end()){
-        inner = outer->second.find(subkey);
-        if(inner != outer->second.end()){
-          ret = inner->second;
+      ctxKey = MakeNgramModelKey(4, last[0], last[1], last[2]);
+
+      tit = topKCache.find(ctxKey);
+      if(tit == topKCache.end()){
+        keys[4] = ctxKey;
+        keys[3] = MakeNgramModelKey(3, last[1], last[2]);
+        keys[2] = MakeNgramModelKey(2, last[2]);
+        for(n = 2; n <= NGRAMS; n++){
+          rit = rowCache[n].find(keys[n]);
+          if(rit == rowCache[n].end()){
+            rit = rowCache[n].insert(std::make_pair(keys[n], FindFlatRow(frozen[n], keys[n], row) ? row : U64_MAX)).first;
+          }
+          found[n] = (rit->second != U64_MAX);
+          cursors[n].id = cursors[n].end = frozen[n].ids;
+          cursors[n].prob = frozen[n].probs;
+          if(found[n]){
+            cursors[n].id = frozen[n].ids + frozen[n].rowStart[rit->second];
+            cursors[n].end = frozen[n].ids + frozen[n].rowStart[rit->second+1];
+            cursors[n].prob = frozen[n].probs + frozen[n].rowStart[rit->second];
+          }
         }
+        tit = topKCache.insert(std::make_pair(ctxKey, ResultList())).first;
+        InterpolateRows(cursors[4], cursors[3], cursors[2], found, [&unigrams](IntKey id){
+          return GetFlatUnigramProb(unigrams, id);
+        }, lambdas.l, tit->second, (U32)k);
       }
-      break;
-    case 4:
-      outer = quadgramTable.find(key);
-      if(outer != quadgramTable.end()){
-        inner = outer->second.find(subkey);
-        if(inner != outer->second.end()){
-          ret = inner->second;
+      topK = &tit->second;
+
+      for(j = 0; j < topK->size(); j++){
+        if((*topK)[j].second <= 0.0){
+          continue;
         }
+        cand.words = beam[b].words;
+        cand.words.push_back((*topK)[j].first);
+        cand.log2Score = beam[b].log2Score + log2((*topK)[j].second);
+        next.push_back(cand);
       }
+    }
+    if(expired || next.empty()){
       break;
-    default:
-      cout << "ERROR model " << nModel << " not found in GetProb" << endl;
+    }
+
+    if((int)next.size() > beamWidth){
+      std::partial_sort(next.begin(), next.begin() + beamWidth, next.end(), [](const PhraseCompletion& a, const PhraseCompletion& b){
+        return a.log2Score > b.log2Score;
+      });
+      next.resize(beamWidth);
+    }
+    else{
+      sort(next.begin(), next.end(), [](const PhraseCompletion& a, const PhraseCompletion& b){ return a.log2Score > b.log2Score; });
+    }
+    beam.swap(next);
   }
 
-  return ret;
+  if(!beam[0].words.empty()){
+    phrases.swap(beam);
+  }
+}
+
+//CompletePhrase() on raw text: the context is tokenized like training text, unknown words become key 0
+void NgramModel::CompletePhrase(const string& context, int maxWords, int beamWidth, int k, vector<PhraseCompletion>& phrases, double budgetMs) const
+{
+  U32 i;
+  IntKey key;
+  vector<string> words;
+  vector<IntKey> keys;
+
+  SentenceToWords(context,words);  //a context as short as "in a" still counts
+  for(i = 0; i < words.size(); i++){
+    keys.push_back(LookupKey(words[i],key) ? key : OOV_KEY);
+  }
+
+  CompletePhrase(keys, maxWords, beamWidth, k, phrases, budgetMs);
+}
+
+//lookups per second of one-at-a-time GetProb()/Predict() against their batched versions, over every n-gram of a file;
+//GetProb() is also timed against the map tables it used before freezing
+void NgramModel::BenchmarkLookups(const string& fname)
+{
+  int n, i, j, count;
+  U32 q, nMismatch;
+  U64 mapBytes, probBytes, rowBytes[3];
+  double t0, mapSecs, singleSecs, batchSecs, sum;
+  vector<string> wordVec;
+  vector<IntKey> keySeq;
+  vector<U64> keys;
+  vector<U16> subkeys;
+  vector<double> single, batch;
+  vector<ResultList> results(PREDICT_BATCH_SZ);
+  ResultList result;
+
+  TextToWordSequence(fname,wordVec);
+  WordToKeySequence(wordVec,keySeq);
+  if(keySeq.size() < NGRAM + 1){
+    cout << "ERROR too few words for a lookup benchmark in " << fname << endl;
+    return;
+  }
+  if(!tablesFrozen){
+    FreezeTables();
+  }
+
+  //a unigram map entry is an outer node holding an NgramRow, plus the one inner node in it (tree nodes carry 32 bytes of links)
+  mapBytes = unigramTable.size() * (32 + sizeof(NgramTable::value_type) + 32 + sizeof(NgramRowMap::value_type));
+  probBytes = frozenStore[1].denseProb.size() * sizeof(double);
+  rowBytes[1] = frozenStore[1].denseRow.size() * sizeof(U32);
+  rowBytes[2] = frozenStore[2].denseRow.size() * sizeof(U32);
+  //the dense arrays index the snapshot on top of everything else; the map tables stay allocated as the mutable model
+  cout << "Lookup benchmark over " << fname << " (" << keySeq.size() << " words):" << endl;
+  cout << "  dense index adds " << (probBytes + rowBytes[1] + rowBytes[2]) << " bytes: " << probBytes << " unigram probs, "
+       << rowBytes[1] << " unigram rows, " << rowBytes[2] << " bigram rows" << endl;
+  cout << "  unigram lookups no longer touch " << mapBytes << " bytes of map nodes, which stay allocated" << endl;
+  for(n = 1; n <= NGRAMS; n++){
+    keys.clear();
+    subkeys.clear();
+    for(i = n - 1; i < (int)keySeq.size(); i++){
+      keys.push_back(MakeNgramModelKey(n, keySeq[i-n+1], (n > 2) ? keySeq[i-n+2] : 0, (n > 3) ? keySeq[i-n+3] : 0));
+      subkeys.push_back(keySeq[i]);
+    }
+    single.resize(keys.size());
+    batch.resize(keys.size());
+
+    t0 = WallSeconds();
+    for(q = 0; q < keys.size(); q++){
+      batch[q] = GetMapProb(n, keys[q], subkeys[q]);
+    }
+    mapSecs = WallSeconds() - t0;
+    nMismatch = 0;
+    for(q = 0; q < keys.size(); q++){
+      nMismatch += (batch[q] != GetProb(n, keys[q], subkeys[q]));
+    }
+
+    t0 = WallSeconds();
+    for(q = 0; q < keys.size(); q++){
+      single[q] = GetProb(n, keys[q], subkeys[q]);
+    }
+    singleSecs = WallSeconds() - t0;
+
+    t0 = WallSeconds();
+    GetProbBatch(n, keys.data(), subkeys.data(), batch.data(), keys.size());
+    batchSecs = WallSeconds() - t0;
+
+    for(q = 0; q < keys.size(); q++){
+      nMismatch += (single[q] != batch[q]);
+    }
+    cout << "  " << n << "-gram GetProb: " << (keys.size() / mapSecs) << "/s map, " << (keys.size() / singleSecs) << "/s single, "
+         << (keys.size() / batchSecs) << "/s batched (" << (singleSecs / batchSecs) << "x, " << nMismatch << " mismatches)" << endl;
+  }
+
+  sum = 0.0;
+  t0 = WallSeconds();
+  for(i = 0; i < (int)keySeq.size(); i++){
+    Predict(keySeq,i,result);
+    sum += result.size();
+    result.clear();
+  }
+  singleSecs = WallSeconds() - t0;
+  t0 = WallSeconds();
+  for(i = 0; i < (int)keySeq.size(); i += count){
+    count = ((int)keySeq.size() - i < PREDICT_BATCH_SZ) ? ((int)keySeq.size() - i) : PREDICT_BATCH_SZ;
+    PredictBatch(keySeq, i, count, results.data());
+    for(j = 0; j < count; j++){
+      sum -= results[j].size();
+      results[j].clear();
+    }
+  }
+  batchSecs = WallSeconds() - t0;
+  cout << "  Predict: " << (keySeq.size() / singleSecs) << "/s single, " << (keySeq.size() / batchSecs) << "/s batched ("
+       << (singleSecs / batchSecs) << "x" << ((sum != 0.0) ? ", MISMATCHED result counts" : "") << ")" << endl;
 }
 
 void NgramModel::ScoreResult(IntKey actual, ResultList& results)
 {
-  double i;
-  ResultListIt it;
+  U32 i;
+
+  for(i = 0; (i < results.size()) && (results[i].first != actual); i++);
+  ScoreRank((i < results.size()) ? (i + 1) : 0);
+}
 
+//accumulates one prediction whose actual word came in at rank (1-based), or was missing from the results if rank is 0
+void NgramModel::ScoreRank(U32 rank)
+{
   lambdas.nPredictions++;
 
-  if(actual == results.begin()->first->first){
-    lambdas.boolAccuracy++;
+  if(rank == 0){
+    return;
   }
 
-  i = 1.0;
-  for(it = results.begin(); it != results.end(); ++it, i++){
-    if(it->first->first == actual){
-      lambdas.recall++;
-      lambdas.realAccuracy += (1 / i);
-      if(i <= 7){
-        lambdas.topSevenAccuracy++;
-      }
-    }
+  if(rank == 1){
+    lambdas.boolAccuracy++;
+  }
+  lambdas.recall++;
+  lambdas.realAccuracy += (1 / (double)rank);
+  if(rank <= 7){
+    lambdas.topSevenAccuracy++;
   }
 }
 
-//returns IntKey key of a word, or allocates a new key for the word if it doesn't already exist
+//returns IntKey key of a word, or allocates a new key for the word if it doesn't already exist. Training only; text
+//being evaluated goes through LookupKey() or WordToKeySequence(), which map unknown words to OOV_KEY
 IntKey NgramModel::StringToKey(const string& word)
 {
   IntKey ret;
@@ -732,10 +2877,10 @@ IntKey NgramModel::StringToKey(const string& word)
   return ret;
 }
 
-bool NgramModel::KeyToString(IntKey key, string& str)
+bool NgramModel::KeyToString(IntKey key, string& str) const
 {
   bool ret;
-  KeyStringMapIt it = KeyStringTable.find(key);
+  KeyStringMapConstIt it = KeyStringTable.find(key);
 
   if(it != KeyStringTable.end()){
     str = it->second;
@@ -784,7 +2929,7 @@ bool NgramModel::AllocKey(const string& newWord, IntKey& key)
 
   ASAP change params to both string
 */
-void NgramModel::NormalizeText(char ibuf[BUFSIZE], string& ostr)
+void NgramModel::NormalizeText(char ibuf[BUFSIZE], string& ostr) const
 {
   string istr = ibuf;
   //string ostr;
@@ -828,7 +2973,7 @@ void NgramModel::NormalizeText(char ibuf[BUFSIZE], string& ostr)
   */
 }
 
-bool NgramModel::IsPhraseDelimiter(char c)
+bool NgramModel::IsPhraseDelimiter(char c) const
 {
   U32 i;
 
@@ -856,7 +3001,7 @@ bool NgramModel::IsPhraseDelimiter(char c)
   Notes: This function could be made more advanced. Currently it makes direct replacement
   of phrase/word delimiters with our delimiters (without regard to context, etc)
 */
-void NgramModel::DelimitText(string& istr)
+void NgramModel::DelimitText(string& istr) const
 {
   int i, k;
 
@@ -884,7 +3029,7 @@ void NgramModel::DelimitText(string& istr)
   }
 }
 
-bool NgramModel::IsWordDelimiter(char c)
+bool NgramModel::IsWordDelimiter(char c) const
 {
   int i;
 
@@ -897,15 +3042,15 @@ bool NgramModel::IsWordDelimiter(char c)
   return false;
 }
 
-bool NgramModel::IsValidWord(const char* word)
+bool NgramModel::IsValidWord(const char* word) const
 {
   string w = word;
   return IsValidWord(w);
 }
 bool NgramModel::IsValidWord(const string& token)
 {
-  //no words longer than limit
-  if(token.length() > MAX_WORD_LEN){
+  //no words longer than limit (in characters, not bytes)
+  if((token.length() > MAX_WORD_LEN) && (Utf8Length(token) > MAX_WORD_LEN)){
     //cout << "\rWARN unusual length word in isValidWord: >" << token << "< ignored. Check parsing                        " << endl;
     return false;
   }
@@ -970,7 +3115,7 @@ bool NgramModel::IsValidWord(const string& token)
   but also difficult for parses like <phrase><hyphen-phrase><hyphen-phrase><hyphen-phrase><phrase> 
   or <phrase><hyphen-phrase><phrase><hyphen-phrase><phrase> which occur often in Huck Finn.
 */
-void NgramModel::ScrubHyphens(string& istr)
+void NgramModel::ScrubHyphens(string& istr) const
 {
   int i;
 
@@ -988,7 +3133,7 @@ void NgramModel::ScrubHyphens(string& istr)
   Convert various temp tags back to their natural equivalents.
   For now, just converts "Mr+" back to the abbreviation "Mr."
 */
-void NgramModel::FinalPass(string& buf)
+void NgramModel::FinalPass(string& buf) const
 {
   for(int i = 0; i < buf.length(); i++){
     if(buf[i] == PERIOD_HOLDER){
@@ -997,73 +3142,180 @@ void NgramModel::FinalPass(string& buf)
   }
 }
 
-void NgramModel::ToLower(string& myStr)
+/*
+  ASCII fast paths of ToLower() and RawPass(): each transforms s in place up to the first byte with its high bit set
+  (or len) and returns how far it got. SSE2 is part of x86-64, so the 16-byte loops need no runtime check; a block
+  holding any non-ASCII byte is left to the scalar loop, which stops at that byte.
+*/
+static U32 LowerAscii(char* s, U32 len)
 {
-  for(int i = 0; i < myStr.length(); i++){
-    if((myStr[i] >= 'A') && (myStr[i] <= 'Z')){
-      myStr[i] += 32;
+  U32 i = 0;
+
+#ifdef __SSE2__
+  __m128i v, upper;
+  const __m128i belowA = _mm_set1_epi8('A' - 1), aboveZ = _mm_set1_epi8('Z' + 1), caseBit = _mm_set1_epi8(32);
+
+  for( ; i + 16 <= len; i += 16){
+    v = _mm_loadu_si128((const __m128i*)(s + i));
+    if(_mm_movemask_epi8(v) != 0){
+      break;
+    }
+    upper = _mm_and_si128(_mm_cmpgt_epi8(v, belowA), _mm_cmplt_epi8(v, aboveZ));
+    _mm_storeu_si128((__m128i*)(s + i), _mm_add_epi8(v, _mm_and_si128(upper, caseBit)));
+  }
+#endif
+  for( ; (i < len) && ((unsigned char)s[i] < 0x80); i++){
+    if((s[i] >= 'A') && (s[i] <= 'Z')){
+      s[i] += 32;
     }
   }
+
+  return i;
 }
 
-//standardize input by converting to lowercase
-void NgramModel::ToLower(char buf[BUFSIZE])
+//whitespace/control chars, commas and the few ASCII chars past 'z' become wordDelimiter
+static U32 RawPassAscii(char* s, U32 len, char wordDelimiter)
 {
-  int i;
+  U32 i = 0;
 
-  for(i = 0; buf[i] != '\0'; i++){
-    if((buf[i] >= 'A') && (buf[i] <= 'Z')){
-      buf[i] += 32;
-      //cout << buf[i] << " from " << (buf[i] -32) << endl;
+#ifdef __SSE2__
+  __m128i v, replace;
+  const __m128i space = _mm_set1_epi8(32), aboveZ = _mm_set1_epi8(122), comma = _mm_set1_epi8(','), delim = _mm_set1_epi8(wordDelimiter);
+
+  for( ; i + 16 <= len; i += 16){
+    v = _mm_loadu_si128((const __m128i*)(s + i));
+    if(_mm_movemask_epi8(v) != 0){
+      break;
     }
+    replace = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpgt_epi8(v, aboveZ)), _mm_cmpeq_epi8(v, comma));
+    _mm_storeu_si128((__m128i*)(s + i), _mm_or_si128(_mm_and_si128(replace, delim), _mm_andnot_si128(replace, v)));
   }
+#endif
+  for( ; (i < len) && ((unsigned char)s[i] < 0x80); i++){
+    if((s[i] < 32) || (s[i] > 122) || (s[i] == ',')){
+      s[i] = wordDelimiter;
+    }
+  }
+
+  return i;
 }
 
 /*
-  Raw char transformer. currently just replaces any newlines or tabs with spaces. And erases "CHAPTER" headings.
-  changes commas to wordDelimiter
+  Unicode case folding. ASCII runs are lowered in place; from the first non-ASCII character on the rest is
+  rebuilt, since a folded character need not take as many bytes as the original (eg U+212A KELVIN SIGN -> 'k').
 */
-void NgramModel::RawPass(string& istr)
+void NgramModel::ToLower(string& myStr)
 {
-  int i;
+  U32 i, n, len, cp;
+  char enc[4];
+  string out;
 
-  for(i = 0; istr[i] != '\0'; i++){
-    if((istr[i] < 32) || (istr[i] > 122)){ // convert whitespace chars and extended range chars to spaces
-    //if((istr[i] == '\n') || (istr[i] == '\t') || (istr[i] == '\r') || (istr[i] == ',')){
-      istr[i] = wordDelimiter;
+  len = myStr.length();
+  i = LowerAscii(&myStr[0], len);
+  if(i == len){
+    return;
+  }
+
+  out.reserve(len + 8);
+  out.assign(myStr, 0, i);
+  while(i < len){
+    if((unsigned char)myStr[i] < 0x80){
+      n = i + LowerAscii(&myStr[i], len - i);
+      out.append(myStr, i, n - i);
+      i = n;
+      continue;
     }
-    else if(istr[i] == ','){   //HACK
-      istr[i] = wordDelimiter;
+    n = DecodeUtf8(&myStr[i], cp);
+    if(cp == UTF8_INVALID){
+      out += myStr[i];
+    }
+    else{
+      out.append(enc, EncodeUtf8(FoldCase(cp), enc));
     }
+    i += n;
+  }
 
-    /*
-    //HACK erase "CHAPTER n." from input, a common header in Hucklberry Finn
-    // left two checks short-circuit to only allow call strncmp if next two letters are "CH" (ie, high prob. of "CHAPTER")
-    if(((i + 16) < len) && (istr[i] == 'C') && (istr[i+1] == 'H') && !strncmp("CHAPTER",&istr[i],7)){
-      j = i + 8;
-      for( ; (i < j) && (i < len); i++){
-        istr[i] = phraseDelimiter;
-      }
-      //now we point at 'X' in "CHAPTER X", so consume chapter numerals until we hit the period
-      for( ; (istr[i] != '.') && (i < len); i++){
-        istr[i] = phraseDelimiter;
-      }
-      if(i == len){
-        cout << "ERROR istrfer misalignment in rawPass()" << endl;
-      }
-      else{
-        istr[i++] = phraseDelimiter;  
-      }
+  myStr.swap(out);
+}
+
+//standardize input by converting to lowercase; the result is cut at a character boundary if folding lengthened it
+void NgramModel::ToLower(char buf[BUFSIZE]) const
+{
+  U32 n;
+  string s = buf;
+
+  ToLower(s);
+  n = Utf8Boundary(s, BUFSIZE - 1);
+  memcpy(buf, s.data(), n);
+  buf[n] = '\0';
+}
+
+/*
+  Raw char transformer. Replaces whitespace and control chars, commas, and ill-formed UTF-8 bytes with
+  wordDelimiter. Other non-ASCII characters are kept if they belong to words, and otherwise replaced with the ASCII
+  they stand for (CodePointClass()): a curly apostrophe becomes '\'', an en dash '-', a guillemet '"', etc, so
+  the later passes treat them like their ASCII equivalents. Han and Hiragana characters are set off by delimiters
+  so each is a word. Pure ASCII text is transformed in place; the rest of a line is rebuilt from its first
+  non-ASCII character on, picking the in-place path back up for every ASCII run.
+*/
+void NgramModel::RawPass(string& istr) const
+{
+  U32 i, n, len, cp;
+  char cls;
+  string out;
+
+  len = istr.length();
+  i = RawPassAscii(&istr[0], len, wordDelimiter);
+  if(i == len){
+    return;
+  }
+
+  out.reserve(len + len / 2);
+  out.assign(istr, 0, i);
+  while(i < len){
+    if((unsigned char)istr[i] < 0x80){
+      n = i + RawPassAscii(&istr[i], len - i, wordDelimiter);
+      out.append(istr, i, n - i);
+      i = n;
+      continue;
     }
-    */
+
+    n = DecodeUtf8(&istr[i], cp);
+    cls = (cp == UTF8_INVALID) ? CP_WORD_BREAK : CodePointClass(cp);
+    switch(cls){
+      case CP_WORD:
+        out.append(istr, i, n);
+        break;
+      case CP_DROP:
+        break;
+      case CP_PHRASE_BREAK:
+        out += phraseDelimiter;
+        break;
+      case CP_WORD_BREAK:
+        out += wordDelimiter;
+        break;
+      case CP_IDEOGRAPH:
+        if(!out.empty() && (out[out.length() - 1] != wordDelimiter)){
+          out += wordDelimiter;
+        }
+        out.append(istr, i, n);
+        out += wordDelimiter;
+        break;
+      default:
+        out += cls;
+        break;
+    }
+    i += n;
   }
+
+  istr.swap(out);
 }
 
 /*
   This is the most general is-delim check:
   Detects if char is ANY of our delimiters (phrase, word, or other/user-defined.)
 */
-bool NgramModel::IsDelimiter(const char c, const string& delims)
+bool NgramModel::IsDelimiter(const char c, const string& delims) const
 {
   int i;
 
@@ -1076,16 +3328,109 @@ bool NgramModel::IsDelimiter(const char c, const string& delims)
   return false;
 }
 
-void NgramModel::TextToWordSequence(const string& fname, vector<string>& wordVec)
+//normalizes and tokenizes one line of raw text, appending the valid words to wordVec
+void NgramModel::LineToWords(char buf[BUFSIZE], vector<string>& wordVec) const
+{
+  if(strnlen(buf,BUFSIZE) > 5){  //ignore lines of less than 10 chars
+    BufferToWords(buf,wordVec);
+  }
+}
+
+/*
+  Normalizes and tokenizes one buffer of text, whatever its length. Normalizing can lengthen the text (setting off
+  each ideograph takes a delimiter per character), so the normalized text is tokenized a buffer at a time, each piece
+  ending at a delimiter, rather than cut back to one buffer.
+*/
+void NgramModel::BufferToWords(char buf[BUFSIZE], vector<string>& wordVec) const
 {
   int nTokens, i;
-  U32 wordCt;
-  char buf[BUFSIZE];
+  U64 pos, len, cut;
   char* toks[MAX_TOKENS_PER_READ];
+  string s;
+
+  buf[BUFSIZE-1] = '\0';
+  NormalizeText(buf,s);
+
+  for(pos = 0; pos < s.length(); pos += len){
+    len = s.length() - pos;
+    if(len > BUFSIZE - 1){
+      len = Utf8Boundary(s.data() + pos, len, BUFSIZE - 1);
+      len = (len > 0) ? len : (BUFSIZE - 1);
+      for(cut = len; (cut > 0) && !IsDelimiter(s[pos+cut], delimiters) && !IsDelimiter(s[pos+cut-1], delimiters); cut--);
+      len = (cut > 0) ? cut : len;  //a single token longer than the buffer is split after all
+    }
+    memcpy(buf, s.data() + pos, len);
+    buf[len] = '\0';
+    nTokens = Tokenize(toks,buf,delimiters);
+
+    //push each of these tokens to back of vector
+    for(i = 0; i < nTokens; i++){
+      //no filtering except some basic validity checks
+      if(IsValidWord(toks[i])){
+        wordVec.push_back(toks[i]);
+      }
+    }
+  }
+}
+
+/*
+  Tokenizes one line of any length with LineToWords(), a buffer at a time. Each piece ends at a character boundary,
+  so an over-long line never has a UTF-8 sequence cut in two.
+*/
+void NgramModel::LongLineToWords(const char* line, U64 len, vector<string>& wordVec) const
+{
+  U64 pos, n;
+  char buf[BUFSIZE];
+
+  pos = 0;
+  do{
+    n = Utf8Boundary(line + pos, len - pos, BUFSIZE - 1);
+    n = ((n > 0) || (pos == len)) ? n : (BUFSIZE - 1);  //only continuation bytes: nothing to keep whole
+    memcpy(buf, line + pos, n);
+    buf[n] = '\0';
+    LineToWords(buf,wordVec);
+    pos += n;
+  }while(pos < len);
+}
+
+/*
+  Tokenizes one piece of text to be scored or completed (a sentence, a phrase context) with the training
+  normalization. Unlike LineToWords() there is no minimum length, so "yes" or "ok go" are words too. Text longer
+  than a buffer goes through in chunks, as SplitCorpus() does with long lines, but each chunk ends at whitespace
+  (and never inside a UTF-8 sequence) so no word is cut in two.
+*/
+void NgramModel::SentenceToWords(const string& sentence, vector<string>& wordVec) const
+{
+  U64 i, len, cut;
+  char buf[BUFSIZE];
+
+  for(i = 0; i < sentence.length(); i += len){
+    len = sentence.length() - i;
+    if(len > BUFSIZE - 1){
+      len = Utf8Boundary(sentence.data() + i, len, BUFSIZE - 1);
+      len = (len > 0) ? len : (BUFSIZE - 1);  //only continuation bytes: nothing to keep whole
+      for(cut = len; (cut > 0) && !isspace((unsigned char)sentence[i+cut]) && !isspace((unsigned char)sentence[i+cut-1]); cut--);
+      len = (cut > 0) ? cut : len;  //a single word longer than the buffer is split after all
+    }
+    memcpy(buf, sentence.data() + i, len);
+    buf[len] = '\0';
+    BufferToWords(buf,wordVec);
+  }
+}
+
+void NgramModel::TextToWordSequence(const string& fname, vector<string>& wordVec)
+{
+  U64 lastReport;
+  string line;
   long double fsize, progress;
-  string line, word, s;
-  fstream infile(fname.c_str(), ios::in);
+  fstream infile;
+
+  if(ingestThreads > 0){
+    PipelinedTextToWordSequence(fname,wordVec,ingestThreads);
+    return;
+  }
 
+  infile.open(fname.c_str(), ios::in);
   //stopfile.open(stopWordFile.c_str(), ios::read);
   if(!infile){
     cout << "ERROR could not open file: " << fname << endl;
@@ -1100,54 +3445,329 @@ void NgramModel::TextToWordSequence(const string& fname, vector<string>& wordVec
 
   wordVec.reserve(1 << 24); //reserve space for about 1.6 million words
 
-  //cout << "max_size of list<string>: " << wordSequence.max_size() << "  fsize: " << fsize << endl; 
-
-  wordCt = 0;
-  while(infile.getline(buf,BUFSIZE)){  // same as: while (getline( myfile, line ).good())
-    if(strnlen(buf,BUFSIZE) > 5){  //ignore lines of less than 10 chars
-      //strncpy(buf,line.c_str(),255);
-      buf[BUFSIZE-1] = '\0';
-      s.clear();
-      NormalizeText(buf,s);
-      strncpy(buf,s.c_str(),BUFSIZE-1);
-      buf[BUFSIZE-1] = '\0';
-      nTokens = Tokenize(toks,buf,delimiters);
-
-      //push each of these tokens to back of vector
-      for(i = 0; i < nTokens; i++){
-        word = toks[i];
-
-        //no filtering except some basic validity checks
-        if(IsValidWord(word)){
-          word = toks[i];
-          wordVec.push_back(word);
-          wordCt++;
-          //cout << word << " " << flush;
-        }
+  lastReport = 0;
+  while(getline(infile,line)){
+    LongLineToWords(line.data(), line.length(), wordVec);
+    if(wordVec.size() >= lastReport + 1000){
+      lastReport = wordVec.size();
+      progress = (long double)infile.tellg();
+      cout << "\r" << (int)((progress / fsize) * 100) << "% complete wordSeq.size()=" << wordVec.size() << "             " << flush;
+    }
+  }
+  cout << endl;
 
-        if((wordCt % 1000) == 0){
-          progress = (long double)infile.tellg();
-          cout << "\r" << (int)((progress / fsize) * 100) << "% complete wordSeq.size()=" << wordVec.size() << "             " << flush;
-        }
+  infile.close();
+}
+
+/*
+  Ring of large read buffers shared by one reader thread and the tokenizer threads. The reader only fills a slot
+  once a tokenizer has returned it, which bounds memory and applies backpressure when tokenizing falls behind;
+  tokenizers block only when the disk does. Every filled slot ends on a line boundary (the partial last line is
+  carried into the next slot), and carries a sequence number so the word output can be stitched back in file order.
+*/
+typedef struct ingestRing{
+  std::mutex lock;
+  std::condition_variable slotFree;
+  std::condition_variable slotFull;
+  vector<vector<char> > slots;
+  vector<U64> slotLen;
+  vector<U64> slotSeq;
+  deque<int> freeSlots;
+  deque<int> fullSlots;
+  std::deque<vector<string> > output;  //index by sequence number; deque so appends don't move earlier slots
+  bool done;
+  int readErrno;  //errno of a failed read(), which ends the stream early; 0 if the reader got to EOF
+} IngestRing;
+
+static void IngestReader(int fd, IngestRing* ring)
+{
+  int slot, err;
+  U64 len, carry, offset, seq;
+  ssize_t nRead;
+  char* last;
+  vector<char> tail;
+
+  offset = seq = 0;
+  err = 0;
+  nRead = 1;
+  while(nRead > 0){
+    {
+      std::unique_lock<std::mutex> guard(ring->lock);
+      while(ring->freeSlots.empty()){
+        ring->slotFree.wait(guard);
+      }
+      slot = ring->freeSlots.front();
+      ring->freeSlots.pop_front();
+    }
+
+    //start with the partial line left over from the previous slot, then fill the rest from disk
+    vector<char>& buf = ring->slots[slot];
+    carry = tail.size();
+    if(carry > 0){
+      memcpy(buf.data(), tail.data(), carry);
+    }
+    len = carry;
+    while(len < buf.size()){
+      nRead = read(fd, buf.data() + len, buf.size() - len);
+      if((nRead < 0) && (errno == EINTR)){
+        continue;
+      }
+      if(nRead <= 0){
+        err = (nRead < 0) ? errno : 0;
+        break;
       }
+      len += nRead;
+      offset += nRead;
     }
+    //ask the kernel to start on the slot after next while this one is tokenized
+    posix_fadvise(fd, offset, INGEST_BUF_SZ, POSIX_FADV_WILLNEED);
+
+    //at EOF the whole remainder is a line; otherwise cut after the last newline (or at the end of a huge line)
+    tail.clear();
+    if(nRead > 0){
+      last = (char*)memrchr(buf.data(), '\n', len);
+      if(last != NULL){
+        tail.assign(last + 1, buf.data() + len);
+        len = (U64)(last + 1 - buf.data());
+      }
+    }
+
+    std::lock_guard<std::mutex> guard(ring->lock);
+    ring->slotLen[slot] = len;
+    ring->slotSeq[slot] = seq++;
+    ring->output.push_back(vector<string>());
+    ring->fullSlots.push_back(slot);
+    ring->slotFull.notify_one();
   }
-  cout << endl;
 
-  //NOT HERE! init numwords after we prune the vocabulary
-  //this->numwords = wordSequence.size();
+  std::lock_guard<std::mutex> guard(ring->lock);
+  ring->readErrno = err;
+  ring->done = true;
+  ring->slotFull.notify_all();
+}
 
-  /*
-  i = 0;
-  for(vector<string>::iterator it = wordSequence.begin(); it != wordSequence.end(); ++it){
-    cout << " " << *it;
-    i++;
-    if(i % 20 == 0){
-      cout << " " << endl;
+void NgramModel::IngestConsumer(IngestRing* ring)
+{
+  int slot;
+  U64 len;
+  char *line, *end, *newline;
+  vector<string>* words;
+
+  while(true){
+    {
+      std::unique_lock<std::mutex> guard(ring->lock);
+      while(ring->fullSlots.empty() && !ring->done){
+        ring->slotFull.wait(guard);
+      }
+      if(ring->fullSlots.empty()){
+        return;
+      }
+      slot = ring->fullSlots.front();
+      ring->fullSlots.pop_front();
+      words = &ring->output[ring->slotSeq[slot]];
+    }
+
+    //same line handling as TextRangeToWordSequence(): over-long lines go through in BUFSIZE pieces
+    line = ring->slots[slot].data();
+    end = line + ring->slotLen[slot];
+    while(line < end){
+      newline = (char*)memchr(line, '\n', end - line);
+      len = (newline != NULL) ? (U64)(newline - line) : (U64)(end - line);
+      LongLineToWords(line, len, *words);
+      line += len + 1;
     }
+
+    std::lock_guard<std::mutex> guard(ring->lock);
+    ring->freeSlots.push_back(slot);
+    ring->slotFree.notify_one();
+  }
+}
+
+/*
+  Pipelined ingestion: a reader thread streams the file through a ring of INGEST_RING_SLOTS buffers of
+  INGEST_BUF_SZ bytes with sequential/willneed readahead hints, while nConsumers threads normalize and tokenize
+  the filled buffers. On a cold page cache this overlaps disk waits with tokenizing instead of alternating them.
+  Produces the same word sequence as the serial path (barring single lines longer than a whole buffer).
+*/
+//false if the file could not be read to the end, in which case nothing is added to wordVec
+bool NgramModel::PipelinedTextToWordSequence(const string& fname, vector<string>& wordVec, int nConsumers)
+{
+  int i, fd;
+  U64 nWords;
+  IngestRing ring;
+  vector<std::thread> consumers;
+
+  fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0){
+    cout << "ERROR could not open file: " << fname << endl;
+    return false;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  ring.done = false;
+  ring.readErrno = 0;
+  ring.slots.resize(INGEST_RING_SLOTS);
+  ring.slotLen.resize(INGEST_RING_SLOTS);
+  ring.slotSeq.resize(INGEST_RING_SLOTS);
+  for(i = 0; i < INGEST_RING_SLOTS; i++){
+    ring.slots[i].resize(INGEST_BUF_SZ);
+    ring.freeSlots.push_back(i);
+  }
+
+  std::thread reader(IngestReader, fd, &ring);
+  for(i = 0; i < nConsumers; i++){
+    consumers.push_back(std::thread(&NgramModel::IngestConsumer, this, &ring));
+  }
+  reader.join();
+  for(i = 0; i < nConsumers; i++){
+    consumers[i].join();
+  }
+  close(fd);
+
+  //a truncated corpus would train without complaint, so a failed read loses the whole file rather than its tail
+  if(ring.readErrno != 0){
+    cout << "ERROR read failed in " << fname << ": " << strerror(ring.readErrno) << endl;
+    return false;
+  }
+
+  nWords = 0;
+  for(i = 0; i < (int)ring.output.size(); i++){
+    nWords += ring.output[i].size();
+  }
+  wordVec.reserve(wordVec.size() + nWords);
+  for(i = 0; i < (int)ring.output.size(); i++){
+    wordVec.insert(wordVec.end(), std::make_move_iterator(ring.output[i].begin()), std::make_move_iterator(ring.output[i].end()));
+    vector<string>().swap(ring.output[i]);
+  }
+  cout << fname << ": " << nWords << " words" << endl;
+
+  return true;
+}
+
+//evicts a file's clean pages from the page cache, so the next read of it is cold (no root needed)
+static void DropFileCache(const string& fname)
+{
+  int fd = open(fname.c_str(), O_RDONLY);
+
+  if(fd >= 0){
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+//times serial vs pipelined ingestion of fname, each from a cold page cache
+void NgramModel::BenchmarkIngest(const string& fname)
+{
+  int saveThreads;
+  double t0, serialSecs, pipedSecs, mb;
+  struct stat st;
+  vector<string> serialWords, pipedWords;
+
+  if(stat(fname.c_str(), &st) != 0){
+    cout << "ERROR could not stat benchmark file: " << fname << endl;
+    return;
+  }
+  mb = (double)st.st_size / (1024.0 * 1024.0);
+  saveThreads = ingestThreads;
+
+  DropFileCache(fname);
+  ingestThreads = 0;
+  t0 = WallSeconds();
+  TextToWordSequence(fname,serialWords);
+  serialSecs = WallSeconds() - t0;
+
+  DropFileCache(fname);
+  ingestThreads = saveThreads;
+  t0 = WallSeconds();
+  PipelinedTextToWordSequence(fname,pipedWords,(saveThreads > 0) ? saveThreads : 1);
+  pipedSecs = WallSeconds() - t0;
+
+  cout << "Cold-cache ingest of " << fname << " (" << mb << " MB):" << endl;
+  cout << "  serial:    " << serialSecs << "s  " << (mb / serialSecs) << " MB/s  " << serialWords.size() << " words" << endl;
+  cout << "  pipelined: " << pipedSecs << "s  " << (mb / pipedSecs) << " MB/s  " << pipedWords.size() << " words"
+       << "  (" << ((serialWords == pipedWords) ? "identical" : "MISMATCHED") << " output)" << endl;
+}
+
+/*
+  Times LineToWords() (normalizing and tokenizing, no I/O) over each file's lines held in memory, best of
+  TOKENIZE_BENCH_REPS runs, and reports it with the file's share of non-ASCII bytes, eg to compare an English corpus
+  against a mixed-script one.
+*/
+void NgramModel::BenchmarkTokenizer(const vector<string>& fnames)
+{
+  U32 f, r;
+  U64 i, bytes, nonAscii;
+  double t0, secs, best, mb;
+  string line;
+  vector<string> lines, words;
+  fstream infile;
+
+  for(f = 0; f < fnames.size(); f++){
+    infile.open(fnames[f].c_str(), ios::in);
+    if(!infile){
+      cout << "ERROR could not open file: " << fnames[f] << endl;
+      continue;
+    }
+    lines.clear();
+    bytes = nonAscii = 0;
+    while(getline(infile,line)){
+      for(i = 0; i < line.length(); i++){
+        nonAscii += ((unsigned char)line[i] >= 0x80) ? 1 : 0;
+      }
+      bytes += line.length() + 1;
+      lines.push_back(line);
+    }
+    infile.close();
+    mb = (double)bytes / (1024.0 * 1024.0);
+
+    best = 0.0;
+    for(r = 0; r < TOKENIZE_BENCH_REPS; r++){
+      words.clear();
+      t0 = WallSeconds();
+      for(i = 0; i < lines.size(); i++){
+        LongLineToWords(lines[i].data(), lines[i].length(), words);  //as when ingesting
+      }
+      secs = WallSeconds() - t0;
+      if((r == 0) || (secs < best)){
+        best = secs;
+      }
+    }
+
+    cout << "Tokenizing " << fnames[f] << " (" << mb << " MB, " << (100.0 * nonAscii / (bytes ? bytes : 1)) << "% non-ASCII bytes): "
+         << best << "s  " << (mb / best) << " MB/s  " << words.size() << " words" << endl;
+  }
+}
+
+/*
+  Tokenizes the lines of fname that start within the byte range [start,end). A line straddling start belongs
+  to the previous range, so consecutive ranges cover every line exactly once. Quiet, since it runs on pool workers.
+  Lines longer than BUFSIZE are processed in BUFSIZE pieces rather than ending the read.
+*/
+void NgramModel::TextRangeToWordSequence(const string& fname, U64 start, U64 end, vector<string>& wordVec)
+{
+  U64 pos;
+  string line;
+  fstream infile(fname.c_str(), ios::in);
+
+  if(!infile){
+    cout << "ERROR could not open file: " << fname << endl;
+    return;
+  }
+
+  pos = start;
+  if(start > 0){
+    infile.seekg(start - 1);
+    if(infile.get() != '\n'){
+      infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+      pos = start - 1 + infile.gcount() + 1;
+    }
+  }
+
+  while((pos < end) && getline(infile,line)){
+    pos += line.length() + 1;
+    LongLineToWords(line.data(), line.length(), wordVec);
   }
-  cout << "\nend of your list sir" << endl;
-  */
 
   infile.close();
 }
@@ -1162,7 +3782,7 @@ void NgramModel::TextToWordSequence(const string& fname, vector<string>& wordVec
   Testing: This used to take a len parameter, but it was redundant with null checks and made the function 
   too nasty to debug for various boundary cases, causing errors.
 */
-int NgramModel::Tokenize(char* ptrs[], char buf[BUFSIZE], const string& delims)
+int NgramModel::Tokenize(char* ptrs[], char buf[BUFSIZE], const string& delims) const
 {
   int i, tokCt;
   //int dummy;
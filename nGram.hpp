@@ -11,9 +11,13 @@
   Eliminating these should have little effect at the max-likelihood end of the predictions, where predictions coalesce.
 */
 
+#ifndef NGRAM_HPP
+#define NGRAM_HPP
+
 #include <list>
 #include <map>
 #include <unordered_set> //use these for result duplicate subkey filtering
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -30,8 +34,13 @@
 #include <string>
 #include <algorithm>
 #include <cmath>
+#include <limits>
+#include <iterator>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <mutex>
+#include <atomic>
+#include <scoped_allocator>
 
 //defines max foreseeable ligetSubEnne length in the freqTable.txt database
 #define MAX_LINE_LEN 256
@@ -42,12 +51,24 @@
 #define BUFSIZE 4096
 #define MAX_WORDS_PER_PHRASE 256  //these params are not very safe in updateNgramTable--possible segfaults
 #define MAX_PHRASES_PER_READ 256
-#define MAX_TOKENS_PER_READ 1024  //about bufsize / 4.
+#define MAX_TOKENS_PER_READ (BUFSIZE / 2 + 1)  //one-byte tokens between single delimiters, plus Tokenize()'s NULL
 #define MAX_SENT_LEN 256  //not very robust. but a constraint is needed on the upperbound of sentence length, for phrase parsing data structures.
 // avg sentence length is around 10-15 words, 20+ being a long sentence.
 //#define PHRASE_DELIMITER '#'
 //#define WORD_DELIMITER ' '
-#define FILE_DELIMITER '|'
+#define FILE_DELIMITER '|'  //separates multiple training paths in Train(const string&)
+#define CORPUS_CHUNK_SZ (1 << 26)  //files larger than this (64MB) are split into chunks that tokenize in parallel
+#define SPLIT_RATIO_PERIOD 1000    //lines per cycle of a SplitRule made by RatioSplit()
+#define INGEST_BUF_SZ (1 << 22)  //4MB read buffers for pipelined ingestion
+#define SCORE_BLOCK_SZ 1024      //sentences per work item in bulk scoring
+#define TABLE_BLOCK_SZ 4096      //context rows per work item in parallel table passes (normalizing, pruning)
+#define LOOKUP_GROUP_SZ 16       //independent searches interleaved per group in the batched flat-table lookups
+#define PREDICT_BATCH_SZ 256     //contexts per PredictBatch() call when testing
+#define PHRASE_BUDGET_MS 20.0    //default CompletePhrase() latency budget per query
+#define INGEST_RING_SLOTS 4      //buffers in flight between the reader thread and the tokenizers
+#define TOKENIZE_BENCH_REPS 5    //timed passes per file in BenchmarkTokenizer(), best kept
+#define FLAT_NO_ROW 0xFFFFFFFF   //dense row index entry of a context that has no row
+#define OOV_KEY 0                //key of every word outside the vocabulary; AllocKey() starts at 1, so no table holds it
 #define PERIOD_HOLDER '+'
 #define ASCII_DELETE 127
 #define INF_ENTROPY 9999  //constant for infinite entropy: 9999 bits is enormous (think of it as 2^9999) 
@@ -59,6 +80,14 @@
 #define DBG 0
 #define U16_MAX 65535
 #define U32_MAX 4294967295
+#define U64_MAX 18446744073709551615ULL
+#define BACKOFF_MIN_DENOM 1e-6  //floor on the lower-order mass left for a context's unseen words, bounding its backoff weight
+#define ARENA_CHUNK_SZ (1ULL << 25)   //32MB table arena mappings, a whole number of huge pages
+#define ARENA_SLAB_SZ (1 << 16)       //bytes a thread takes from the arena's chunk at a time
+#define ARENA_GRAIN 16                //arena allocations are rounded up to this
+#define ARENA_SIZE_CLASSES 16         //freed blocks up to ARENA_GRAIN * ARENA_SIZE_CLASSES bytes are reused
+#define ARENA_THREAD_SLABS 4          //arenas a thread keeps a slab in at once
+#define HUGE_PAGE_SZ (1 << 21)
 
 //using namespace std;
 using std::cout;
@@ -70,6 +99,7 @@ using std::cin;
 using std::map;
 //using std::multimap;
 using std::unordered_set;
+using std::unordered_map;
 using std::list;
 using std::sort;
 using std::flush;
@@ -88,21 +118,191 @@ typedef unsigned int U32; // may be U64, depending on sys
 typedef unsigned short int U16;
 typedef U16 IntKey;  //see header notes. This value determines the max number of unique words in the training data
 
+double WallSeconds(void);  //wall clock time for the benchmarks, in seconds
+//sections of the mapped model and count shard files start on 8-byte boundaries
+U64 AlignUp(U64 n);
+void WritePadded(fstream& out, const void* data, U64 len);  //writes len bytes, then zero pads out to 8 bytes
+
+enum arenaPageModes{ ARENA_PAGES_NORMAL, ARENA_PAGES_TRANSPARENT, ARENA_PAGES_EXPLICIT };
+
+/*
+  Storage for the nodes of one model's tables and vocabulary. Nodes are carved from large anonymous mappings instead
+  of one malloc() each, and the model tears its tables down by unmapping the chunks rather than freeing tens of
+  millions of nodes one at a time (see NgramModel::~NgramModel()). The chunks can be backed by huge pages to cut TLB
+  misses on the tree walks: transparent ones (madvise) by default, or explicit ones (MAP_HUGETLB, from the
+  vm.nr_hugepages pool), which fall back to transparent ones if the pool is empty.
+
+  Any number of threads may allocate at once, eg the per-worker counting tables and the per-order merges: each
+  thread takes ARENA_SLAB_SZ bytes at a time under the lock and carves its nodes from that slab alone, keeping
+  slabs in its ARENA_THREAD_SLABS most recently used arenas. Freed nodes go on the arena's lists by size under the
+  lock, and are taken first by later allocations; while a size has nothing freed, allocating it takes no lock.
+  Memory freed in one arena is only ever reused by that arena.
+*/
+class TableArena{
+  public:
+    int pageMode;  //an arenaPageModes; takes effect from the next chunk mapped
+
+    TableArena();
+    ~TableArena();
+
+    void* Allocate(size_t bytes);
+    void Deallocate(void* p, size_t bytes);
+    U64 MappedBytes(void);
+    U32 NumChunks(void);
+    U64 NumSlabs(void);
+
+  private:
+    U64 id;  //unique over the process, so a thread never takes a new arena at a freed one's address for its own
+    std::mutex lock;
+    vector<pair<char*,U64> > chunks;
+    char* chunkNext;
+    char* chunkEnd;
+    U64 nSlabs;
+    void* freeList[ARENA_SIZE_CLASSES+1];                //by size / ARENA_GRAIN
+    std::atomic<U64> freeCount[ARENA_SIZE_CLASSES+1];
+
+    void* TakeFreed(U32 sizeClass);
+    void Refill(struct arenaSlab* slab, size_t bytes);
+    char* MapChunk(U64 bytes);
+
+    TableArena(const TableArena&);
+    TableArena& operator=(const TableArena&);
+};
+
+//STL allocator over a TableArena, or over the heap when arena is NULL. Containers swap their allocators along with
+//their nodes, so a table swapped with a temporary still frees each node into the arena it came from.
+template<typename T> class ArenaAllocator{
+  public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_swap;
+
+    TableArena* arena;
+
+    ArenaAllocator() : arena(NULL) {}
+    ArenaAllocator(TableArena* a) : arena(a) {}
+    template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n){ return (T*)(arena ? arena->Allocate(n * sizeof(T)) : ::operator new(n * sizeof(T))); }
+    void deallocate(T* p, size_t n){ if(arena){ arena->Deallocate(p, n * sizeof(T)); } else{ ::operator delete(p); } }
+};
+
+template<typename T, typename U> bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b){ return a.arena == b.arena; }
+template<typename T, typename U> bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b){ return a.arena != b.arena; }
+
+typedef map<IntKey,double,std::less<IntKey>,ArenaAllocator<pair<const IntKey,double> > > NgramRowMap;
+
 //WARNING These data structures only work on 64 bit systems, and only supports up to four-gram sequences (each word gets a U16 key)
-typedef map<U64,map<IntKey,double> > NgramTable;
-typedef map<IntKey,double>::iterator InnerTableIt;
+//A context row: the probabilities of every continuation seen after one context, plus a small header.
+//count is set when the table is normalized; the rest by ComputeBackoffWeights().
+//A row inside a table gets its entries from the table's arena (the allocator-extended constructors, through
+//TableAllocator); a row standing alone uses the heap.
+typedef struct ngramRow : public NgramRowMap{
+  double count;       //raw frequency of the context
+  double discount;    //absolute discount D/count, taken off each seen continuation's probability
+  double unseenMass;  //mass the discounting frees for unseen continuations, D*N1+(context)/count
+  double backoff;     //weight on the lower order for continuations unseen in this context
+  double logBackoff;  //log2(backoff), for log-space scoring
+  ngramRow() : count(0.0), discount(0.0), unseenMass(0.0), backoff(1.0), logBackoff(0.0) {}
+  explicit ngramRow(const allocator_type& a) : NgramRowMap(a), count(0.0), discount(0.0), unseenMass(0.0), backoff(1.0), logBackoff(0.0) {}
+  ngramRow(const ngramRow& other, const allocator_type& a) : NgramRowMap(other, a), count(other.count), discount(other.discount),
+    unseenMass(other.unseenMass), backoff(other.backoff), logBackoff(other.logBackoff) {}
+  ngramRow(ngramRow&& other, const allocator_type& a) : NgramRowMap(std::move(other), a), count(other.count), discount(other.discount),
+    unseenMass(other.unseenMass), backoff(other.backoff), logBackoff(other.logBackoff) {}
+} NgramRow;
+
+typedef std::scoped_allocator_adaptor<ArenaAllocator<pair<const U64,NgramRow> > > TableAllocator;
+typedef map<U64,NgramRow,std::less<U64>,TableAllocator> NgramTable;
+typedef NgramRowMap::iterator InnerTableIt;
+typedef NgramRowMap::const_iterator InnerTableConstIt;
 typedef NgramTable::iterator OuterTableIt;
-typedef pair<InnerTableIt,double> ResultPair;
-typedef list<ResultPair > ResultList;
+typedef NgramTable::const_iterator OuterTableConstIt;
+typedef pair<IntKey,double> ResultPair;  //word key and its interpolated score
+typedef vector<ResultPair > ResultList;
 typedef ResultList::iterator ResultListIt;
 
 
 
 //key to string, and string to key manager data types
-typedef map<IntKey,string> KeyStringMap;
+typedef map<IntKey,string,std::less<IntKey>,ArenaAllocator<pair<const IntKey,string> > > KeyStringMap;
 typedef KeyStringMap::iterator KeyStringMapIt;
-typedef map<string,IntKey> StringKeyMap;
+typedef KeyStringMap::const_iterator KeyStringMapConstIt;
+typedef map<string,IntKey,std::less<string>,ArenaAllocator<pair<const string,IntKey> > > StringKeyMap;
 typedef StringKeyMap::iterator StringKeyMapIt;
+typedef StringKeyMap::const_iterator StringKeyMapConstIt;
+
+//Read-only, pointer-free view of one n-gram table: contexts sorted by key, each row a sorted run of subkeys
+//with parallel probabilities (CSR layout). The arrays may live in the heap or in a mapped model file.
+typedef struct flatTable{
+  U64 nRows;
+  const U64* keys;       //[nRows] outer keys, ascending
+  const U32* rowStart;   //[nRows+1] row r spans [rowStart[r], rowStart[r+1]) of ids/probs
+  const IntKey* ids;     //subkeys, ascending within each row
+  const double* probs;
+  const double* discount; //[nRows] row headers, as in NgramRow
+  const double* backoff;
+  U64 nDense;             //contexts below nDense are direct-indexed by denseRow; 0 if the table has no dense index
+  const U32* denseRow;    //[nDense] row of each single-word context (unigram and bigram orders), FLAT_NO_ROW if unseen
+  const double* denseProb; //[nDense] probability of each word id, unigram order only
+} FlatTable;
+
+//heap storage behind a FlatTable built from an NgramTable (NgramModel::FreezeTables(), the mapped model export)
+typedef struct flatTableStore{
+  vector<U64> keys;
+  vector<U32> rowStart;
+  vector<IntKey> ids;
+  vector<double> probs;
+  vector<double> discount;
+  vector<double> backoff;
+  vector<U32> denseRow;
+  vector<double> denseProb;
+} FlatTableStore;
+
+bool FindFlatRow(const FlatTable& table, U64 key, U64& row);
+double GetFlatProb(const FlatTable& table, U64 key, IntKey subkey);
+double GetFlatBackoffProb(const FlatTable tables[], int model, U64 key, IntKey word);
+double GetFlatUnigramProb(const FlatTable& unigrams, IntKey id);
+
+void BuildFlatTable(NgramTable& table, FlatTableStore& store, FlatTable& flat);
+void BuildDenseIndex(FlatTableStore& store, FlatTable& flat, bool unigrams);
+
+//batched, software-prefetched versions of the above for many independent queries; see nGram.cc
+void FindFlatRows(const FlatTable& table, const U64 keys[], U32 n, U64 rows[], bool found[]);
+void GetFlatProbs(const FlatTable& table, const U64 keys[], const IntKey subkeys[], U32 n, double out[]);
+void PredictFlatBatch(const FlatTable tables[], const double l[NLAMBDAS], const vector<IntKey>& keySeq, int first, int count, ResultList results[]);
+void RankFlatBatch(const FlatTable tables[], const double l[NLAMBDAS], const vector<IntKey>& keySeq, int first, int count, U32 ranks[]);
+
+//a line-aligned byte range of one training file; doc is the index of the file (document) it belongs to
+typedef struct corpusChunk{
+  string fname;
+  U32 doc;
+  U64 start;
+  U64 end;
+} CorpusChunk;
+
+enum splitSets{ SPLIT_TRAIN, SPLIT_HELDOUT, SPLIT_TEST, SPLIT_SETS };
+
+/*
+  Deterministic corpus split: non-blank lines are numbered from 1 and taken modulo period. Residues in
+  [heldOutFirst,heldOutLast] go to the held-out set, residues in [testFirst,testLast] to the test set, and the rest
+  to training. An empty range has first > last. Eg the old buildHeldOutData.py split of the Slate test file is
+  {500, 490, 499, 0, 489}: ten lines in every 500 held out for the lambdas, the rest tested.
+*/
+typedef struct splitRule{
+  U32 period;
+  U32 heldOutFirst;
+  U32 heldOutLast;
+  U32 testFirst;
+  U32 testLast;
+} SplitRule;
+
+//each set's token stream in file order, ready for Train(), LambdaEM() (through ProcessTables()) and Test()
+typedef struct corpusSplit{
+  vector<string> words[SPLIT_SETS];
+  U64 lines[SPLIT_SETS];
+} CorpusSplit;
+
+class WorkStealingPool;
+struct ingestRing;
 
 typedef struct lambdaSet{
   double l[NLAMBDAS];
@@ -113,6 +313,21 @@ typedef struct lambdaSet{
   double nPredictions;
 } LambdaSet;
 
+//log2 probability and perplexity of one scored sentence. Tokens the model gives no probability (OOV) are
+//counted in nOov and left out of both, as is conventional for perplexity.
+typedef struct sentenceScore{
+  double log2Prob;
+  double perplexity;
+  U32 nTokens;
+  U32 nOov;
+} SentenceScore;
+
+//one CompletePhrase() suggestion: the words following the context, and the sum of their log2 interpolated scores
+typedef struct phraseCompletion{
+  vector<IntKey> words;
+  double log2Score;
+} PhraseCompletion;
+
 typedef struct modelStat{
   double sumFrequency;
   double totalEntropy;               //raw entropy across a single model. Though seemingly meaningless for anything but 1-gram models, total entropy gives us a sparsity-measure for other n-gram models for n>1.
@@ -129,6 +344,8 @@ class NgramModel{
     modelStat stats[5];  //index by ngram model number
     lambdaSet lambdas;
 
+    TableArena arena;  //nodes of the tables and the vocabulary below, so it must be declared before them
+
     string phraseDelimiters;
     string rawDelimiters;
     string wordDelimiters;
@@ -146,65 +363,296 @@ class NgramModel{
     KeyStringMap KeyStringTable;
     StringKeyMap StringKeyTable;
 
+    int ingestThreads;  //tokenizer threads for pipelined file reads; 0 selects the serial single-thread reader
+    bool frequencyRankedKeys;  //renumber keys by descending frequency before counting (see RankKeysByFrequency())
+
+    //flat snapshot of the tables for the batched lookups. Anything that changes the tables clears tablesFrozen, and
+    //the owner must FreezeTables() again before querying; the const query calls refuse to run on a stale snapshot.
+    FlatTableStore frozenStore[NGRAMS+1];
+    FlatTable frozen[NGRAMS+1];
+    bool tablesFrozen;
+
     NgramModel();
     ~NgramModel();
     
     //interaction layer for the key/string model
     IntKey StringToKey(const string& word);
-    bool KeyToString(IntKey key, string& str);
+    bool KeyToString(IntKey key, string& str) const;
     bool AllocKey(const string& newWord, IntKey& key);
     
     //utils
-    U64 MakeNgramModelKey(int model, IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
+    static U64 MakeNgramModelKey(int model, IntKey w1, IntKey w2 = 0, IntKey w3 = 0);
+    static U64 SuffixContextKey(int model, U64 key);
     void UpdateNgramModel(NgramTable& table, U64 key, IntKey nextWord);
     void UpdateUnigramModel(NgramTable& unigrams, IntKey key);
     void TablesToLogSpace(void);
     void TableToLogSpace(NgramTable& table);
     void UnigramTableToLogSpace(NgramTable& unigrams);
-    void WordToKeySequence(vector<string>& wordVec, vector<IntKey>& keySequence);
+    U64 WordToKeySequence(vector<string>& wordVec, vector<IntKey>& keySequence) const;  //read-only; returns the OOV count
     void ScoreResult(IntKey actual, ResultList& results);
-    void Predict(vector<IntKey> keySeq, int i, ResultList& results);
+    void ScoreRank(U32 rank);
+    void Predict(const vector<IntKey>& keySeq, int i, ResultList& results, U32 topK = 0) const;  //topK > 0 keeps only the best topK
     void PruneSequence(vector<string>& wordVec);
+    void PruneDocuments(vector<vector<string> >& docs);
     void NormalizeTables(void);
-    void NormalizeUnigramTable(NgramTable& unitable);
-    void NormalizeTable(NgramTable& table);
-    double GetProb(int nModel, U64 key, U16 subkey);
+    void NormalizeUnigramTable(NgramTable& unitable, ModelStat& stat);
+    void NormalizeTable(NgramTable& table, ModelStat& stat);
+    void PrintModelStats(void);
+    void ReleaseTable(NgramTable& table);
+    double GetProb(int nModel, U64 key, U16 subkey) const;
+    double GetMapProb(int nModel, U64 key, U16 subkey) const;
+    void FreezeTables(void);
+    bool RequireFrozen(const char* caller) const;
+    void GetProbBatch(int nModel, const U64 keys[], const U16 subkeys[], double out[], U32 n) const;
+    void GetMaxBatch(int nModel, const U64 keys[], IntKey out[], U32 n) const;
+    void PredictBatch(const vector<IntKey>& keySeq, int first, int count, ResultList results[]) const;
+    void RankBatch(const vector<IntKey>& keySeq, int first, int count, U32 ranks[]) const;
+    void BenchmarkLookups(const string& fname);
+    void BenchmarkSuffixIndex(const string& trainFile, const string& testFile);
+    void BenchmarkSampler(U64 nWords);
+    void BenchmarkStages(const string& trainFile, const string& testFile);
+    void CompletePhrase(const vector<IntKey>& context, int maxWords, int beamWidth, int k, vector<PhraseCompletion>& phrases, double budgetMs = PHRASE_BUDGET_MS) const;
+    void CompletePhrase(const string& context, int maxWords, int beamWidth, int k, vector<PhraseCompletion>& phrases, double budgetMs = PHRASE_BUDGET_MS) const;
+    void ComputeBackoffWeights(void);
+    void ComputeRowBackoff(int n, U64 key, NgramRow& row);
+    void RecomputeBackoffWeights(int n, WorkStealingPool& pool);
+    void PruneTables(double threshold, const string& testFile = "");
+    U64 PruneTable(int n, double threshold, WorkStealingPool& pool);
+    double GetBackoffProb(int model, U64 key, IntKey word) const;
+    double GetBackoffProb(const vector<IntKey>& keySeq, int i) const;
+    bool GetBackoffLog2Prob(int model, U64 key, IntKey word, double& log2Prob) const;
+
+    //bulk scoring
+    bool LookupKey(const string& word, IntKey& key) const;
+    void ScoreSentence(const IntKey* keys, U32 len, SentenceScore& score) const;
+    void ScoreSentences(const vector<vector<IntKey> >& sentences, vector<SentenceScore>& scores, int nThreads = 0) const;
+    void ScoreSentences(const vector<string>& sentences, vector<SentenceScore>& scores, int nThreads = 0) const;
+    void ScoreFile(const string& fname);
     void PrintResults(void);
+    void ResetAccuracy(void);
+    double TopSevenAccuracy(const vector<IntKey>& keySequence);
     U16 GetMax(NgramTable& table, U64 outerKey);
-    void LambdaEM(void);
+    void LambdaEM(const vector<IntKey>& keySeq);
+    bool ExportMappedModel(const string& fname);
 
     //text processing
-    void NormalizeText(char ibuf[BUFSIZE], string& ostr);
-    void DelimitText(string& istr);
-    bool IsWordDelimiter(char c);
-    bool IsValidWord(const char* word);
-    bool IsValidWord(const string& token);
-    void ScrubHyphens(string& istr);
-    void FinalPass(string& buf);
-    void ToLower(string& myStr);
-    void ToLower(char buf[BUFSIZE]);
-    void RawPass(string& istr);
-    bool IsDelimiter(const char c, const string& delims);
+    void NormalizeText(char ibuf[BUFSIZE], string& ostr) const;
+    void DelimitText(string& istr) const;
+    bool IsWordDelimiter(char c) const;
+    bool IsValidWord(const char* word) const;
+    static bool IsValidWord(const string& token);
+    void ScrubHyphens(string& istr) const;
+    void FinalPass(string& buf) const;
+    static void ToLower(string& myStr);  //case folding as in training, also for text outside a model
+    void ToLower(char buf[BUFSIZE]) const;
+    void RawPass(string& istr) const;
+    bool IsDelimiter(const char c, const string& delims) const;
     void TextToWordSequence(const string& fname, vector<string>& wordVec);
-    int Tokenize(char* ptrs[], char buf[BUFSIZE], const string& delims);
-    bool IsPhraseDelimiter(char c);
+    void TextRangeToWordSequence(const string& fname, U64 start, U64 end, vector<string>& wordVec);
+    void LineToWords(char buf[BUFSIZE], vector<string>& wordVec) const;
+    void BufferToWords(char buf[BUFSIZE], vector<string>& wordVec) const;
+    void SentenceToWords(const string& sentence, vector<string>& wordVec) const;
+    void LongLineToWords(const char* line, U64 len, vector<string>& wordVec) const;
+    bool PipelinedTextToWordSequence(const string& fname, vector<string>& wordVec, int nConsumers);
+    void IngestConsumer(struct ingestRing* ring);
+    void BenchmarkIngest(const string& fname);
+    void BenchmarkTokenizer(const vector<string>& fnames);
+    int Tokenize(char* ptrs[], char buf[BUFSIZE], const string& delims) const;
+    bool IsPhraseDelimiter(char c) const;
 
     //public
-    void Train(const string& fname);
+    void Train(const string& fname, const vector<string>& heldOut);
+    void Train(const vector<string>& paths, const vector<string>& heldOut);
+    void Train(CorpusSplit& split);
+    void TrainDocuments(vector<vector<string> >& docs, const vector<string>& heldOut, WorkStealingPool& pool);
+    void ProcessTables(const vector<string>& heldOut);
+
+    //single-pass train/held-out/test splitting (see SplitRule)
+    bool SplitCorpus(const string& fname, const SplitRule& rule, CorpusSplit& split);
+    SplitRule RatioSplit(double heldOutFraction, double testFraction);
+
+    //raw-count shards for training split across processes or hosts (see countShard.hpp)
+    bool WriteCountShard(const vector<string>& paths, const string& fname);
+    bool ExportCountShard(const string& fname);
+    bool TrainFromCountShard(const string& fname, const vector<string>& heldOut);
+
+    //multi-file corpus ingestion
+    bool TokenizeCorpus(const vector<string>& paths, vector<vector<string> >& docs, WorkStealingPool& pool);
+    void ExpandCorpusPaths(const vector<string>& paths, vector<string>& files);
+    void ChunkCorpus(const vector<string>& files, vector<CorpusChunk>& chunks);
+    void DocumentsToKeySequences(vector<vector<string> >& docs, vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool);
+    void CountDocuments(const vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool);
+    void CountDocuments(const vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool, NgramTable* modelTables[]);
+    void CountSequence(const vector<IntKey>& keySeq, NgramTable* tables[]);
+    void RankKeysByFrequency(vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool);
+    void RenumberByFrequency(const vector<U64>& freqs, vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool);
+    void RemapKeys(const vector<IntKey>& newKey, vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool);
+    void RemapTable(NgramTable& table, int model, const vector<IntKey>& newKey);
+    U64 DeltaVarintIdBytes(NgramTable& table);
     void Test(const string& fname);
+    void Test(vector<string>& words);
 };
 
+/*
+  Merge-join interpolation kernel behind NgramModel::Predict() and MappedModel::Predict().
+  The caller resolves the context row of each order once; since every row is sorted by word key, a single merged
+  walk over the 4-, 3- and 2-gram rows visits each candidate once, with all of its higher-order probabilities in hand,
+  so there are no per-candidate re-finds of the context rows and no duplicate set. Only the unigram lookup is per
+  candidate, since the unigram "row" is the whole table.
+
+  Scores are bit-identical to the original scoring formula: a candidate's score uses the highest order containing it,
+  and lower-order misses are smoothed by the minimal 4-gram (min4) and 3-gram (min3) estimates of this context, where
+  min3 only ranges over 3-gram entries not already scored from the 4-gram row. Those minima are only known once the
+  rows are exhausted, so 3- and 2-gram-only candidates get their smoothing terms in a fixup pass, added in the same
+  order as before. Ties sort as the old stable list sort left them: 4-gram candidates first, then 3, then 2, each by key.
+  One deliberate difference: a found row that yields no minimum smooths with 0, where the original let its 99999
+  initial value leak into every lower-order candidate's score.
+
+  The merge is inherently serial, so it only gathers each candidate's terms into a structure-of-arrays buffer; the
+  scoring and ranking passes then run over whole rows with SIMD (see ScoreCandidates() and RankCandidates()).
+  topK > 0 returns just the best topK candidates, found by threshold filtering instead of a full sort.
+
+  Cursor must provide Done(), Id(), Prob() and Next(); found[n] tells whether the order-n context row exists.
+*/
+typedef struct mapRowCursor{
+  InnerTableConstIt it, end;
+  bool Done(void) const { return it == end; }
+  IntKey Id(void) const { return it->first; }
+  double Prob(void) const { return it->second; }
+  void Next(void){ ++it; }
+} MapRowCursor;
+
+typedef struct flatRowCursor{
+  const IntKey *id, *end;
+  const double* prob;
+  bool Done(void) const { return id == end; }
+  IntKey Id(void) const { return *id; }
+  double Prob(void) const { return *prob; }
+  void Next(void){ ++id; ++prob; }
+} FlatRowCursor;
 
-
-
-
-
-
-
-
-
-
-
-
-
-
+/*
+  Candidate buffer filled by the merge in InterpolateRows(): one slot per candidate word. x3 and x4 hold the 3- and
+  4-gram terms, or NaN where the term is the context's min3/min4 smoothing, which is only known after the merge.
+*/
+typedef struct candidateRows{
+  vector<IntKey> ids;
+  vector<U16> order;  //highest order whose row contains the id
+  vector<double> uni;
+  vector<double> p2;
+  vector<double> x3;
+  vector<double> x4;
+  vector<double> score;
+
+  void Clear(void)
+  {
+    ids.clear(); order.clear(); uni.clear(); p2.clear(); x3.clear(); x4.clear(); score.clear();
+  }
+} CandidateRows;
+
+//ranking order of the results: score desc, then order desc, then id asc (how the old stable list sort left ties)
+typedef struct candidateRank{
+  const CandidateRows* cands;
+  bool operator()(U32 a, U32 b) const
+  {
+    if(cands->score[a] != cands->score[b]){
+      return cands->score[a] > cands->score[b];
+    }
+    if(cands->order[a] != cands->order[b]){
+      return cands->order[a] > cands->order[b];
+    }
+    return cands->ids[a] < cands->ids[b];
+  }
+} CandidateRank;
+
+void ScoreCandidates(CandidateRows& cands, double min3, double min4, const double l[NLAMBDAS]);
+void RankCandidates(const CandidateRows& cands, U32 topK, vector<U32>& ranked);
+U32 CandidateRankOf(const CandidateRows& cands, IntKey actual);
+
+//the merge and scoring passes of InterpolateRows(), leaving cands scored but unranked
+template<class Cursor, class UnigramFn>
+void MergeRows(Cursor& c4, Cursor& c3, Cursor& c2, const bool found[NGRAMS+1], UnigramFn unigram, const double l[NLAMBDAS], CandidateRows& cands)
+{
+  IntKey id;
+  U16 order;
+  double min3, min4, p2, p3, x3, x4;
+  const double missing = std::numeric_limits<double>::quiet_NaN();
+
+  cands.Clear();
+  // (very) simple smoothing parameters for missing data
+  min4 = found[4] ? 99999 : 0.0;
+  min3 = found[3] ? 99999 : 0.0;
+
+  while(!c4.Done() || !c3.Done() || !c2.Done()){
+    id = U16_MAX;
+    if(!c4.Done() && (c4.Id() < id)) id = c4.Id();
+    if(!c3.Done() && (c3.Id() < id)) id = c3.Id();
+    if(!c2.Done() && (c2.Id() < id)) id = c2.Id();
+
+    p2 = p3 = 0.0;
+    if(!c2.Done() && (c2.Id() == id)){
+      p2 = c2.Prob();
+      c2.Next();
+    }
+    if(!c3.Done() && (c3.Id() == id)){
+      p3 = c3.Prob();
+      c3.Next();
+      order = 3;
+    }
+    else{
+      order = 2;
+    }
+
+    x3 = x4 = missing;
+    if(!c4.Done() && (c4.Id() == id)){
+      order = 4;
+      x3 = p3;
+      x4 = c4.Prob();
+      if(c4.Prob() < min4){
+        min4 = c4.Prob();
+      }
+      c4.Next();
+    }
+    else if(order == 3){
+      x3 = p3;
+      if(p3 < min3){
+        min3 = p3;
+      }
+    }
+
+    cands.ids.push_back(id);
+    cands.order.push_back(order);
+    cands.uni.push_back(unigram(id));
+    cands.p2.push_back(p2);
+    cands.x3.push_back(x3);
+    cands.x4.push_back(x4);
+  }
+
+  //a found row that contributed no minimum (eg every 3-gram entry was also a 4-gram one) has nothing to smooth with
+  if(min4 == 99999){
+    min4 = 0.0;
+  }
+  if(min3 == 99999){
+    min3 = 0.0;
+  }
+
+  ScoreCandidates(cands, min3, min4, l);
+}
+
+template<class Cursor, class UnigramFn>
+void InterpolateRows(Cursor& c4, Cursor& c3, Cursor& c2, const bool found[NGRAMS+1], UnigramFn unigram, const double l[NLAMBDAS], ResultList& results, U32 topK = 0)
+{
+  U32 i;
+  CandidateRows cands;
+  vector<U32> ranked;
+
+  MergeRows(c4, c3, c2, found, unigram, l, cands);
+  RankCandidates(cands, topK, ranked);
+
+  results.reserve(results.size() + ranked.size());
+  for(i = 0; i < ranked.size(); i++){
+    results.push_back(ResultPair(cands.ids[ranked[i]], cands.score[ranked[i]]));
+  }
+}
+
+#endif
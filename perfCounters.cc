@@ -0,0 +1,230 @@
+#include "perfCounters.hpp"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cerrno>
+
+static const U32 perfTypes[PERF_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+static const U64 perfConfigs[PERF_EVENTS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,  //the generic event is the last-level cache on both Intel and AMD, where HW_CACHE_LL often is not
+  PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+static const char* perfMissNames[PERF_EVENTS] = {"", "", "LLC", "dTLB", "branch"};
+static bool perfWarned = false;
+
+static int OpenPerfEvent(int e, int groupFd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = perfTypes[e];
+  attr.config = perfConfigs[e];
+  attr.disabled = (groupFd < 0);  //members follow the leader
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  //inherited counters cannot be read as a group, so each is read on its own, with the times to scale it by
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+StageCounters::StageCounters()
+{
+  int e, err;
+  FILE* fp;
+  int paranoid;
+
+  leader = -1;
+  err = 0;
+  t0 = 0.0;
+  for(e = 0; e < PERF_EVENTS; e++){
+    fds[e] = OpenPerfEvent(e, leader);
+    if(fds[e] < 0){
+      err = (err == 0) ? errno : err;
+    }
+    else if(leader < 0){
+      leader = fds[e];
+    }
+  }
+
+  if((leader < 0) && !perfWarned){
+    cout << "WARN hardware counters unavailable, timing stages only: ";
+    if((err == EACCES) || (err == EPERM)){
+      paranoid = -9;
+      fp = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+      if(fp != NULL){
+        if(fscanf(fp, "%d", &paranoid) != 1){
+          paranoid = -9;
+        }
+        fclose(fp);
+      }
+      cout << "perf events not permitted";
+      if(paranoid != -9){
+        cout << " (kernel.perf_event_paranoid=" << paranoid << ")";
+      }
+      cout << endl;
+    }
+    else if((err == ENOENT) || (err == ENODEV) || (err == EOPNOTSUPP)){
+      cout << "no hardware PMU exposed (eg a VM)" << endl;
+    }
+    else if(err == ENOSYS){
+      cout << "perf_event_open is not supported here" << endl;
+    }
+    else{
+      cout << strerror(err) << endl;
+    }
+    perfWarned = true;
+  }
+}
+
+StageCounters::~StageCounters()
+{
+  int e;
+
+  for(e = 0; e < PERF_EVENTS; e++){
+    if(fds[e] >= 0){
+      close(fds[e]);
+    }
+  }
+}
+
+bool StageCounters::Counting(void)
+{
+  return leader >= 0;
+}
+
+void StageCounters::Start(void)
+{
+  if(leader >= 0){
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  t0 = WallSeconds();
+}
+
+void StageCounters::Stop(StageSample& sample)
+{
+  int e;
+  U64 v[3];  //value, time enabled, time running
+
+  sample.seconds = WallSeconds() - t0;
+  if(leader >= 0){
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  }
+  for(e = 0; e < PERF_EVENTS; e++){
+    sample.counts[e] = -1.0;
+    //a group that never got onto the PMU (too few counters) runs for no time, and its counts mean nothing
+    if((fds[e] >= 0) && (read(fds[e], v, sizeof(v)) == (ssize_t)sizeof(v)) && (v[2] > 0)){
+      sample.counts[e] = (double)v[0] * ((double)v[1] / (double)v[2]);
+    }
+  }
+}
+
+void StageCounters::Report(const string& stage, const StageSample& sample, U64 tokens)
+{
+  int e;
+  bool counted = false;
+  double perToken = (tokens > 0) ? (1.0 / tokens) : 0.0;
+
+  cout << "  " << stage << ": " << sample.seconds << "s, " << tokens << " tokens, ";
+  cout << ((sample.seconds > 0.0) ? (tokens / sample.seconds / 1e6) : 0.0) << "M tokens/s";
+  if((sample.counts[PERF_CYCLES] > 0.0) && (sample.counts[PERF_INSTRUCTIONS] >= 0.0)){
+    cout << ", IPC " << (sample.counts[PERF_INSTRUCTIONS] / sample.counts[PERF_CYCLES]);
+    cout << ", " << (sample.counts[PERF_CYCLES] * perToken) << " cycles/token";
+    counted = true;
+  }
+  for(e = PERF_LLC_MISSES; e < PERF_EVENTS; e++){
+    if(sample.counts[e] >= 0.0){
+      cout << ", " << (sample.counts[e] * perToken) << " " << perfMissNames[e] << " misses/token";
+      counted = true;
+    }
+  }
+  if(!counted){
+    cout << " (timing only)";
+  }
+  cout << endl;
+}
+
+/*
+  Trains this (empty) model on trainFile a stage at a time, with hardware counters around the stages that dominate
+  a run, then predicts every word of testFile: tokenizing (the serial TextToWordSequence(), with ingestThreads set to
+  0 for the stage as BenchmarkIngest() does), counting, normalizing and Predict(). Misses per token are per training
+  token for the first three, per predicted word for Predict(). The lambdas are left at their defaults, as they do not
+  change what a prediction costs.
+*/
+void NgramModel::BenchmarkStages(const string& trainFile, const string& testFile)
+{
+  int saveThreads;
+  U32 d, i;
+  U64 nTokens;
+  vector<vector<string> > docs(1);
+  vector<vector<IntKey> > keyDocs;
+  vector<string> testWords;
+  vector<IntKey> testKeys;
+  ResultList result;
+  StageSample sample;
+  StageCounters counters;
+  WorkStealingPool pool;
+
+  if(!unigramTable.empty()){
+    cout << "ERROR stage benchmark needs an untrained model" << endl;
+    return;
+  }
+  cout << "Stage counters over " << trainFile << " / " << testFile << " (" << pool.NumWorkers() << " threads, "
+       << (counters.Counting() ? "hardware counters" : "timing only") << "):" << endl;
+
+  saveThreads = ingestThreads;
+  ingestThreads = 0;
+  counters.Start();
+  TextToWordSequence(trainFile,docs[0]);
+  counters.Stop(sample);
+  ingestThreads = saveThreads;
+  StageCounters::Report("TextToWordSequence (serial)", sample, docs[0].size());
+
+  PruneDocuments(docs);
+  DocumentsToKeySequences(docs,keyDocs,pool);
+  if(frequencyRankedKeys){
+    RankKeysByFrequency(keyDocs,pool);
+  }
+  nTokens = 0;
+  for(d = 0; d < keyDocs.size(); d++){
+    nTokens += keyDocs[d].size();
+  }
+  if(nTokens < NGRAM + 1){
+    cout << "ERROR too few words for a stage benchmark in " << trainFile << endl;
+    return;
+  }
+
+  counters.Start();
+  CountDocuments(keyDocs,pool);
+  counters.Stop(sample);
+  StageCounters::Report("CountDocuments", sample, nTokens);
+
+  counters.Start();
+  NormalizeTables();
+  counters.Stop(sample);
+  StageCounters::Report("NormalizeTables", sample, nTokens);
+
+  ComputeBackoffWeights();
+  FreezeTables();
+
+  TextToWordSequence(testFile,testWords);
+  WordToKeySequence(testWords,testKeys);
+  if(testKeys.size() < NGRAM + 1){
+    cout << "ERROR too few words for a stage benchmark in " << testFile << endl;
+    return;
+  }
+  counters.Start();
+  for(i = NGRAM; i < testKeys.size(); i++){
+    result.clear();
+    Predict(testKeys, i, result);
+  }
+  counters.Stop(sample);
+  StageCounters::Report("Predict", sample, testKeys.size() - NGRAM);
+}
@@ -0,0 +1,46 @@
+/*
+  Hardware counters around the stages of a run, through perf_event_open(2): cycles, instructions, last-level cache
+  misses, dTLB load misses and branch misses, opened as one group so they are scheduled onto the PMU together and
+  cover the same instructions. Counters are inherited by threads created after they are opened, and a child's counts
+  are folded into the parent's when it exits, so a stage run on a WorkStealingPool (whose threads are joined before
+  Run() returns) is counted whole.
+
+  Containers and locked-down hosts often forbid perf events (kernel.perf_event_paranoid, seccomp) or have no PMU
+  exposed at all (VMs). Events that do not open are reported as not counted, and if none do the stages are timed
+  only, after one warning saying why.
+*/
+
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include "workPool.hpp"
+
+enum perfEventIndices{PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS};
+
+//one stage's wall time and event counts, scaled up if the group was multiplexed; a count of -1 was not counted
+typedef struct stageSample{
+  double seconds;
+  double counts[PERF_EVENTS];
+} StageSample;
+
+class StageCounters{
+  public:
+    StageCounters();
+    ~StageCounters();
+
+    void Start(void);
+    void Stop(StageSample& sample);  //pool threads of the stage must have been joined
+    bool Counting(void);             //some event opened; false means timing only
+    //one line: time, tokens/s, and where counted IPC and misses per token
+    static void Report(const string& stage, const StageSample& sample, U64 tokens);
+
+  private:
+    int fds[PERF_EVENTS];  //-1 where the event did not open
+    int leader;            //fd of the group leader, the first event that opened
+    double t0;
+
+    StageCounters(const StageCounters&);
+    StageCounters& operator=(const StageCounters&);
+};
+
+#endif
@@ -0,0 +1,443 @@
+#include "suffixIndex.hpp"
+
+void SuffixIndex::Build(const vector<IntKey>& keySeq, WorkStealingPool& pool)
+{
+  vector<vector<IntKey> > keyDocs(1, keySeq);
+
+  Build(keyDocs,pool);
+}
+
+void SuffixIndex::Build(const vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool)
+{
+  U32 d;
+  U64 n;
+  double t0;
+
+  t0 = WallSeconds();
+  n = 0;
+  for(d = 0; d < keyDocs.size(); d++){
+    n += keyDocs[d].empty() ? 0 : (keyDocs[d].size() + 1);
+  }
+  if(n >= U32_MAX){
+    cout << "ERROR " << n << " tokens are too many for a 32-bit suffix array" << endl;
+    return;
+  }
+
+  text.clear();
+  text.reserve(n);
+  for(d = 0; d < keyDocs.size(); d++){
+    if(!keyDocs[d].empty()){
+      text.insert(text.end(), keyDocs[d].begin(), keyDocs[d].end());
+      text.push_back(0);
+    }
+  }
+
+  SortSuffixes(pool);
+  ComputeLcp(pool);
+  cout << "Suffix index built over " << text.size() << " tokens in " << (WallSeconds() - t0) << "s, " << SizeBytes() << " bytes" << endl;
+}
+
+U64 SuffixIndex::SizeBytes(void) const
+{
+  return text.size() * sizeof(IntKey) + sa.size() * sizeof(U32) + lcp.size() * sizeof(U32);
+}
+
+/*
+  Splits every tied group [first,end) of sa by key(suffix), given the rank of each suffix's group so far.
+  Phase one sorts each group on its keys, remembering the key of each slot; phase two, once every key has been read,
+  gives each suffix the rank of its new subgroup (its start slot + 1, so 0 is left for "past the end") and collects
+  the subgroups still tied. Groups are dealt to the pool in runs of about SUFFIX_TASK_SZ suffixes.
+*/
+template<class KeyFn>
+static void RefineGroups(vector<U32>& sa, vector<U32>& rank, vector<pair<U32,U32> >& groups, WorkStealingPool& pool, KeyFn key)
+{
+  U32 g, t, size;
+  vector<U32> taskFirst;
+  vector<U64> costs;
+  vector<U64> slotKey(sa.size());
+  vector<vector<pair<U64,U32> > > scratch(pool.NumWorkers());
+  vector<vector<pair<U32,U32> > > tied;
+
+  for(g = 0; g < groups.size(); g++){
+    size = groups[g].second - groups[g].first;
+    if(costs.empty() || (costs.back() >= SUFFIX_TASK_SZ)){
+      taskFirst.push_back(g);
+      costs.push_back(0);
+    }
+    costs.back() += size;
+  }
+  taskFirst.push_back(groups.size());
+  tied.resize(costs.size());
+
+  pool.Run(costs, [&](int task, int worker){
+    vector<pair<U64,U32> >& buf = scratch[worker];
+    for(U32 k = taskFirst[task]; k < taskFirst[task+1]; k++){
+      buf.clear();
+      for(U32 j = groups[k].first; j < groups[k].second; j++){
+        buf.push_back(std::make_pair(key(sa[j]), sa[j]));
+      }
+      sort(buf.begin(), buf.end());
+      for(U32 j = 0; j < buf.size(); j++){
+        slotKey[groups[k].first + j] = buf[j].first;
+        sa[groups[k].first + j] = buf[j].second;
+      }
+    }
+  });
+
+  pool.Run(costs, [&](int task, int worker){
+    for(U32 k = taskFirst[task]; k < taskFirst[task+1]; k++){
+      U32 start = groups[k].first;
+      for(U32 j = groups[k].first; j <= groups[k].second; j++){
+        if((j == groups[k].second) || (slotKey[j] != slotKey[start])){
+          if(j - start > 1){
+            tied[task].push_back(std::make_pair(start, j));
+          }
+          start = j;
+        }
+        if(j < groups[k].second){
+          rank[sa[j]] = start + 1;
+        }
+      }
+    }
+  });
+
+  groups.clear();
+  for(t = 0; t < tied.size(); t++){
+    groups.insert(groups.end(), tied[t].begin(), tied[t].end());
+  }
+}
+
+//bucket by first word, sort the buckets on the packed first SUFFIX_PACK_WORDS words, then double until no ties are left
+void SuffixIndex::SortSuffixes(WorkStealingPool& pool)
+{
+  int rounds;
+  U64 i, h, n, nBlocks;
+  vector<U64> packed, costs;
+  vector<U32> rank, fill, bucketStart(U16_MAX + 2, 0);
+  vector<pair<U32,U32> > groups;
+
+  n = text.size();
+  sa.resize(n);
+  rank.resize(n);
+  packed.resize(n);
+
+  nBlocks = (n + SUFFIX_TASK_SZ - 1) / SUFFIX_TASK_SZ;
+  costs.assign(nBlocks, SUFFIX_TASK_SZ);
+  pool.Run(costs, [&](int task, int worker){
+    U64 end = ((U64)(task + 1) * SUFFIX_TASK_SZ < n) ? (U64)(task + 1) * SUFFIX_TASK_SZ : n;
+    for(U64 p = (U64)task * SUFFIX_TASK_SZ; p < end; p++){
+      U64 k = 0;
+      for(U64 w = 0; w < SUFFIX_PACK_WORDS; w++){
+        k = (k << 16) | ((p + w < n) ? text[p + w] : 0);
+      }
+      packed[p] = k;
+    }
+  });
+
+  for(i = 0; i < n; i++){
+    bucketStart[text[i] + 1]++;
+  }
+  for(i = 1; i < bucketStart.size(); i++){
+    bucketStart[i] += bucketStart[i-1];
+  }
+  for(i = 0; i + 1 < bucketStart.size(); i++){
+    if(bucketStart[i+1] - bucketStart[i] > 1){
+      groups.push_back(std::make_pair(bucketStart[i], bucketStart[i+1]));
+    }
+  }
+  fill = bucketStart;
+  for(i = 0; i < n; i++){
+    rank[i] = bucketStart[text[i]] + 1;
+    sa[fill[text[i]]++] = (U32)i;
+  }
+
+  RefineGroups(sa, rank, groups, pool, [&packed](U32 p){ return packed[p]; });
+  vector<U64>().swap(packed);
+
+  //suffixes tied on their first h words are ordered by the rank of the h words after them
+  rounds = 0;
+  for(h = SUFFIX_PACK_WORDS; !groups.empty() && (h < n); h *= 2){
+    RefineGroups(sa, rank, groups, pool, [&rank, h, n](U32 p){ return (U64)((p + h < n) ? rank[p + h] : 0); });
+    rounds++;
+  }
+  if(!groups.empty()){
+    cout << "WARN " << groups.size() << " suffix groups are still tied after " << rounds << " doubling rounds" << endl;
+  }
+}
+
+//Kasai's algorithm on independent slices of the text; a slice starts from a zero lower bound instead of the carried one
+void SuffixIndex::ComputeLcp(WorkStealingPool& pool)
+{
+  U64 n, nBlocks;
+  vector<U32> inv;
+  vector<U64> costs;
+
+  n = text.size();
+  inv.resize(n);
+  lcp.assign(n, 0);
+  nBlocks = (n + SUFFIX_TASK_SZ - 1) / SUFFIX_TASK_SZ;
+  costs.assign(nBlocks, SUFFIX_TASK_SZ);
+
+  pool.Run(costs, [&](int task, int worker){
+    U64 end = ((U64)(task + 1) * SUFFIX_TASK_SZ < n) ? (U64)(task + 1) * SUFFIX_TASK_SZ : n;
+    for(U64 j = (U64)task * SUFFIX_TASK_SZ; j < end; j++){
+      inv[sa[j]] = (U32)j;
+    }
+  });
+
+  pool.Run(costs, [&](int task, int worker){
+    U64 h = 0;
+    U64 end = ((U64)(task + 1) * SUFFIX_TASK_SZ < n) ? (U64)(task + 1) * SUFFIX_TASK_SZ : n;
+    for(U64 p = (U64)task * SUFFIX_TASK_SZ; p < end; p++){
+      if(inv[p] == 0){
+        h = 0;
+        continue;
+      }
+      U64 q = sa[inv[p] - 1];
+      while((p + h < n) && (q + h < n) && (text[p + h] == text[q + h])){
+        h++;
+      }
+      lcp[inv[p]] = (U32)h;
+      if(h > 0){
+        h--;
+      }
+    }
+  });
+}
+
+//the word offset words into suffix sa[j], 0 past the end of the text
+IntKey SuffixIndex::WordAt(U64 j, U32 offset) const
+{
+  U64 p = (U64)sa[j] + offset;
+
+  return (p < text.size()) ? text[p] : 0;
+}
+
+//first slot in [lo,hi) whose word at offset is >= word; the range must already agree on the words before offset
+U64 SuffixIndex::LowerBound(U64 lo, U64 hi, U32 offset, IntKey word) const
+{
+  U64 mid;
+
+  while(lo < hi){
+    mid = lo + (hi - lo) / 2;
+    if(WordAt(mid, offset) < word){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+U64 SuffixIndex::UpperBound(U64 lo, U64 hi, U32 offset, IntKey word) const
+{
+  U64 mid;
+
+  while(lo < hi){
+    mid = lo + (hi - lo) / 2;
+    if(WordAt(mid, offset) <= word){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+//narrows [0,n) one word at a time: within the range for words[0..k), suffixes are sorted by their word k
+bool SuffixIndex::FindRange(const IntKey* words, U32 len, U64& lo, U64& hi) const
+{
+  U32 k;
+
+  lo = 0;
+  hi = sa.size();
+  for(k = 0; (k < len) && (lo < hi); k++){
+    if(words[k] == 0){
+      lo = hi;
+      break;
+    }
+    lo = LowerBound(lo, hi, k, words[k]);
+    hi = UpperBound(lo, hi, k, words[k]);
+  }
+  if(lo >= hi){
+    lo = hi = 0;
+    return false;
+  }
+
+  return true;
+}
+
+U64 SuffixIndex::Count(const IntKey* words, U32 len) const
+{
+  U64 lo, hi;
+
+  return FindRange(words, len, lo, hi) ? (hi - lo) : 0;
+}
+
+/*
+  The suffixes of a context range are sorted by their next word, so each continuation is a run of slots. Runs are
+  mostly short: scan the LCP array (adjacent slots share the next word iff their LCP exceeds len) for up to
+  SUFFIX_LCP_SCAN slots, then binary search for the end of a longer run. Suffixes that end the document come first
+  (0 sorts first) and are skipped.
+*/
+void SuffixIndex::ContinuationsInRange(U64 lo, U64 hi, U32 len, vector<pair<IntKey,U64> >& next) const
+{
+  U64 j, e;
+  IntKey w;
+
+  j = UpperBound(lo, hi, len, 0);
+  while(j < hi){
+    w = WordAt(j, len);
+    for(e = j + 1; (e < hi) && (e - j < SUFFIX_LCP_SCAN) && (lcp[e] > len); e++);
+    if((e < hi) && (lcp[e] > len)){
+      e = UpperBound(e, hi, len, w);
+    }
+    next.push_back(std::make_pair(w, e - j));
+    j = e;
+  }
+}
+
+void SuffixIndex::Continuations(const IntKey* words, U32 len, vector<pair<IntKey,U64> >& next) const
+{
+  U64 lo, hi;
+
+  if(FindRange(words, len, lo, hi)){
+    ContinuationsInRange(lo, hi, len, next);
+  }
+}
+
+//a suffix of length L that is followed by a word implies one of length L-1 that is, so the longest is binary searched
+U32 SuffixIndex::LongestSuffix(const IntKey* words, U32 len, U32 maxLen, U64& lo, U64& hi) const
+{
+  U32 shortest, longest, mid;
+
+  longest = (len < maxLen) ? len : maxLen;
+  shortest = 0;
+  while(shortest < longest){
+    mid = shortest + (longest - shortest + 1) / 2;
+    if(FindRange(words + len - mid, mid, lo, hi) && (UpperBound(lo, hi, mid, 0) < hi)){
+      shortest = mid;
+    }
+    else{
+      longest = mid - 1;
+    }
+  }
+  FindRange(words + len - shortest, shortest, lo, hi);
+
+  return shortest;
+}
+
+//results are the continuations of the longest context with any, scored count(context w) / count(context), best first
+void SuffixIndex::Predict(const vector<IntKey>& keySeq, int i, ResultList& results, U32 maxOrder) const
+{
+  U32 j, len;
+  U64 lo, hi, total;
+  vector<pair<IntKey,U64> > next;
+
+  if((i <= 0) || sa.empty()){
+    return;
+  }
+
+  len = LongestSuffix(keySeq.data(), (U32)i, (maxOrder > 0) ? (maxOrder - 1) : (U32)i, lo, hi);
+  ContinuationsInRange(lo, hi, len, next);
+  total = 0;
+  for(j = 0; j < next.size(); j++){
+    total += next[j].second;
+  }
+  for(j = 0; j < next.size(); j++){
+    results.push_back(ResultPair(next[j].first, (double)next[j].second / (double)total));
+  }
+  std::stable_sort(results.begin(), results.end(), [](const ResultPair& a, const ResultPair& b){ return a.second > b.second; });
+}
+
+/*
+  Builds a suffix index over trainFile, keyed with this model's vocabulary (words it does not know, eg the ones
+  PruneDocuments() dropped, key to 0 and so break matches much as the tables never saw them), and compares it with
+  the tables on testFile: count/probability lookups per order, and Predict() latency and top-7 accuracy.
+*/
+void NgramModel::BenchmarkSuffixIndex(const string& trainFile, const string& testFile)
+{
+  int n;
+  U32 i, j, q, hits, ranked;
+  U64 tableSeen, indexSeen, tableBytes;
+  IntKey key;
+  double t0, secs;
+  vector<string> wordVec;
+  vector<IntKey> trainKeys, testKeys;
+  vector<U64> keys;
+  ResultList result;
+  SuffixIndex index;
+  WorkStealingPool pool;
+
+  TextToWordSequence(trainFile,wordVec);
+  for(i = 0; i < wordVec.size(); i++){
+    trainKeys.push_back(LookupKey(wordVec[i],key) ? key : 0);
+  }
+  wordVec.clear();
+  TextToWordSequence(testFile,wordVec);
+  for(i = 0; i < wordVec.size(); i++){
+    testKeys.push_back(LookupKey(wordVec[i],key) ? key : 0);
+  }
+  if(testKeys.size() < NGRAM + 1){
+    cout << "ERROR too few words for a suffix index benchmark in " << testFile << endl;
+    return;
+  }
+  if(!tablesFrozen){
+    FreezeTables();
+  }
+
+  index.Build(trainKeys,pool);
+  tableBytes = 0;
+  for(n = 1; n <= NGRAMS; n++){
+    tableBytes += frozenStore[n].keys.size() * sizeof(U64) + frozenStore[n].rowStart.size() * sizeof(U32);
+    tableBytes += frozenStore[n].ids.size() * sizeof(IntKey) + frozenStore[n].probs.size() * sizeof(double);
+    tableBytes += frozenStore[n].discount.size() * sizeof(double) + frozenStore[n].backoff.size() * sizeof(double);
+  }
+  cout << "Suffix index benchmark over " << testFile << " (" << testKeys.size() << " words): index " << index.SizeBytes()
+       << " bytes for any order, flat tables " << tableBytes << " bytes for orders 1-" << NGRAMS << endl;
+
+  for(n = 2; n <= NGRAMS; n++){
+    keys.clear();
+    for(i = n - 1; i < testKeys.size(); i++){
+      keys.push_back(MakeNgramModelKey(n, testKeys[i-n+1], (n > 2) ? testKeys[i-n+2] : 0, (n > 3) ? testKeys[i-n+3] : 0));
+    }
+    tableSeen = indexSeen = 0;
+    t0 = WallSeconds();
+    for(q = 0; q < keys.size(); q++){
+      tableSeen += (GetProb(n, keys[q], testKeys[q+n-1]) > 0.0);
+    }
+    secs = WallSeconds() - t0;
+    t0 = WallSeconds();
+    for(i = n - 1; i < testKeys.size(); i++){
+      indexSeen += (index.Count(&testKeys[i-n+1], n) > 0);
+    }
+    cout << "  " << n << "-gram lookup: tables " << (1e9 * secs / keys.size()) << " ns (" << tableSeen << " seen), index count "
+         << (1e9 * (WallSeconds() - t0) / keys.size()) << " ns (" << indexSeen << " seen)" << endl;
+  }
+
+  //Predict() latency and top-7 accuracy: the interpolated tables, the index at order 4, and the index unbounded
+  for(n = 0; n < 3; n++){
+    hits = ranked = 0;
+    t0 = WallSeconds();
+    for(i = NGRAM; i < testKeys.size(); i++){
+      result.clear();
+      if(n == 0){
+        Predict(testKeys, i, result);
+      }
+      else{
+        index.Predict(testKeys, i, result, (n == 1) ? NGRAMS : 0);
+      }
+      for(j = 0; (j < result.size()) && (j < 7); j++){
+        hits += (result[j].first == testKeys[i]);
+      }
+      ranked++;
+    }
+    secs = WallSeconds() - t0;
+    cout << "  Predict " << ((n == 0) ? "tables:           " : (n == 1) ? "index, order 4:   " : "index, unbounded: ")
+         << (1e6 * secs / ranked) << " us, top7 " << (100.0 * hits / ranked) << "%" << endl;
+  }
+}
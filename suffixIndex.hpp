@@ -0,0 +1,55 @@
+/*
+  Suffix-array index over a keyed training sequence, an alternative backend to the fixed-order tables: counts and
+  continuations of a context of any length are answered at query time by binary search over the suffix array,
+  so Predict() can back off from the longest context seen in training (the "infini-gram" estimate
+  count(context w) / count(context)) at a memory cost linear in the corpus: 2 bytes of text, 4 of suffix array
+  and 4 of LCP per token, however many orders are queried.
+
+  Documents are concatenated with key 0 after each one, so no match runs across two documents (0 is also the
+  unknown key, which no query matches). Suffixes compare as if the text were followed by 0s, so 0 sorts first.
+
+  Build() is parallel on a WorkStealingPool: the first SUFFIX_PACK_WORDS words of every suffix pack into one U64
+  (words are 16 bits), the suffixes are bucketed by their first word and each bucket sorted on the packed key,
+  then prefix doubling re-sorts only the groups still tied, each group a separate task. The LCP array comes from
+  Kasai's algorithm run on independent slices of the text (a slice just starts from a zero lower bound).
+*/
+
+#ifndef SUFFIX_INDEX_HPP
+#define SUFFIX_INDEX_HPP
+
+#include "workPool.hpp"
+
+#define SUFFIX_PACK_WORDS 4        //words per packed initial sort key (64 / 16 bits)
+#define SUFFIX_TASK_SZ (1 << 16)   //suffixes per work item when sorting tied groups or computing the LCP
+#define SUFFIX_LCP_SCAN 32         //continuation groups are found by scanning this much LCP before galloping
+
+class SuffixIndex{
+  public:
+    vector<IntKey> text;  //the documents, each followed by a 0
+    vector<U32> sa;       //text positions in suffix order
+    vector<U32> lcp;      //lcp[j] = common prefix length of suffixes sa[j-1] and sa[j]; lcp[0] = 0
+
+    void Build(const vector<IntKey>& keySeq, WorkStealingPool& pool);
+    void Build(const vector<vector<IntKey> >& keyDocs, WorkStealingPool& pool);
+    U64 SizeBytes(void) const;
+
+    //[lo,hi) gets the suffix range starting with words[0..len); false (and an empty range) if there is none
+    bool FindRange(const IntKey* words, U32 len, U64& lo, U64& hi) const;
+    U64 Count(const IntKey* words, U32 len) const;
+    //word counts following the context words[0..len), in word order; len 0 gives the unigram counts
+    void Continuations(const IntKey* words, U32 len, vector<pair<IntKey,U64> >& next) const;
+    //length of the longest suffix of words[0..len) that is followed by some word in the text, at most maxLen
+    U32 LongestSuffix(const IntKey* words, U32 len, U32 maxLen, U64& lo, U64& hi) const;
+    //infini-gram prediction for keySeq[i] from the longest matching context (at most maxOrder-1 words, 0 = unbounded)
+    void Predict(const vector<IntKey>& keySeq, int i, ResultList& results, U32 maxOrder = 0) const;
+
+  private:
+    IntKey WordAt(U64 j, U32 offset) const;
+    U64 LowerBound(U64 lo, U64 hi, U32 offset, IntKey word) const;
+    U64 UpperBound(U64 lo, U64 hi, U32 offset, IntKey word) const;
+    void ContinuationsInRange(U64 lo, U64 hi, U32 len, vector<pair<IntKey,U64> >& next) const;
+    void SortSuffixes(WorkStealingPool& pool);
+    void ComputeLcp(WorkStealingPool& pool);
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+  Stress test for ModelHandle: query threads run Predict()/GetProb() through readers while the main thread keeps
+  publishing freshly trained models. `make swap-stress` builds it with AddressSanitizer, so a model freed while a
+  reader still holds it fails loudly (its arena is unmapped, so the tables fault even without the sanitizer).
+  Readers also check that the model they hold stays whole for the length of their critical section.
+
+  usage: swapStress [publishes] [query threads]
+*/
+
+#include "modelHandle.hpp"
+#include "workPool.hpp"
+#include <thread>
+
+#define STRESS_PUBLISHES 100
+#define STRESS_READERS 4
+#define STRESS_TOKENS 20000  //training tokens per model
+#define STRESS_VOCAB 200     //words in the first model; model g has STRESS_VOCAB + g % 50
+
+//a small random corpus over words w0..w(vocab-1); the same generation always gives the same model
+static void MakeCorpus(U32 generation, U32 nTokens, vector<string>& words)
+{
+  U32 i, vocab;
+  U64 x;
+
+  vocab = STRESS_VOCAB + generation % 50;
+  x = 0x9E3779B97F4A7C15ULL * (generation + 1);
+  for(i = 0; i < nTokens; i++){
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    words.push_back("w" + std::to_string((x >> 33) % vocab));
+  }
+}
+
+static NgramModel* TrainModel(U32 generation, WorkStealingPool& pool)
+{
+  NgramModel* model = new NgramModel();
+  vector<vector<string> > docs(1);
+  vector<string> heldOut;
+  std::streambuf* saved;
+  std::ofstream quiet;
+
+  MakeCorpus(generation, STRESS_TOKENS, docs[0]);
+  MakeCorpus(generation + 1000, STRESS_TOKENS / 10, heldOut);
+  saved = cout.rdbuf(quiet.rdbuf());  //training is chatty
+  model->TrainDocuments(docs, heldOut, pool);
+  cout.rdbuf(saved);
+
+  return model;
+}
+
+int main(int argc, char* argv[])
+{
+  int t, nReaders, nPublishes, g;
+  vector<std::thread> readers;
+  std::atomic<bool> done(false);
+  std::atomic<U64> nQueries(0), nFailures(0);
+  WorkStealingPool pool(1);
+  ModelHandle handle;
+
+  nPublishes = (argc > 1) ? atoi(argv[1]) : STRESS_PUBLISHES;
+  nReaders = (argc > 2) ? atoi(argv[2]) : STRESS_READERS;
+  handle.Publish(TrainModel(0, pool));
+
+  for(t = 0; t < nReaders; t++){
+    readers.push_back(std::thread([&, t](){
+      U32 i, j;
+      IntKey ids;
+      vector<IntKey> keySeq;
+      ResultList results;
+
+      while(!done.load()){
+        ModelReader reader(handle);
+        ids = reader->idCounter;
+        if((ids < 2) || (ids > STRESS_VOCAB + 51)){
+          nFailures++;
+          continue;
+        }
+        keySeq.clear();
+        for(i = 0; i < 8; i++){
+          keySeq.push_back(1 + (i * 7 + t) % (ids - 1));
+        }
+        for(i = NGRAM - 1; i < keySeq.size(); i++){
+          results.clear();
+          reader->Predict(keySeq, i, results);
+          for(j = 0; j < results.size(); j++){
+            if((results[j].first == 0) || (results[j].first >= ids)){
+              nFailures++;
+            }
+          }
+          if(reader->GetProb(1, keySeq[i], keySeq[i]) <= 0.0){
+            nFailures++;
+          }
+          std::this_thread::yield();  //give the writer a chance to swap while this reader is pinned
+        }
+        if(reader->idCounter != ids){
+          nFailures++;
+        }
+        nQueries++;
+      }
+    }));
+  }
+
+  for(g = 1; g <= nPublishes; g++){
+    handle.Publish(TrainModel(g, pool));
+  }
+  done.store(true);
+  for(t = 0; t < nReaders; t++){
+    readers[t].join();
+  }
+
+  cout << "swap stress: " << nPublishes << " publishes, " << nReaders << " readers, " << nQueries.load() << " queries, "
+       << nFailures.load() << " failures, epoch " << handle.Epoch() << endl;
+
+  return (nFailures.load() == 0) ? 0 : 1;
+}
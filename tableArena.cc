@@ -0,0 +1,183 @@
+#include "nGram.hpp"
+#include <sys/mman.h>
+#include <new>
+
+//the part of a slab a thread has not carved yet, in one arena
+typedef struct arenaSlab{
+  U64 arenaId;
+  char* next;
+  char* end;
+} ArenaSlab;
+
+static std::atomic<U64> arenaIds(1);
+static thread_local ArenaSlab threadSlabs[ARENA_THREAD_SLABS];  //most recently used first
+
+TableArena::TableArena()
+{
+  int c;
+
+  id = arenaIds++;
+  pageMode = ARENA_PAGES_TRANSPARENT;
+  chunkNext = chunkEnd = NULL;
+  nSlabs = 0;
+  for(c = 0; c <= ARENA_SIZE_CLASSES; c++){
+    freeList[c] = NULL;
+    freeCount[c] = 0;
+  }
+}
+
+TableArena::~TableArena()
+{
+  U32 i;
+
+  for(i = 0; i < chunks.size(); i++){
+    munmap(chunks[i].first, chunks[i].second);
+  }
+}
+
+/*
+  Maps a chunk of at least bytes, rounded up to whole huge pages. Transparent huge pages need 2MB-aligned ranges,
+  so the mapping is made one huge page larger and trimmed to alignment.
+*/
+char* TableArena::MapChunk(U64 bytes)
+{
+  char *p, *aligned;
+  U64 head;
+
+  bytes = (bytes + HUGE_PAGE_SZ - 1) & ~((U64)HUGE_PAGE_SZ - 1);
+  if(pageMode == ARENA_PAGES_EXPLICIT){
+    p = (char*)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED){
+      chunks.push_back(std::make_pair(p, bytes));
+      return p;
+    }
+    cout << "WARN no explicit huge pages for the table arena (see vm.nr_hugepages), using transparent ones" << endl;
+    pageMode = ARENA_PAGES_TRANSPARENT;
+  }
+
+  p = (char*)mmap(NULL, bytes + HUGE_PAGE_SZ, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    cout << "ERROR table arena could not map " << bytes << " bytes" << endl;
+    throw std::bad_alloc();
+  }
+  aligned = (char*)(((U64)p + HUGE_PAGE_SZ - 1) & ~((U64)HUGE_PAGE_SZ - 1));
+  head = aligned - p;
+  if(head > 0){
+    munmap(p, head);
+  }
+  munmap(aligned + bytes, HUGE_PAGE_SZ - head);
+  if(pageMode == ARENA_PAGES_TRANSPARENT){
+    madvise(aligned, bytes, MADV_HUGEPAGE);
+  }
+  chunks.push_back(std::make_pair(aligned, bytes));
+
+  return aligned;
+}
+
+//gives a thread's slab a new range of at least bytes; what was left of the old one is not worth keeping
+void TableArena::Refill(ArenaSlab* slab, size_t bytes)
+{
+  U64 len = (bytes > ARENA_SLAB_SZ) ? bytes : ARENA_SLAB_SZ;
+  std::lock_guard<std::mutex> guard(lock);
+
+  if((U64)(chunkEnd - chunkNext) < len){
+    chunkNext = MapChunk((len > ARENA_CHUNK_SZ) ? len : ARENA_CHUNK_SZ);
+    chunkEnd = chunkNext + chunks.back().second;
+  }
+  slab->next = chunkNext;
+  slab->end = chunkNext + len;
+  chunkNext += len;
+  nSlabs++;
+}
+
+void* TableArena::TakeFreed(U32 sizeClass)
+{
+  void* p;
+  std::lock_guard<std::mutex> guard(lock);
+
+  p = freeList[sizeClass];
+  if(p != NULL){
+    freeList[sizeClass] = *(void**)p;
+    freeCount[sizeClass]--;
+  }
+
+  return p;
+}
+
+void* TableArena::Allocate(size_t bytes)
+{
+  int i;
+  U32 c;
+  void* p;
+  ArenaSlab slab;
+
+  bytes = (bytes + ARENA_GRAIN - 1) & ~((size_t)ARENA_GRAIN - 1);
+  c = bytes / ARENA_GRAIN;
+  if((c <= ARENA_SIZE_CLASSES) && (freeCount[c].load(std::memory_order_relaxed) > 0)){
+    p = TakeFreed(c);
+    if(p != NULL){
+      return p;
+    }
+  }
+
+  //this arena's slab moves to the front of the thread's list; a new one pushes the least recently used one out
+  if(threadSlabs[0].arenaId != id){
+    slab.arenaId = id;
+    slab.next = slab.end = NULL;
+    for(i = 1; (i < ARENA_THREAD_SLABS - 1) && (threadSlabs[i].arenaId != id); i++);
+    if(threadSlabs[i].arenaId == id){
+      slab = threadSlabs[i];
+    }
+    for( ; i > 0; i--){
+      threadSlabs[i] = threadSlabs[i-1];
+    }
+    threadSlabs[0] = slab;
+  }
+  if((size_t)(threadSlabs[0].end - threadSlabs[0].next) < bytes){
+    Refill(&threadSlabs[0], bytes);
+  }
+  p = threadSlabs[0].next;
+  threadSlabs[0].next += bytes;
+
+  return p;
+}
+
+//blocks too large for a size class are not expected from the node containers, and stay put until the arena goes
+void TableArena::Deallocate(void* p, size_t bytes)
+{
+  U32 c = (bytes + ARENA_GRAIN - 1) / ARENA_GRAIN;
+  std::lock_guard<std::mutex> guard(lock);
+
+  if(c <= ARENA_SIZE_CLASSES){
+    *(void**)p = freeList[c];
+    freeList[c] = p;
+    freeCount[c]++;
+  }
+}
+
+U64 TableArena::MappedBytes(void)
+{
+  U32 i;
+  U64 bytes = 0;
+  std::lock_guard<std::mutex> guard(lock);
+
+  for(i = 0; i < chunks.size(); i++){
+    bytes += chunks[i].second;
+  }
+
+  return bytes;
+}
+
+U32 TableArena::NumChunks(void)
+{
+  std::lock_guard<std::mutex> guard(lock);
+
+  return (U32)chunks.size();
+}
+
+U64 TableArena::NumSlabs(void)
+{
+  std::lock_guard<std::mutex> guard(lock);
+
+  return nSlabs;
+}
@@ -0,0 +1,512 @@
+#include "textSampler.hpp"
+
+static inline U64 RotateLeft(U64 x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+//xoshiro256**
+static inline U64 NextRandom(SamplerRng& rng)
+{
+  U64 result = RotateLeft(rng.s[1] * 5, 7) * 9;
+  U64 t = rng.s[1] << 17;
+
+  rng.s[2] ^= rng.s[0];
+  rng.s[3] ^= rng.s[1];
+  rng.s[1] ^= rng.s[2];
+  rng.s[0] ^= rng.s[3];
+  rng.s[2] ^= t;
+  rng.s[3] = RotateLeft(rng.s[3], 45);
+
+  return result;
+}
+
+static inline U64 SplitMix64(U64& x)
+{
+  U64 z = (x += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+  return z ^ (z >> 31);
+}
+
+TextSampler::TextSampler()
+{
+  tables = NULL;
+  chained = false;
+  memset(orderCut, 0, sizeof(orderCut));
+}
+
+//the stream's state comes from splitmix64 over (seed, stream) mixed together, as the xoshiro authors recommend
+void TextSampler::Seed(SamplerRng& rng, U64 seed, U64 stream) const
+{
+  int i;
+  U64 x = SplitMix64(seed) ^ (stream * 0xD1B54A32D192ED03ULL);
+
+  for(i = 0; i < 4; i++){
+    rng.s[i] = SplitMix64(x);
+  }
+}
+
+/*
+  Builds the alias tables and entry links of every order on the pool, TABLE_BLOCK_SZ rows per task, and checks
+  whether the tables are chained. The unigram "rows" hold one entry each, so the unigram distribution is a single
+  alias table over all of them.
+*/
+void TextSampler::Build(NgramModel& model, WorkStealingPool& pool)
+{
+  int n;
+  U64 r, nEntries, nBlocks;
+  double t0, sum, w;
+  vector<U64> costs;
+  vector<char> blockChained;
+  vector<vector<double> > scaled(pool.NumWorkers());
+  vector<vector<U32> > small(pool.NumWorkers()), large(pool.NumWorkers());
+
+  t0 = WallSeconds();
+  if(!model.tablesFrozen){
+    model.FreezeTables();
+  }
+  tables = model.frozen;
+
+  //the order mixture: cumulative 32-bit cuts from the highest order down
+  sum = 0.0;
+  for(n = 1; n <= NGRAMS; n++){
+    sum += (model.lambdas.l[n] > 0.0) ? model.lambdas.l[n] : 0.0;
+  }
+  w = 0.0;
+  orderCut[NGRAMS+1] = 0;
+  for(n = NGRAMS; n >= 1; n--){
+    w += (sum > 0.0) ? (((model.lambdas.l[n] > 0.0) ? model.lambdas.l[n] : 0.0) / sum) : ((n == 1) ? 1.0 : 0.0);
+    orderCut[n] = (U64)(w * 4294967296.0);
+  }
+  orderCut[1] = 0x100000000ULL;  //whatever rounding left over goes to the unigrams
+
+  chained = true;
+  for(n = 1; n <= NGRAMS; n++){
+    nEntries = (n == 1) ? tables[1].nRows : tables[n].rowStart[tables[n].nRows];
+    entries[n].assign(nEntries, SamplerEntry());
+
+    if(n == 1){
+      BuildAliasRow(1, 0, (U32)nEntries, scaled[0], small[0], large[0]);
+      LinkRows(1, 0, tables[1].nRows);
+      continue;
+    }
+
+    nBlocks = (tables[n].nRows + TABLE_BLOCK_SZ - 1) / TABLE_BLOCK_SZ;
+    costs.assign(nBlocks, 0);
+    blockChained.assign(nBlocks, 1);
+    for(r = 0; r < nBlocks; r++){
+      costs[r] = tables[n].rowStart[std::min((r + 1) * TABLE_BLOCK_SZ, tables[n].nRows)] - tables[n].rowStart[r * TABLE_BLOCK_SZ];
+    }
+    pool.Run(costs, [&](int task, int worker){
+      U64 row, first = (U64)task * TABLE_BLOCK_SZ, end = std::min(first + TABLE_BLOCK_SZ, tables[n].nRows);
+
+      for(row = first; row < end; row++){
+        BuildAliasRow(n, tables[n].rowStart[row], tables[n].rowStart[row+1] - tables[n].rowStart[row], scaled[worker], small[worker], large[worker]);
+      }
+      LinkRows(n, first, end);
+      if(n > 2){
+        blockChained[task] = CheckChained(n, first, end);
+      }
+    });
+    for(r = 0; r < nBlocks; r++){
+      chained = chained && blockChained[r];
+    }
+  }
+
+  cout << "Sampler built in " << (WallSeconds() - t0) << "s, " << SizeBytes() << " bytes" << (chained ? "" : " (unchained contexts, searching)") << endl;
+}
+
+/*
+  Vose's alias method over the entries [start,start+len) of order n (unigram rows for n == 1): entries are scaled so
+  the mean is 1, and each under-full entry is topped up by an over-full one, which becomes its alias.
+*/
+void TextSampler::BuildAliasRow(int n, U64 start, U32 len, vector<double>& scaled, vector<U32>& small, vector<U32>& large)
+{
+  U32 i, s, l;
+  double sum;
+  SamplerEntry* row = &entries[n][start];
+
+  scaled.resize(len);
+  small.clear();
+  large.clear();
+
+  sum = 0.0;
+  for(i = 0; i < len; i++){
+    if(n == 1){
+      scaled[i] = tables[1].probs[tables[1].rowStart[i]];
+      row[i].word = (IntKey)tables[1].keys[i];
+    }
+    else{
+      scaled[i] = tables[n].probs[start + i];
+      row[i].word = tables[n].ids[start + i];
+    }
+    sum += scaled[i];
+  }
+  for(i = 0; i < len; i++){
+    scaled[i] = (sum > 0.0) ? (scaled[i] * len / sum) : 1.0;
+    if(scaled[i] < 1.0){
+      small.push_back(i);
+    }
+    else{
+      large.push_back(i);
+    }
+  }
+
+  while(!small.empty() && !large.empty()){
+    s = small.back();
+    small.pop_back();
+    l = large.back();
+    row[s].threshold = (U32)(scaled[s] * 4294967296.0);
+    row[s].alias = (U16)l;
+    scaled[l] -= 1.0 - scaled[s];
+    if(scaled[l] < 1.0){
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  //whatever is left is full up to rounding, and never aliased
+  while(!large.empty()){
+    l = large.back();
+    large.pop_back();
+    row[l].threshold = U32_MAX;
+    row[l].alias = (U16)l;
+  }
+  while(!small.empty()){
+    s = small.back();
+    small.pop_back();
+    row[s].threshold = U32_MAX;
+    row[s].alias = (U16)s;
+  }
+}
+
+//links the entries of rows [firstRow,endRow) of order n; unigram entry k is row k, with an empty context
+void TextSampler::LinkRows(int n, U64 firstRow, U64 endRow)
+{
+  int m;
+  U64 row;
+
+  for(m = 2; m <= n + 1 && m <= NGRAMS; m++){
+    if(n == 1){
+      LinkEntries(1, m, firstRow, endRow, 0);
+      continue;
+    }
+    for(row = firstRow; row < endRow; row++){
+      LinkEntries(n, m, tables[n].rowStart[row], tables[n].rowStart[row+1], tables[n].keys[row]);
+    }
+  }
+}
+
+//the context after drawing entry k is (context, word k), cut to the m-1 newest words
+void TextSampler::LinkEntries(int n, int m, U64 first, U64 end, U64 context)
+{
+  U32 q, cnt;
+  U64 k;
+  U64 keys[SAMPLER_LINK_BATCH], rows[SAMPLER_LINK_BATCH];
+  bool found[SAMPLER_LINK_BATCH];
+  SamplerRow* next;
+  const U64 mask = (1ULL << (16 * (m - 1))) - 1;
+
+  for(k = first; k < end; k += cnt){
+    cnt = (end - k < SAMPLER_LINK_BATCH) ? (U32)(end - k) : SAMPLER_LINK_BATCH;
+    for(q = 0; q < cnt; q++){
+      keys[q] = ((context << 16) | entries[n][k + q].word) & mask;
+    }
+    FindFlatRows(tables[m], keys, cnt, rows, found);
+    for(q = 0; q < cnt; q++){
+      next = &entries[n][k + q].next[m - 2];
+      next->start = found[q] ? tables[m].rowStart[rows[q]] : 0;
+      next->len = found[q] ? (tables[m].rowStart[rows[q] + 1] - next->start) : 0;
+    }
+  }
+}
+
+//true if each order-m context in rows [firstRow,endRow) is an entry of the order m-1 row of its first m-2 words
+bool TextSampler::CheckChained(int m, U64 firstRow, U64 endRow) const
+{
+  U64 row, prev;
+  IntKey last;
+  const IntKey *first, *end, *it;
+
+  for(row = firstRow; row < endRow; row++){
+    last = (IntKey)(tables[m].keys[row] & 0xFFFF);
+    if(!FindFlatRow(tables[m-1], tables[m].keys[row] >> 16, prev)){
+      return false;
+    }
+    first = tables[m-1].ids + tables[m-1].rowStart[prev];
+    end = tables[m-1].ids + tables[m-1].rowStart[prev+1];
+    it = std::lower_bound(first, end, last);
+    if((it == end) || (*it != last)){
+      return false;
+    }
+  }
+
+  return true;
+}
+
+SamplerRow TextSampler::FindRow(int m, U64 history) const
+{
+  U64 row;
+  SamplerRow found = {0, 0};
+
+  if(FindFlatRow(tables[m], history & ((1ULL << (16 * (m - 1))) - 1), row)){
+    found.start = tables[m].rowStart[row];
+    found.len = tables[m].rowStart[row+1] - found.start;
+  }
+
+  return found;
+}
+
+//order-m row (m > 2) of the context (previous context's m-2 newest words, w), through w's entry in the previous order m-1 row
+SamplerRow TextSampler::FollowRow(int m, SamplerRow prev, IntKey w) const
+{
+  SamplerRow none = {0, 0};
+  const IntKey *first, *end, *it;
+
+  first = tables[m-1].ids + prev.start;
+  end = first + prev.len;
+  it = std::lower_bound(first, end, w);
+  if((it == end) || (*it != w)){
+    return none;
+  }
+
+  return entries[m-1][it - tables[m-1].ids].next[m - 2];
+}
+
+void TextSampler::StartStream(SamplerStream& st, U64 context) const
+{
+  int m;
+
+  st.history = context & SAMPLER_HISTORY_MASK;
+  st.prevWord = 0;
+  st.rows[1].start = 0;
+  st.rows[1].len = (U32)tables[1].nRows;
+  for(m = 2; m <= NGRAMS; m++){
+    st.rows[m].start = SAMPLER_UNRESOLVED;
+    st.rows[m].len = 0;
+  }
+  memcpy(st.prevRows, st.rows, sizeof(st.rows));
+  DrawAhead(st);
+}
+
+//takes the next word's draws and picks its order; if that order's row is known, its entry is on the way to the cache
+void TextSampler::DrawAhead(SamplerStream& st) const
+{
+  int n;
+  const SamplerRow* row;
+
+  st.orderDraw = NextRandom(st.rng);
+  st.slotDraw = NextRandom(st.rng);
+  for(n = NGRAMS; (n > 1) && ((U32)st.orderDraw >= orderCut[n]); n--);
+  st.order = n;
+
+  row = &st.rows[n];
+  if(row->start != SAMPLER_UNRESOLVED){
+    __builtin_prefetch(&entries[n][row->start + (((st.slotDraw >> 32) * row->len) >> 32)]);
+  }
+}
+
+inline IntKey TextSampler::Step(SamplerStream& st) const
+{
+  int n, m;
+  IntKey w;
+  const SamplerEntry* entry;
+
+  //hand the weight of an unseen context down to the next order
+  for(n = st.order; n > 1; n--){
+    if(st.rows[n].start == SAMPLER_UNRESOLVED){
+      st.rows[n] = (chained && (n > 2) && (st.prevRows[n-1].start != SAMPLER_UNRESOLVED)) ? FollowRow(n, st.prevRows[n-1], st.prevWord) : FindRow(n, st.history);
+    }
+    if(st.rows[n].len > 0){
+      break;
+    }
+  }
+
+  //alias draw: the high half picks a slot (multiply-shift, no division), the low half decides slot or alias
+  entry = &entries[n][st.rows[n].start + (((st.slotDraw >> 32) * st.rows[n].len) >> 32)];
+  if((U32)st.slotDraw >= entry->threshold){
+    entry = &entries[n][st.rows[n].start + entry->alias];
+  }
+  w = entry->word;
+  st.history = ((st.history << 16) | w) & SAMPLER_HISTORY_MASK;
+
+  //rows of the new context: linked up to order n+1, the longer ones resolved only if their order gets picked
+  memcpy(st.prevRows, st.rows, sizeof(st.rows));
+  st.prevWord = w;
+  for(m = 2; m <= NGRAMS; m++){
+    if(m <= n + 1){
+      st.rows[m] = entry->next[m - 2];
+    }
+    else{
+      st.rows[m].start = SAMPLER_UNRESOLVED;
+      st.rows[m].len = 0;
+    }
+  }
+  DrawAhead(st);
+
+  return w;
+}
+
+void TextSampler::Generate(SamplerRng& rng, U64 nWords, vector<IntKey>& out, U64 context) const
+{
+  U64 i;
+  SamplerStream st;
+
+  if(tables == NULL){
+    cout << "ERROR sampler used before Build()" << endl;
+    return;
+  }
+
+  st.rng = rng;
+  StartStream(st, context);
+  out.reserve(out.size() + nWords);
+  for(i = 0; i < nWords; i++){
+    out.push_back(Step(st));
+  }
+  rng = st.rng;
+}
+
+void TextSampler::GenerateStreams(U64 seed, U32 nStreams, U64 nWords, vector<vector<IntKey> >& out, WorkStealingPool& pool) const
+{
+  U32 g;
+  vector<U64> costs((nStreams + SAMPLER_INTERLEAVE - 1) / SAMPLER_INTERLEAVE);
+
+  if(tables == NULL){
+    cout << "ERROR sampler used before Build()" << endl;
+    return;
+  }
+
+  out.resize(nStreams);
+  for(g = 0; g < costs.size(); g++){
+    costs[g] = nWords * std::min((U32)SAMPLER_INTERLEAVE, nStreams - g * SAMPLER_INTERLEAVE);
+  }
+  pool.Run(costs, [&](int task, int worker){
+    U32 s, first = task * SAMPLER_INTERLEAVE, cnt = std::min((U32)SAMPLER_INTERLEAVE, nStreams - first);
+    U64 i;
+    SamplerStream st[SAMPLER_INTERLEAVE];
+
+    for(s = 0; s < cnt; s++){
+      Seed(st[s].rng, seed, first + s);
+      StartStream(st[s], 0);
+      out[first + s].assign(nWords, 0);
+    }
+    for(i = 0; i < nWords; i++){
+      for(s = 0; s < cnt; s++){
+        out[first + s][i] = Step(st[s]);
+      }
+    }
+  });
+}
+
+U64 TextSampler::SizeBytes(void) const
+{
+  int n;
+  U64 bytes = 0;
+
+  for(n = 1; n <= NGRAMS; n++){
+    bytes += entries[n].size() * sizeof(SamplerEntry);
+  }
+
+  return bytes;
+}
+
+/*
+  The old way to sample, for comparison: the same order mixture, but the row is found in the map tables and walked,
+  accumulating probabilities until they pass a uniform draw.
+*/
+static IntKey WalkRowSample(NgramTable* maps[], const U64 orderCut[], U64 history, SamplerRng& rng)
+{
+  int n;
+  U32 u;
+  double x, acc;
+  OuterTableIt row;
+  InnerTableIt entry;
+
+  u = (U32)NextRandom(rng);
+  for(n = NGRAMS; (n > 1) && (u >= orderCut[n]); n--);
+  for( ; n > 1; n--){
+    row = maps[n]->find(history & ((1ULL << (16 * (n - 1))) - 1));
+    if(row != maps[n]->end()){
+      break;
+    }
+  }
+
+  x = (double)(NextRandom(rng) >> 11) / 9007199254740992.0;
+  acc = 0.0;
+  if(n == 1){
+    for(row = maps[1]->begin(); row != maps[1]->end(); ++row){
+      acc += row->second.begin()->second;
+      if(acc > x){
+        return (IntKey)row->first;
+      }
+    }
+    return (IntKey)maps[1]->rbegin()->first;
+  }
+  for(entry = row->second.begin(); entry != row->second.end(); ++entry){
+    acc += entry->second;
+    if(acc > x){
+      return entry->first;
+    }
+  }
+
+  return row->second.rbegin()->first;
+}
+
+/*
+  Times sampler construction, then nWords words drawn by walking map rows, by one alias stream, and by one stream per
+  pool worker (times SAMPLER_BENCH_STREAMS), and checks the streams come out the same on a single worker.
+*/
+void NgramModel::BenchmarkSampler(U64 nWords)
+{
+  U32 s, nStreams;
+  U64 i, history, checksum;
+  double t0, secs;
+  bool same;
+  IntKey w;
+  TextSampler sampler;
+  SamplerRng rng;
+  vector<IntKey> out;
+  vector<vector<IntKey> > streams, serialStreams;
+  NgramTable* maps[NGRAMS+1] = {NULL, &unigramTable, &bigramTable, &trigramTable, &quadgramTable};
+  WorkStealingPool pool, serialPool(1);
+
+  if(unigramTable.empty()){
+    cout << "ERROR no model to sample from" << endl;
+    return;
+  }
+  sampler.Build(*this, pool);
+
+  sampler.Seed(rng, 1, 0);
+  history = checksum = 0;
+  t0 = WallSeconds();
+  for(i = 0; i < nWords / 10; i++){
+    w = WalkRowSample(maps, sampler.OrderCuts(), history, rng);
+    history = ((history << 16) | w) & SAMPLER_HISTORY_MASK;
+    checksum += w;
+  }
+  secs = WallSeconds() - t0;
+  cout << "map row walk:     " << (nWords / 10) << " words in " << secs << "s, " << ((nWords / 10) / secs / 1e6) << "M words/s (checksum " << checksum << ")" << endl;
+
+  sampler.Seed(rng, 1, 0);
+  t0 = WallSeconds();
+  sampler.Generate(rng, nWords, out);
+  secs = WallSeconds() - t0;
+  cout << "alias, 1 stream:  " << nWords << " words in " << secs << "s, " << (nWords / secs / 1e6) << "M words/s" << endl;
+
+  nStreams = pool.NumWorkers() * SAMPLER_BENCH_STREAMS;
+  t0 = WallSeconds();
+  sampler.GenerateStreams(1, nStreams, nWords / nStreams, streams, pool);
+  secs = WallSeconds() - t0;
+  cout << "alias, " << nStreams << " streams on " << pool.NumWorkers() << " threads: " << (nWords / nStreams * nStreams) << " words in " << secs << "s, "
+       << ((nWords / nStreams * nStreams) / secs / 1e6) << "M words/s" << endl;
+
+  sampler.GenerateStreams(1, nStreams, nWords / nStreams, serialStreams, serialPool);
+  same = true;
+  for(s = 0; s < nStreams; s++){
+    same = same && (streams[s] == serialStreams[s]);
+  }
+  cout << "streams " << (same ? "identical" : "DIFFER") << " when regenerated on one thread" << endl;
+}
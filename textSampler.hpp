@@ -0,0 +1,97 @@
+/*
+  Fast text generation from a trained model, eg synthetic traffic for load tests. Every word is an O(1) draw from
+  an interpolated mixture of the orders: order n is picked with probability l[n] (the model's lambdas, normalized
+  over 1..NGRAMS), then a word is drawn from order n's row for the current context with a Walker/Vose alias table.
+  An order whose context was never seen passes its weight down to the next lower order (interpolated backoff); the
+  unigram distribution is always there to fall back on.
+
+  Build() makes one alias table per context row of the model's frozen flat tables, laid out parallel to the row
+  entries. Finding the next context's rows by binary search would cost more than the draw itself, so each entry also
+  holds the rows of the contexts it leads to, in the same 32 bytes as its alias slot: drawing w from the row of
+  (a b c) makes (b c w) the new context, and the rows of its suffixes are known for every order up to the one drawn
+  from, plus one. A longer context is resolved only when its order is picked, through the previous context's rows:
+  (b c w) has a row only if w follows (b c), ie is an entry of the previous trigram row, and that entry links to it.
+  Tables where some context is not backed by the lower-order entry that way (eg after pruning) search the whole
+  order for those rows instead.
+
+  A single stream is a chain of dependent cache misses, so GenerateStreams() steps SAMPLER_INTERLEAVE streams in
+  lockstep per task, each prefetching its next entry while the others draw. Streams are reproducible: stream s of
+  GenerateStreams() depends only on (seed, s), whatever the number of threads. The sampler points into the model's
+  frozen snapshot, so it must be rebuilt whenever the model's tables change.
+*/
+
+#ifndef TEXT_SAMPLER_HPP
+#define TEXT_SAMPLER_HPP
+
+#include "workPool.hpp"
+
+#define SAMPLER_UNRESOLVED 0xFFFFFFFF      //row start of a context not looked up yet
+#define SAMPLER_HISTORY_MASK 0x0000FFFFFFFFFFFFULL  //the NGRAMS-1 newest words of a context key
+#define SAMPLER_LINK_BATCH 256             //context searches handed to FindFlatRows() at a time when linking entries
+#define SAMPLER_INTERLEAVE 4               //streams one GenerateStreams() task steps in lockstep, to overlap their cache misses
+#define SAMPLER_BENCH_STREAMS 16           //streams per pool worker in NgramModel::BenchmarkSampler()
+
+//xoshiro256** state of one generator stream
+typedef struct samplerRng{
+  U64 s[4];
+} SamplerRng;
+
+//the entries [start,start+len) of one context row; len is 0 if the context was never seen
+typedef struct samplerRow{
+  U32 start;
+  U32 len;
+} SamplerRow;
+
+//one row entry, 32 bytes: keep it if the 32-bit fraction drawn is below threshold, else take entry alias of the row
+typedef struct samplerEntry{
+  U32 threshold;
+  U16 alias;
+  IntKey word;
+  SamplerRow next[NGRAMS-1];  //rows of the context this entry leads to, next[m-2] for order m = 2..n+1 (n the entry's order)
+} SamplerEntry;
+
+class TextSampler{
+  public:
+    TextSampler();
+
+    void Build(NgramModel& model, WorkStealingPool& pool);  //freezes the model's tables first if needed
+    void Seed(SamplerRng& rng, U64 seed, U64 stream) const;
+    //appends nWords drawn after context, a model key of up to NGRAMS-1 words (newest in the low 16 bits); rng is
+    //left two draws past the last word's
+    void Generate(SamplerRng& rng, U64 nWords, vector<IntKey>& out, U64 context = 0) const;
+    //nStreams independent streams of nWords each, stream s seeded with (seed, s)
+    void GenerateStreams(U64 seed, U32 nStreams, U64 nWords, vector<vector<IntKey> >& out, WorkStealingPool& pool) const;
+    U64 SizeBytes(void) const;
+    const U64* OrderCuts(void) const { return orderCut; }
+
+  private:
+    const FlatTable* tables;                 //the model's frozen tables, by order
+    U64 orderCut[NGRAMS+2];                  //a 32-bit draw below orderCut[n] but not below orderCut[n+1] picks order n
+    vector<SamplerEntry> entries[NGRAMS+1];  //parallel to each order's entries (to its rows for unigrams)
+    bool chained;                            //every context row is backed by the lower-order entry leading to it
+
+    //a stream in the middle of generating: the next word's draws are taken a step ahead, so its entry can be prefetched
+    typedef struct samplerStream{
+      SamplerRng rng;
+      U64 history;
+      U64 orderDraw, slotDraw;
+      int order;  //picked by orderDraw, before backing off
+      IntKey prevWord;
+      SamplerRow rows[NGRAMS+1], prevRows[NGRAMS+1];
+    } SamplerStream;
+
+    void BuildAliasRow(int n, U64 start, U32 len, vector<double>& scaled, vector<U32>& small, vector<U32>& large);
+    void LinkRows(int n, U64 firstRow, U64 endRow);
+    void LinkEntries(int n, int m, U64 first, U64 end, U64 context);
+    bool CheckChained(int m, U64 firstRow, U64 endRow) const;
+    SamplerRow FindRow(int m, U64 history) const;
+    SamplerRow FollowRow(int m, SamplerRow prev, IntKey w) const;
+    void StartStream(SamplerStream& st, U64 context) const;
+    void DrawAhead(SamplerStream& st) const;
+    IntKey Step(SamplerStream& st) const;
+
+    TextSampler(const TextSampler&);
+    TextSampler& operator=(const TextSampler&);
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "typingSession.hpp"
+
+TypingSession::TypingSession(const MappedModel& mappedModel) : model(mappedModel)
+{
+  Reset();
+}
+
+void TypingSession::Reset(void)
+{
+  int n;
+
+  for(n = 0; n <= NGRAMS; n++){
+    keys[n] = 0;
+    rows[n] = 0;
+    found[n] = false;
+  }
+  scoredValid = false;
+  prefix.clear();
+  survivors.clear();
+}
+
+void TypingSession::PushWord(const string& word)
+{
+  IntKey key;
+  string folded = word;
+
+  NgramModel::ToLower(folded);
+  if(folded.empty() || !NgramModel::IsValidWord(folded) || !model.LookupKey(folded,key)){
+    key = OOV_KEY;
+  }
+  PushKey(key);
+}
+
+//shifts the word into every order's packed key (newest word in the low 16 bits), then resolves the new rows
+void TypingSession::PushKey(IntKey key)
+{
+  keys[4] = ((keys[3] << 16) | (U64)key) & 0x0000FFFFFFFFFFFF;
+  keys[3] = ((keys[2] << 16) | (U64)key) & 0x00000000FFFFFFFF;
+  keys[2] = (U64)key;
+
+  found[4] = FindFlatRow(model.tables[4], keys[4], rows[4]);
+  found[3] = FindFlatRow(model.tables[3], keys[3], rows[3]);
+  found[2] = FindFlatRow(model.tables[2], keys[2], rows[2]);
+
+  scoredValid = false;
+  prefix.clear();
+  survivors.clear();
+}
+
+//merged and scored candidates of the current context, the same ones MappedModel::Predict() ranks
+void TypingSession::ScoreContext(void)
+{
+  int n;
+  FlatRowCursor cursors[NGRAMS+1];
+  const FlatTable& unigrams = model.tables[1];
+
+  for(n = 2; n <= NGRAMS; n++){
+    cursors[n].id = cursors[n].end = model.tables[n].ids;
+    cursors[n].prob = model.tables[n].probs;
+    if(found[n]){
+      cursors[n].id = model.tables[n].ids + model.tables[n].rowStart[rows[n]];
+      cursors[n].end = model.tables[n].ids + model.tables[n].rowStart[rows[n]+1];
+      cursors[n].prob = model.tables[n].probs + model.tables[n].rowStart[rows[n]];
+    }
+  }
+
+  MergeRows(cursors[4], cursors[3], cursors[2], found, [&unigrams](IntKey id){
+    return GetFlatUnigramProb(unigrams, id);
+  }, model.lambdas.l, cands);
+  scoredValid = true;
+}
+
+//a longer prefix only narrows the previous survivors; anything else (backspace, a new word) refilters from scratch
+void TypingSession::SetPartial(const string& partial)
+{
+  U32 i, j;
+  bool narrowing;
+  string newPrefix = partial;
+
+  NgramModel::ToLower(newPrefix);
+
+  if(!scoredValid){
+    ScoreContext();
+    prefix.clear();
+    narrowing = false;
+  }
+  else{
+    narrowing = (newPrefix.compare(0, prefix.length(), prefix) == 0) && (newPrefix.length() >= prefix.length());
+  }
+
+  if(!narrowing){
+    survivors.clear();
+    for(i = 0; i < cands.ids.size(); i++){
+      survivors.push_back(i);
+    }
+  }
+
+  if(!newPrefix.empty()){
+    for(i = j = 0; i < survivors.size(); i++){
+      if(model.WordHasPrefix(cands.ids[survivors[i]], newPrefix)){
+        survivors[j++] = survivors[i];
+      }
+    }
+    survivors.resize(j);
+  }
+  prefix = newPrefix;
+}
+
+//partial sort of the survivors only; the order is Predict()'s (CandidateRank), so k=7 on "" is its top 7
+void TypingSession::Suggest(U32 k, ResultList& results)
+{
+  U32 i;
+  CandidateRank better;
+
+  if(!scoredValid){
+    SetPartial(prefix);
+  }
+
+  better.cands = &cands;
+  best = survivors;
+  if(k < best.size()){
+    std::partial_sort(best.begin(), best.begin() + k, best.end(), better);
+    best.resize(k);
+  }
+  else{
+    std::sort(best.begin(), best.end(), better);
+  }
+  for(i = 0; i < best.size(); i++){
+    results.push_back(std::pair<IntKey,double>(cands.ids[best[i]], cands.score[best[i]]));
+  }
+  if(survivors.empty() && !prefix.empty()){
+    model.CompleteWord(prefix, k, results);
+  }
+}
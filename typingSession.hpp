@@ -0,0 +1,51 @@
+/*
+  Per-user state for interactive prediction against one shared, immutable MappedModel. An editor pushes each word as
+  it is completed and sets the partial word on every keystroke; it never resends the whole context.
+
+  The session keeps the last NGRAMS-1 word keys, the packed context key of every order, and the row each key
+  resolved to. Pushing a word shifts the packed keys (the new order-n key is the old order-(n-1) key with the word
+  appended) and re-resolves the three rows once. The candidates of a context are merged and scored on the first
+  keystroke that needs them and kept, unsorted; further keystrokes on the same word only filter them by prefix,
+  narrowing the previous survivors as the prefix grows, and Suggest() picks the best k survivors. Nothing ever sorts
+  the whole candidate list, which is the bulk of a full Predict() on a large context. When no context candidate fits
+  the prefix, the vocabulary's prefix range ranked by unigram probability is used instead
+  (MappedModel::CompleteWord()).
+
+  The vocabulary holds words as training left them, so pushed words and partial words are case folded the same way
+  (NgramModel::ToLower()), and a pushed word training would have rejected (NgramModel::IsValidWord()) pushes key 0.
+  Words are taken whole: the editor splits them at spaces and punctuation, and sends no surrounding punctuation.
+
+  The model is only read, so any number of sessions on any number of threads can share it; a session itself is not
+  meant to be used from two threads at once.
+*/
+
+#ifndef TYPING_SESSION_HPP
+#define TYPING_SESSION_HPP
+
+#include "mappedModel.hpp"
+
+class TypingSession{
+  public:
+    TypingSession(const MappedModel& mappedModel);
+
+    void Reset(void);
+    void PushWord(const string& word);  //a completed word as typed; words outside the vocabulary push key 0
+    void PushKey(IntKey key);
+    void SetPartial(const string& partial);  //the word being typed, as typed; "" right after a word boundary
+    void Suggest(U32 k, ResultList& results);  //best k completions of the partial word in the current context
+
+  private:
+    const MappedModel& model;
+    U64 keys[NGRAMS+1];    //packed context key per order, as MakeNgramModelKey() builds it
+    U64 rows[NGRAMS+1];
+    bool found[NGRAMS+1];
+    bool scoredValid;
+    CandidateRows cands;   //every candidate of the current context, scored, in id order
+    string prefix;         //the partial word, case folded
+    vector<U32> survivors; //indices into cands of the candidates matching prefix, ascending
+    vector<U32> best;      //Suggest() scratch
+
+    void ScoreContext(void);
+};
+
+#endif
@@ -0,0 +1,358 @@
+#include "unicodeText.hpp"
+
+typedef struct codePointRange{
+  U32 lo;
+  U32 hi;
+  char cls;  //CodePointClass() of every code point in [lo,hi]
+} CodePointRange;
+
+typedef struct foldRun{
+  U32 first;
+  U32 last;
+  U32 stride;  //first, first+stride, ... last all fold by delta; the code points in between do not
+  int delta;
+} FoldRun;
+
+//the non-word code points at or above 0x80, ascending; anything not listed is CP_WORD
+static const CodePointRange codePointClasses[] = {
+  {0x0080,0x00A0,CP_WORD_BREAK}, {0x00A1,0x00A1,'!'}, {0x00A2,0x00A9,CP_WORD_BREAK}, {0x00AB,0x00AB,'"'},
+  {0x00AC,0x00AC,CP_WORD_BREAK}, {0x00AD,0x00AD,CP_DROP}, {0x00AE,0x00B4,CP_WORD_BREAK}, {0x00B6,0x00B9,CP_WORD_BREAK},
+  {0x00BB,0x00BB,'"'}, {0x00BC,0x00BE,CP_WORD_BREAK}, {0x00BF,0x00BF,'?'}, {0x00D7,0x00D7,CP_WORD_BREAK},
+  {0x00F7,0x00F7,CP_WORD_BREAK}, {0x02C2,0x02C5,CP_WORD_BREAK}, {0x02D2,0x02DF,CP_WORD_BREAK}, {0x02E5,0x02EB,CP_WORD_BREAK},
+  {0x02ED,0x02ED,CP_WORD_BREAK}, {0x02EF,0x02FF,CP_WORD_BREAK}, {0x0375,0x0375,CP_WORD_BREAK}, {0x037E,0x037E,'?'},
+  {0x0384,0x0385,CP_WORD_BREAK}, {0x0387,0x0387,CP_WORD_BREAK}, {0x03F6,0x03F6,CP_WORD_BREAK}, {0x0482,0x0482,CP_WORD_BREAK},
+  {0x055A,0x055F,CP_WORD_BREAK}, {0x0589,0x0589,'.'}, {0x058A,0x058A,CP_WORD_BREAK}, {0x058D,0x058F,CP_WORD_BREAK},
+  {0x05BE,0x05BE,CP_WORD_BREAK}, {0x05C0,0x05C0,CP_WORD_BREAK}, {0x05C3,0x05C3,CP_WORD_BREAK}, {0x05C6,0x05C6,CP_WORD_BREAK},
+  {0x05F3,0x05F4,CP_WORD_BREAK}, {0x0606,0x060F,CP_WORD_BREAK}, {0x061B,0x061B,';'}, {0x061D,0x061E,CP_WORD_BREAK},
+  {0x061F,0x061F,'?'}, {0x0660,0x0669,'0'}, {0x066A,0x066D,CP_WORD_BREAK}, {0x06D4,0x06D4,'.'},
+  {0x06DE,0x06DE,CP_WORD_BREAK}, {0x06E9,0x06E9,CP_WORD_BREAK}, {0x06F0,0x06F9,'0'}, {0x06FD,0x06FE,CP_WORD_BREAK},
+  {0x0700,0x0700,CP_WORD_BREAK}, {0x0701,0x0702,'.'}, {0x0703,0x070D,CP_WORD_BREAK}, {0x07C0,0x07C9,'0'},
+  {0x07F6,0x07F9,CP_WORD_BREAK}, {0x07FE,0x07FF,CP_WORD_BREAK}, {0x0830,0x083E,CP_WORD_BREAK}, {0x085E,0x085E,CP_WORD_BREAK},
+  {0x0888,0x0888,CP_WORD_BREAK}, {0x0964,0x0965,'.'}, {0x0966,0x096F,'0'}, {0x0970,0x0970,CP_WORD_BREAK},
+  {0x09E6,0x09EF,'0'}, {0x09F2,0x09FB,CP_WORD_BREAK}, {0x09FD,0x09FD,CP_WORD_BREAK}, {0x0A66,0x0A6F,'0'},
+  {0x0A76,0x0A76,CP_WORD_BREAK}, {0x0AE6,0x0AEF,'0'}, {0x0AF0,0x0AF1,CP_WORD_BREAK}, {0x0B66,0x0B6F,'0'},
+  {0x0B70,0x0B70,CP_WORD_BREAK}, {0x0B72,0x0B77,CP_WORD_BREAK}, {0x0BE6,0x0BEF,'0'}, {0x0BF0,0x0BFA,CP_WORD_BREAK},
+  {0x0C66,0x0C6F,'0'}, {0x0C77,0x0C7F,CP_WORD_BREAK}, {0x0C84,0x0C84,CP_WORD_BREAK}, {0x0CE6,0x0CEF,'0'},
+  {0x0D4F,0x0D4F,CP_WORD_BREAK}, {0x0D58,0x0D5E,CP_WORD_BREAK}, {0x0D66,0x0D6F,'0'}, {0x0D70,0x0D79,CP_WORD_BREAK},
+  {0x0DE6,0x0DEF,'0'}, {0x0DF4,0x0DF4,CP_WORD_BREAK}, {0x0E3F,0x0E3F,CP_WORD_BREAK}, {0x0E4F,0x0E4F,CP_WORD_BREAK},
+  {0x0E50,0x0E59,'0'}, {0x0E5A,0x0E5B,CP_WORD_BREAK}, {0x0ED0,0x0ED9,'0'}, {0x0F01,0x0F17,CP_WORD_BREAK},
+  {0x0F1A,0x0F1F,CP_WORD_BREAK}, {0x0F20,0x0F29,'0'}, {0x0F2A,0x0F34,CP_WORD_BREAK}, {0x0F36,0x0F36,CP_WORD_BREAK},
+  {0x0F38,0x0F38,CP_WORD_BREAK}, {0x0F3A,0x0F3D,CP_WORD_BREAK}, {0x0F85,0x0F85,CP_WORD_BREAK}, {0x0FBE,0x0FC5,CP_WORD_BREAK},
+  {0x0FC7,0x0FCC,CP_WORD_BREAK}, {0x0FCE,0x0FDA,CP_WORD_BREAK}, {0x1040,0x1049,'0'}, {0x104A,0x104F,CP_WORD_BREAK},
+  {0x1090,0x1099,'0'}, {0x109E,0x109F,CP_WORD_BREAK}, {0x10FB,0x10FB,CP_WORD_BREAK}, {0x1360,0x1361,CP_WORD_BREAK},
+  {0x1362,0x1362,'.'}, {0x1363,0x137C,CP_WORD_BREAK}, {0x1390,0x1399,CP_WORD_BREAK}, {0x1400,0x1400,CP_WORD_BREAK},
+  {0x166D,0x166E,CP_WORD_BREAK}, {0x1680,0x1680,CP_WORD_BREAK}, {0x169B,0x169C,CP_WORD_BREAK}, {0x16EB,0x16ED,CP_WORD_BREAK},
+  {0x1735,0x1736,CP_WORD_BREAK}, {0x17D4,0x17D6,CP_WORD_BREAK}, {0x17D8,0x17DB,CP_WORD_BREAK}, {0x17E0,0x17E9,'0'},
+  {0x17F0,0x17F9,CP_WORD_BREAK}, {0x1800,0x180A,CP_WORD_BREAK}, {0x1810,0x1819,'0'}, {0x1940,0x1940,CP_WORD_BREAK},
+  {0x1944,0x1945,CP_WORD_BREAK}, {0x1946,0x194F,'0'}, {0x19D0,0x19D9,'0'}, {0x19DA,0x19DA,CP_WORD_BREAK},
+  {0x19DE,0x19FF,CP_WORD_BREAK}, {0x1A1E,0x1A1F,CP_WORD_BREAK}, {0x1A80,0x1A89,'0'}, {0x1A90,0x1A99,'0'},
+  {0x1AA0,0x1AA6,CP_WORD_BREAK}, {0x1AA8,0x1AAD,CP_WORD_BREAK}, {0x1B50,0x1B59,'0'}, {0x1B5A,0x1B6A,CP_WORD_BREAK},
+  {0x1B74,0x1B7E,CP_WORD_BREAK}, {0x1BB0,0x1BB9,'0'}, {0x1BFC,0x1BFF,CP_WORD_BREAK}, {0x1C3B,0x1C3F,CP_WORD_BREAK},
+  {0x1C40,0x1C49,'0'}, {0x1C50,0x1C59,'0'}, {0x1C7E,0x1C7F,CP_WORD_BREAK}, {0x1CC0,0x1CC7,CP_WORD_BREAK},
+  {0x1CD3,0x1CD3,CP_WORD_BREAK}, {0x1FBD,0x1FBD,CP_WORD_BREAK}, {0x1FBF,0x1FC1,CP_WORD_BREAK}, {0x1FCD,0x1FCF,CP_WORD_BREAK},
+  {0x1FDD,0x1FDF,CP_WORD_BREAK}, {0x1FED,0x1FEF,CP_WORD_BREAK}, {0x1FFD,0x1FFE,CP_WORD_BREAK}, {0x2000,0x200B,CP_WORD_BREAK},
+  {0x200E,0x200F,CP_DROP}, {0x2010,0x2013,'-'}, {0x2014,0x2015,CP_PHRASE_BREAK}, {0x2016,0x2017,CP_WORD_BREAK},
+  {0x2018,0x2019,'\''}, {0x201A,0x201A,CP_WORD_BREAK}, {0x201B,0x201B,'\''}, {0x201C,0x201F,'"'},
+  {0x2020,0x2025,CP_WORD_BREAK}, {0x2026,0x2026,'.'}, {0x2027,0x2029,CP_WORD_BREAK}, {0x202F,0x2031,CP_WORD_BREAK},
+  {0x2032,0x2032,'\''}, {0x2033,0x2038,CP_WORD_BREAK}, {0x2039,0x203A,'"'}, {0x203B,0x203B,CP_WORD_BREAK},
+  {0x203C,0x203C,'!'}, {0x203D,0x2042,CP_WORD_BREAK}, {0x2043,0x2043,'-'}, {0x2044,0x2046,CP_WORD_BREAK},
+  {0x2047,0x2048,'?'}, {0x2049,0x2049,'!'}, {0x204A,0x204E,CP_WORD_BREAK}, {0x204F,0x204F,';'},
+  {0x2050,0x205F,CP_WORD_BREAK}, {0x2060,0x2060,CP_DROP}, {0x2070,0x2070,CP_WORD_BREAK}, {0x2074,0x207E,CP_WORD_BREAK},
+  {0x2080,0x208E,CP_WORD_BREAK}, {0x20A0,0x20C0,CP_WORD_BREAK}, {0x2100,0x2101,CP_WORD_BREAK}, {0x2103,0x2106,CP_WORD_BREAK},
+  {0x2108,0x2109,CP_WORD_BREAK}, {0x2114,0x2114,CP_WORD_BREAK}, {0x2116,0x2118,CP_WORD_BREAK}, {0x211E,0x2123,CP_WORD_BREAK},
+  {0x2125,0x2125,CP_WORD_BREAK}, {0x2127,0x2127,CP_WORD_BREAK}, {0x2129,0x2129,CP_WORD_BREAK}, {0x212E,0x212E,CP_WORD_BREAK},
+  {0x213A,0x213B,CP_WORD_BREAK}, {0x2140,0x2144,CP_WORD_BREAK}, {0x214A,0x214D,CP_WORD_BREAK}, {0x214F,0x215F,CP_WORD_BREAK},
+  {0x2189,0x218B,CP_WORD_BREAK}, {0x2190,0x2211,CP_WORD_BREAK}, {0x2212,0x2212,'-'}, {0x2213,0x2426,CP_WORD_BREAK},
+  {0x2440,0x244A,CP_WORD_BREAK}, {0x2460,0x2B73,CP_WORD_BREAK}, {0x2B76,0x2B95,CP_WORD_BREAK}, {0x2B97,0x2BFF,CP_WORD_BREAK},
+  {0x2CE5,0x2CEA,CP_WORD_BREAK}, {0x2CF9,0x2CFF,CP_WORD_BREAK}, {0x2D70,0x2D70,CP_WORD_BREAK}, {0x2E00,0x2E2D,CP_WORD_BREAK},
+  {0x2E2E,0x2E2E,'?'}, {0x2E30,0x2E39,CP_WORD_BREAK}, {0x2E3A,0x2E3B,CP_PHRASE_BREAK}, {0x2E3C,0x2E5D,CP_WORD_BREAK},
+  {0x2E80,0x2E99,CP_WORD_BREAK}, {0x2E9B,0x2EF3,CP_WORD_BREAK}, {0x2F00,0x2FD5,CP_WORD_BREAK}, {0x2FF0,0x2FFB,CP_WORD_BREAK},
+  {0x3000,0x3001,CP_WORD_BREAK}, {0x3002,0x3002,'.'}, {0x3003,0x3004,CP_WORD_BREAK}, {0x3008,0x300B,CP_WORD_BREAK},
+  {0x300C,0x300F,'"'}, {0x3010,0x301C,CP_WORD_BREAK}, {0x301D,0x301F,'"'}, {0x3020,0x3020,CP_WORD_BREAK},
+  {0x3030,0x3030,CP_WORD_BREAK}, {0x3036,0x3037,CP_WORD_BREAK}, {0x303D,0x303F,CP_WORD_BREAK}, {0x3041,0x3096,CP_IDEOGRAPH},
+  {0x309B,0x309C,CP_WORD_BREAK}, {0x309D,0x309F,CP_IDEOGRAPH}, {0x30A0,0x30A0,CP_WORD_BREAK}, {0x30FB,0x30FB,CP_WORD_BREAK},
+  {0x3190,0x319F,CP_WORD_BREAK}, {0x31C0,0x31E3,CP_WORD_BREAK}, {0x3200,0x321E,CP_WORD_BREAK}, {0x3220,0x33FF,CP_WORD_BREAK},
+  {0x3400,0x4DBF,CP_IDEOGRAPH}, {0x4DC0,0x4DFF,CP_WORD_BREAK}, {0x4E00,0x9FFF,CP_IDEOGRAPH}, {0xA490,0xA4C6,CP_WORD_BREAK},
+  {0xA4FE,0xA4FF,CP_WORD_BREAK}, {0xA60D,0xA60F,CP_WORD_BREAK}, {0xA620,0xA629,'0'}, {0xA673,0xA673,CP_WORD_BREAK},
+  {0xA67E,0xA67E,CP_WORD_BREAK}, {0xA6F2,0xA6F7,CP_WORD_BREAK}, {0xA700,0xA716,CP_WORD_BREAK}, {0xA720,0xA721,CP_WORD_BREAK},
+  {0xA789,0xA78A,CP_WORD_BREAK}, {0xA828,0xA82B,CP_WORD_BREAK}, {0xA830,0xA839,CP_WORD_BREAK}, {0xA874,0xA877,CP_WORD_BREAK},
+  {0xA8CE,0xA8CF,CP_WORD_BREAK}, {0xA8D0,0xA8D9,'0'}, {0xA8F8,0xA8FA,CP_WORD_BREAK}, {0xA8FC,0xA8FC,CP_WORD_BREAK},
+  {0xA900,0xA909,'0'}, {0xA92E,0xA92F,CP_WORD_BREAK}, {0xA95F,0xA95F,CP_WORD_BREAK}, {0xA9C1,0xA9CD,CP_WORD_BREAK},
+  {0xA9D0,0xA9D9,'0'}, {0xA9DE,0xA9DF,CP_WORD_BREAK}, {0xA9F0,0xA9F9,'0'}, {0xAA50,0xAA59,'0'},
+  {0xAA5C,0xAA5F,CP_WORD_BREAK}, {0xAA77,0xAA79,CP_WORD_BREAK}, {0xAADE,0xAADF,CP_WORD_BREAK}, {0xAAF0,0xAAF1,CP_WORD_BREAK},
+  {0xAB5B,0xAB5B,CP_WORD_BREAK}, {0xAB6A,0xAB6B,CP_WORD_BREAK}, {0xABEB,0xABEB,CP_WORD_BREAK}, {0xABF0,0xABF9,'0'},
+  {0xD800,0xF8FF,CP_WORD_BREAK}, {0xF900,0xFA6D,CP_IDEOGRAPH}, {0xFA70,0xFAD9,CP_IDEOGRAPH}, {0xFB29,0xFB29,CP_WORD_BREAK},
+  {0xFBB2,0xFBC2,CP_WORD_BREAK}, {0xFD3E,0xFD4F,CP_WORD_BREAK}, {0xFDCF,0xFDCF,CP_WORD_BREAK}, {0xFDFC,0xFDFF,CP_WORD_BREAK},
+  {0xFE10,0xFE19,CP_WORD_BREAK}, {0xFE30,0xFE52,CP_WORD_BREAK}, {0xFE54,0xFE57,CP_WORD_BREAK}, {0xFE58,0xFE58,CP_PHRASE_BREAK},
+  {0xFE59,0xFE59,'('}, {0xFE5A,0xFE5A,')'}, {0xFE5B,0xFE62,CP_WORD_BREAK}, {0xFE63,0xFE63,'-'},
+  {0xFE64,0xFE66,CP_WORD_BREAK}, {0xFE68,0xFE6B,CP_WORD_BREAK}, {0xFEFF,0xFEFF,CP_DROP}, {0xFF01,0xFF01,'!'},
+  {0xFF02,0xFF02,'"'}, {0xFF03,0xFF06,CP_WORD_BREAK}, {0xFF07,0xFF07,'\''}, {0xFF08,0xFF08,'('},
+  {0xFF09,0xFF09,')'}, {0xFF0A,0xFF0C,CP_WORD_BREAK}, {0xFF0D,0xFF0D,'-'}, {0xFF0E,0xFF0E,'.'},
+  {0xFF0F,0xFF0F,CP_WORD_BREAK}, {0xFF10,0xFF19,'0'}, {0xFF1A,0xFF1A,':'}, {0xFF1B,0xFF1B,';'},
+  {0xFF1C,0xFF1E,CP_WORD_BREAK}, {0xFF1F,0xFF1F,'?'}, {0xFF20,0xFF20,CP_WORD_BREAK}, {0xFF3B,0xFF40,CP_WORD_BREAK},
+  {0xFF5B,0xFF60,CP_WORD_BREAK}, {0xFF61,0xFF61,'.'}, {0xFF62,0xFF65,CP_WORD_BREAK}, {0xFFE0,0xFFE6,CP_WORD_BREAK},
+  {0xFFE8,0xFFEE,CP_WORD_BREAK}, {0xFFFC,0xFFFD,CP_WORD_BREAK}, {0x10100,0x10102,CP_WORD_BREAK}, {0x10107,0x10133,CP_WORD_BREAK},
+  {0x10137,0x1013F,CP_WORD_BREAK}, {0x10175,0x1018E,CP_WORD_BREAK}, {0x10190,0x1019C,CP_WORD_BREAK}, {0x101A0,0x101A0,CP_WORD_BREAK},
+  {0x101D0,0x101FC,CP_WORD_BREAK}, {0x102E1,0x102FB,CP_WORD_BREAK}, {0x10320,0x10323,CP_WORD_BREAK}, {0x1039F,0x1039F,CP_WORD_BREAK},
+  {0x103D0,0x103D0,CP_WORD_BREAK}, {0x104A0,0x104A9,'0'}, {0x1056F,0x1056F,CP_WORD_BREAK}, {0x10857,0x1085F,CP_WORD_BREAK},
+  {0x10877,0x1087F,CP_WORD_BREAK}, {0x108A7,0x108AF,CP_WORD_BREAK}, {0x108FB,0x108FF,CP_WORD_BREAK}, {0x10916,0x1091B,CP_WORD_BREAK},
+  {0x1091F,0x1091F,CP_WORD_BREAK}, {0x1093F,0x1093F,CP_WORD_BREAK}, {0x109BC,0x109BD,CP_WORD_BREAK}, {0x109C0,0x109CF,CP_WORD_BREAK},
+  {0x109D2,0x109FF,CP_WORD_BREAK}, {0x10A40,0x10A48,CP_WORD_BREAK}, {0x10A50,0x10A58,CP_WORD_BREAK}, {0x10A7D,0x10A7F,CP_WORD_BREAK},
+  {0x10A9D,0x10A9F,CP_WORD_BREAK}, {0x10AC8,0x10AC8,CP_WORD_BREAK}, {0x10AEB,0x10AF6,CP_WORD_BREAK}, {0x10B39,0x10B3F,CP_WORD_BREAK},
+  {0x10B58,0x10B5F,CP_WORD_BREAK}, {0x10B78,0x10B7F,CP_WORD_BREAK}, {0x10B99,0x10B9C,CP_WORD_BREAK}, {0x10BA9,0x10BAF,CP_WORD_BREAK},
+  {0x10CFA,0x10CFF,CP_WORD_BREAK}, {0x10D30,0x10D39,'0'}, {0x10E60,0x10E7E,CP_WORD_BREAK}, {0x10EAD,0x10EAD,CP_WORD_BREAK},
+  {0x10F1D,0x10F26,CP_WORD_BREAK}, {0x10F51,0x10F59,CP_WORD_BREAK}, {0x10F86,0x10F89,CP_WORD_BREAK}, {0x10FC5,0x10FCB,CP_WORD_BREAK},
+  {0x11047,0x1104D,CP_WORD_BREAK}, {0x11052,0x11065,CP_WORD_BREAK}, {0x11066,0x1106F,'0'}, {0x110BB,0x110BC,CP_WORD_BREAK},
+  {0x110BE,0x110C1,CP_WORD_BREAK}, {0x110F0,0x110F9,'0'}, {0x11136,0x1113F,'0'}, {0x11140,0x11143,CP_WORD_BREAK},
+  {0x11174,0x11175,CP_WORD_BREAK}, {0x111C5,0x111C8,CP_WORD_BREAK}, {0x111CD,0x111CD,CP_WORD_BREAK}, {0x111D0,0x111D9,'0'},
+  {0x111DB,0x111DB,CP_WORD_BREAK}, {0x111DD,0x111DF,CP_WORD_BREAK}, {0x111E1,0x111F4,CP_WORD_BREAK}, {0x11238,0x1123D,CP_WORD_BREAK},
+  {0x112A9,0x112A9,CP_WORD_BREAK}, {0x112F0,0x112F9,'0'}, {0x1144B,0x1144F,CP_WORD_BREAK}, {0x11450,0x11459,'0'},
+  {0x1145A,0x1145B,CP_WORD_BREAK}, {0x1145D,0x1145D,CP_WORD_BREAK}, {0x114C6,0x114C6,CP_WORD_BREAK}, {0x114D0,0x114D9,'0'},
+  {0x115C1,0x115D7,CP_WORD_BREAK}, {0x11641,0x11643,CP_WORD_BREAK}, {0x11650,0x11659,'0'}, {0x11660,0x1166C,CP_WORD_BREAK},
+  {0x116B9,0x116B9,CP_WORD_BREAK}, {0x116C0,0x116C9,'0'}, {0x11730,0x11739,'0'}, {0x1173A,0x1173F,CP_WORD_BREAK},
+  {0x1183B,0x1183B,CP_WORD_BREAK}, {0x118E0,0x118E9,'0'}, {0x118EA,0x118F2,CP_WORD_BREAK}, {0x11944,0x11946,CP_WORD_BREAK},
+  {0x11950,0x11959,'0'}, {0x119E2,0x119E2,CP_WORD_BREAK}, {0x11A3F,0x11A46,CP_WORD_BREAK}, {0x11A9A,0x11A9C,CP_WORD_BREAK},
+  {0x11A9E,0x11AA2,CP_WORD_BREAK}, {0x11C41,0x11C45,CP_WORD_BREAK}, {0x11C50,0x11C59,'0'}, {0x11C5A,0x11C6C,CP_WORD_BREAK},
+  {0x11C70,0x11C71,CP_WORD_BREAK}, {0x11D50,0x11D59,'0'}, {0x11DA0,0x11DA9,'0'}, {0x11EF7,0x11EF8,CP_WORD_BREAK},
+  {0x11FC0,0x11FF1,CP_WORD_BREAK}, {0x11FFF,0x11FFF,CP_WORD_BREAK}, {0x12470,0x12474,CP_WORD_BREAK}, {0x12FF1,0x12FF2,CP_WORD_BREAK},
+  {0x16A60,0x16A69,'0'}, {0x16A6E,0x16A6F,CP_WORD_BREAK}, {0x16AC0,0x16AC9,'0'}, {0x16AF5,0x16AF5,CP_WORD_BREAK},
+  {0x16B37,0x16B3F,CP_WORD_BREAK}, {0x16B44,0x16B45,CP_WORD_BREAK}, {0x16B50,0x16B59,'0'}, {0x16B5B,0x16B61,CP_WORD_BREAK},
+  {0x16E80,0x16E9A,CP_WORD_BREAK}, {0x16FE2,0x16FE2,CP_WORD_BREAK}, {0x1BC9C,0x1BC9C,CP_WORD_BREAK}, {0x1BC9F,0x1BC9F,CP_WORD_BREAK},
+  {0x1CF50,0x1CFC3,CP_WORD_BREAK}, {0x1D000,0x1D0F5,CP_WORD_BREAK}, {0x1D100,0x1D126,CP_WORD_BREAK}, {0x1D129,0x1D164,CP_WORD_BREAK},
+  {0x1D16A,0x1D16C,CP_WORD_BREAK}, {0x1D183,0x1D184,CP_WORD_BREAK}, {0x1D18C,0x1D1A9,CP_WORD_BREAK}, {0x1D1AE,0x1D1EA,CP_WORD_BREAK},
+  {0x1D200,0x1D241,CP_WORD_BREAK}, {0x1D245,0x1D245,CP_WORD_BREAK}, {0x1D2E0,0x1D2F3,CP_WORD_BREAK}, {0x1D300,0x1D356,CP_WORD_BREAK},
+  {0x1D360,0x1D378,CP_WORD_BREAK}, {0x1D6C1,0x1D6C1,CP_WORD_BREAK}, {0x1D6DB,0x1D6DB,CP_WORD_BREAK}, {0x1D6FB,0x1D6FB,CP_WORD_BREAK},
+  {0x1D715,0x1D715,CP_WORD_BREAK}, {0x1D735,0x1D735,CP_WORD_BREAK}, {0x1D74F,0x1D74F,CP_WORD_BREAK}, {0x1D76F,0x1D76F,CP_WORD_BREAK},
+  {0x1D789,0x1D789,CP_WORD_BREAK}, {0x1D7A9,0x1D7A9,CP_WORD_BREAK}, {0x1D7C3,0x1D7C3,CP_WORD_BREAK}, {0x1D7CE,0x1D7FF,'0'},
+  {0x1D800,0x1D9FF,CP_WORD_BREAK}, {0x1DA37,0x1DA3A,CP_WORD_BREAK}, {0x1DA6D,0x1DA74,CP_WORD_BREAK}, {0x1DA76,0x1DA83,CP_WORD_BREAK},
+  {0x1DA85,0x1DA8B,CP_WORD_BREAK}, {0x1E140,0x1E149,'0'}, {0x1E14F,0x1E14F,CP_WORD_BREAK}, {0x1E2F0,0x1E2F9,'0'},
+  {0x1E2FF,0x1E2FF,CP_WORD_BREAK}, {0x1E8C7,0x1E8CF,CP_WORD_BREAK}, {0x1E950,0x1E959,'0'}, {0x1E95E,0x1E95F,CP_WORD_BREAK},
+  {0x1EC71,0x1ECB4,CP_WORD_BREAK}, {0x1ED01,0x1ED3D,CP_WORD_BREAK}, {0x1EEF0,0x1EEF1,CP_WORD_BREAK}, {0x1F000,0x1F02B,CP_WORD_BREAK},
+  {0x1F030,0x1F093,CP_WORD_BREAK}, {0x1F0A0,0x1F0AE,CP_WORD_BREAK}, {0x1F0B1,0x1F0BF,CP_WORD_BREAK}, {0x1F0C1,0x1F0CF,CP_WORD_BREAK},
+  {0x1F0D1,0x1F0F5,CP_WORD_BREAK}, {0x1F100,0x1F1AD,CP_WORD_BREAK}, {0x1F1E6,0x1F202,CP_WORD_BREAK}, {0x1F210,0x1F23B,CP_WORD_BREAK},
+  {0x1F240,0x1F248,CP_WORD_BREAK}, {0x1F250,0x1F251,CP_WORD_BREAK}, {0x1F260,0x1F265,CP_WORD_BREAK}, {0x1F300,0x1F6D7,CP_WORD_BREAK},
+  {0x1F6DD,0x1F6EC,CP_WORD_BREAK}, {0x1F6F0,0x1F6FC,CP_WORD_BREAK}, {0x1F700,0x1F773,CP_WORD_BREAK}, {0x1F780,0x1F7D8,CP_WORD_BREAK},
+  {0x1F7E0,0x1F7EB,CP_WORD_BREAK}, {0x1F7F0,0x1F7F0,CP_WORD_BREAK}, {0x1F800,0x1F80B,CP_WORD_BREAK}, {0x1F810,0x1F847,CP_WORD_BREAK},
+  {0x1F850,0x1F859,CP_WORD_BREAK}, {0x1F860,0x1F887,CP_WORD_BREAK}, {0x1F890,0x1F8AD,CP_WORD_BREAK}, {0x1F8B0,0x1F8B1,CP_WORD_BREAK},
+  {0x1F900,0x1FA53,CP_WORD_BREAK}, {0x1FA60,0x1FA6D,CP_WORD_BREAK}, {0x1FA70,0x1FA74,CP_WORD_BREAK}, {0x1FA78,0x1FA7C,CP_WORD_BREAK},
+  {0x1FA80,0x1FA86,CP_WORD_BREAK}, {0x1FA90,0x1FAAC,CP_WORD_BREAK}, {0x1FAB0,0x1FABA,CP_WORD_BREAK}, {0x1FAC0,0x1FAC5,CP_WORD_BREAK},
+  {0x1FAD0,0x1FAD9,CP_WORD_BREAK}, {0x1FAE0,0x1FAE7,CP_WORD_BREAK}, {0x1FAF0,0x1FAF6,CP_WORD_BREAK}, {0x1FB00,0x1FB92,CP_WORD_BREAK},
+  {0x1FB94,0x1FBCA,CP_WORD_BREAK}, {0x1FBF0,0x1FBF9,'0'}, {0x20000,0x2A6DF,CP_IDEOGRAPH}, {0x2A700,0x2B738,CP_IDEOGRAPH},
+  {0x2B740,0x2B81D,CP_IDEOGRAPH}, {0x2B820,0x2CEA1,CP_IDEOGRAPH}, {0x2CEB0,0x2EBE0,CP_IDEOGRAPH}, {0x2F800,0x2FA1D,CP_IDEOGRAPH},
+  {0x30000,0x3134A,CP_IDEOGRAPH}, {0xF0000,0xFFFFD,CP_WORD_BREAK}, {0x100000,0x10FFFD,CP_WORD_BREAK}
+};
+
+//simple case folding of the code points at or above 0x80, ascending and non-overlapping (plus U+0130 -> 'i',
+//which CaseFolding.txt only folds for Turkic)
+static const FoldRun foldRuns[] = {
+  {0x00B5,0x00B5,1,775}, {0x00C0,0x00D6,1,32}, {0x00D8,0x00DE,1,32}, {0x0100,0x012E,2,1},
+  {0x0130,0x0130,1,-199}, {0x0132,0x0136,2,1}, {0x0139,0x0147,2,1}, {0x014A,0x0176,2,1},
+  {0x0178,0x0178,1,-121}, {0x0179,0x017D,2,1}, {0x017F,0x017F,1,-268}, {0x0181,0x0181,1,210},
+  {0x0182,0x0184,2,1}, {0x0186,0x0186,1,206}, {0x0187,0x0187,1,1}, {0x0189,0x018A,1,205},
+  {0x018B,0x018B,1,1}, {0x018E,0x018E,1,79}, {0x018F,0x018F,1,202}, {0x0190,0x0190,1,203},
+  {0x0191,0x0191,1,1}, {0x0193,0x0193,1,205}, {0x0194,0x0194,1,207}, {0x0196,0x0196,1,211},
+  {0x0197,0x0197,1,209}, {0x0198,0x0198,1,1}, {0x019C,0x019C,1,211}, {0x019D,0x019D,1,213},
+  {0x019F,0x019F,1,214}, {0x01A0,0x01A4,2,1}, {0x01A6,0x01A6,1,218}, {0x01A7,0x01A7,1,1},
+  {0x01A9,0x01A9,1,218}, {0x01AC,0x01AC,1,1}, {0x01AE,0x01AE,1,218}, {0x01AF,0x01AF,1,1},
+  {0x01B1,0x01B2,1,217}, {0x01B3,0x01B5,2,1}, {0x01B7,0x01B7,1,219}, {0x01B8,0x01B8,1,1},
+  {0x01BC,0x01BC,1,1}, {0x01C4,0x01C4,1,2}, {0x01C5,0x01C5,1,1}, {0x01C7,0x01C7,1,2},
+  {0x01C8,0x01C8,1,1}, {0x01CA,0x01CA,1,2}, {0x01CB,0x01DB,2,1}, {0x01DE,0x01EE,2,1},
+  {0x01F1,0x01F1,1,2}, {0x01F2,0x01F4,2,1}, {0x01F6,0x01F6,1,-97}, {0x01F7,0x01F7,1,-56},
+  {0x01F8,0x021E,2,1}, {0x0220,0x0220,1,-130}, {0x0222,0x0232,2,1}, {0x023A,0x023A,1,10795},
+  {0x023B,0x023B,1,1}, {0x023D,0x023D,1,-163}, {0x023E,0x023E,1,10792}, {0x0241,0x0241,1,1},
+  {0x0243,0x0243,1,-195}, {0x0244,0x0244,1,69}, {0x0245,0x0245,1,71}, {0x0246,0x024E,2,1},
+  {0x0345,0x0345,1,116}, {0x0370,0x0372,2,1}, {0x0376,0x0376,1,1}, {0x037F,0x037F,1,116},
+  {0x0386,0x0386,1,38}, {0x0388,0x038A,1,37}, {0x038C,0x038C,1,64}, {0x038E,0x038F,1,63},
+  {0x0391,0x03A1,1,32}, {0x03A3,0x03AB,1,32}, {0x03C2,0x03C2,1,1}, {0x03CF,0x03CF,1,8},
+  {0x03D0,0x03D0,1,-30}, {0x03D1,0x03D1,1,-25}, {0x03D5,0x03D5,1,-15}, {0x03D6,0x03D6,1,-22},
+  {0x03D8,0x03EE,2,1}, {0x03F0,0x03F0,1,-54}, {0x03F1,0x03F1,1,-48}, {0x03F4,0x03F4,1,-60},
+  {0x03F5,0x03F5,1,-64}, {0x03F7,0x03F7,1,1}, {0x03F9,0x03F9,1,-7}, {0x03FA,0x03FA,1,1},
+  {0x03FD,0x03FF,1,-130}, {0x0400,0x040F,1,80}, {0x0410,0x042F,1,32}, {0x0460,0x0480,2,1},
+  {0x048A,0x04BE,2,1}, {0x04C0,0x04C0,1,15}, {0x04C1,0x04CD,2,1}, {0x04D0,0x052E,2,1},
+  {0x0531,0x0556,1,48}, {0x10A0,0x10C5,1,7264}, {0x10C7,0x10C7,1,7264}, {0x10CD,0x10CD,1,7264},
+  {0x13F8,0x13FD,1,-8}, {0x1C80,0x1C80,1,-6222}, {0x1C81,0x1C81,1,-6221}, {0x1C82,0x1C82,1,-6212},
+  {0x1C83,0x1C84,1,-6210}, {0x1C85,0x1C85,1,-6211}, {0x1C86,0x1C86,1,-6204}, {0x1C87,0x1C87,1,-6180},
+  {0x1C88,0x1C88,1,35267}, {0x1C90,0x1CBA,1,-3008}, {0x1CBD,0x1CBF,1,-3008}, {0x1E00,0x1E94,2,1},
+  {0x1E9B,0x1E9B,1,-58}, {0x1E9E,0x1E9E,1,-7615}, {0x1EA0,0x1EFE,2,1}, {0x1F08,0x1F0F,1,-8},
+  {0x1F18,0x1F1D,1,-8}, {0x1F28,0x1F2F,1,-8}, {0x1F38,0x1F3F,1,-8}, {0x1F48,0x1F4D,1,-8},
+  {0x1F59,0x1F5F,2,-8}, {0x1F68,0x1F6F,1,-8}, {0x1F88,0x1F8F,1,-8}, {0x1F98,0x1F9F,1,-8},
+  {0x1FA8,0x1FAF,1,-8}, {0x1FB8,0x1FB9,1,-8}, {0x1FBA,0x1FBB,1,-74}, {0x1FBC,0x1FBC,1,-9},
+  {0x1FBE,0x1FBE,1,-7173}, {0x1FC8,0x1FCB,1,-86}, {0x1FCC,0x1FCC,1,-9}, {0x1FD8,0x1FD9,1,-8},
+  {0x1FDA,0x1FDB,1,-100}, {0x1FE8,0x1FE9,1,-8}, {0x1FEA,0x1FEB,1,-112}, {0x1FEC,0x1FEC,1,-7},
+  {0x1FF8,0x1FF9,1,-128}, {0x1FFA,0x1FFB,1,-126}, {0x1FFC,0x1FFC,1,-9}, {0x2126,0x2126,1,-7517},
+  {0x212A,0x212A,1,-8383}, {0x212B,0x212B,1,-8262}, {0x2132,0x2132,1,28}, {0x2160,0x216F,1,16},
+  {0x2183,0x2183,1,1}, {0x24B6,0x24CF,1,26}, {0x2C00,0x2C2F,1,48}, {0x2C60,0x2C60,1,1},
+  {0x2C62,0x2C62,1,-10743}, {0x2C63,0x2C63,1,-3814}, {0x2C64,0x2C64,1,-10727}, {0x2C67,0x2C6B,2,1},
+  {0x2C6D,0x2C6D,1,-10780}, {0x2C6E,0x2C6E,1,-10749}, {0x2C6F,0x2C6F,1,-10783}, {0x2C70,0x2C70,1,-10782},
+  {0x2C72,0x2C72,1,1}, {0x2C75,0x2C75,1,1}, {0x2C7E,0x2C7F,1,-10815}, {0x2C80,0x2CE2,2,1},
+  {0x2CEB,0x2CED,2,1}, {0x2CF2,0x2CF2,1,1}, {0xA640,0xA66C,2,1}, {0xA680,0xA69A,2,1},
+  {0xA722,0xA72E,2,1}, {0xA732,0xA76E,2,1}, {0xA779,0xA77B,2,1}, {0xA77D,0xA77D,1,-35332},
+  {0xA77E,0xA786,2,1}, {0xA78B,0xA78B,1,1}, {0xA78D,0xA78D,1,-42280}, {0xA790,0xA792,2,1},
+  {0xA796,0xA7A8,2,1}, {0xA7AA,0xA7AA,1,-42308}, {0xA7AB,0xA7AB,1,-42319}, {0xA7AC,0xA7AC,1,-42315},
+  {0xA7AD,0xA7AD,1,-42305}, {0xA7AE,0xA7AE,1,-42308}, {0xA7B0,0xA7B0,1,-42258}, {0xA7B1,0xA7B1,1,-42282},
+  {0xA7B2,0xA7B2,1,-42261}, {0xA7B3,0xA7B3,1,928}, {0xA7B4,0xA7C2,2,1}, {0xA7C4,0xA7C4,1,-48},
+  {0xA7C5,0xA7C5,1,-42307}, {0xA7C6,0xA7C6,1,-35384}, {0xA7C7,0xA7C9,2,1}, {0xA7D0,0xA7D0,1,1},
+  {0xA7D6,0xA7D8,2,1}, {0xA7F5,0xA7F5,1,1}, {0xAB70,0xABBF,1,-38864}, {0xFF21,0xFF3A,1,32},
+  {0x10400,0x10427,1,40}, {0x104B0,0x104D3,1,40}, {0x10570,0x1057A,1,39}, {0x1057C,0x1058A,1,39},
+  {0x1058C,0x10592,1,39}, {0x10594,0x10595,1,39}, {0x10C80,0x10CB2,1,64}, {0x118A0,0x118BF,1,32},
+  {0x16E40,0x16E5F,1,32}, {0x1E900,0x1E921,1,34}
+};
+
+U32 DecodeUtf8(const char* s, U32& cp)
+{
+  U32 i, n;
+  const unsigned char* b = (const unsigned char*)s;
+
+  if(b[0] < 0x80){
+    cp = b[0];
+    return 1;
+  }
+  if(b[0] < 0xC2){  //continuation byte, or the lead of an overlong 2-byte form
+    cp = UTF8_INVALID;
+    return 1;
+  }
+  else if(b[0] < 0xE0){
+    n = 2;
+    cp = b[0] & 0x1F;
+  }
+  else if(b[0] < 0xF0){
+    n = 3;
+    cp = b[0] & 0x0F;
+  }
+  else if(b[0] < 0xF5){
+    n = 4;
+    cp = b[0] & 0x07;
+  }
+  else{
+    cp = UTF8_INVALID;
+    return 1;
+  }
+
+  //a null terminator fails the continuation check, so this never reads past the end
+  for(i = 1; i < n; i++){
+    if((b[i] & 0xC0) != 0x80){
+      cp = UTF8_INVALID;
+      return 1;
+    }
+    cp = (cp << 6) | (b[i] & 0x3F);
+  }
+  //overlong 3 and 4-byte forms, UTF-16 surrogates, and past the end of Unicode
+  if(((n == 3) && (cp < 0x800)) || ((n == 4) && ((cp < 0x10000) || (cp > 0x10FFFF))) || ((cp >= 0xD800) && (cp <= 0xDFFF))){
+    cp = UTF8_INVALID;
+    return 1;
+  }
+
+  return n;
+}
+
+U32 EncodeUtf8(U32 cp, char out[4])
+{
+  if(cp < 0x80){
+    out[0] = (char)cp;
+    return 1;
+  }
+  if(cp < 0x800){
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if(cp < 0x10000){
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (cp >> 18));
+  out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+U32 FoldCase(U32 cp)
+{
+  int lo, hi, mid;
+  const int nRuns = sizeof(foldRuns) / sizeof(foldRuns[0]);
+
+  if(cp < 0x80){
+    return ((cp >= 'A') && (cp <= 'Z')) ? cp + 32 : cp;
+  }
+  if(cp < foldRuns[0].first){
+    return cp;
+  }
+
+  //last run starting at or before cp
+  lo = 0;
+  hi = nRuns - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(foldRuns[mid].first <= cp){
+      lo = mid;
+    }
+    else{
+      hi = mid - 1;
+    }
+  }
+
+  if((cp <= foldRuns[lo].last) && (((cp - foldRuns[lo].first) % foldRuns[lo].stride) == 0)){
+    return (U32)((int)cp + foldRuns[lo].delta);
+  }
+
+  return cp;
+}
+
+char CodePointClass(U32 cp)
+{
+  int lo, hi, mid;
+  const int nRanges = sizeof(codePointClasses) / sizeof(codePointClasses[0]);
+
+  lo = 0;
+  hi = nRanges - 1;
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    if(cp < codePointClasses[mid].lo){
+      hi = mid - 1;
+    }
+    else if(cp > codePointClasses[mid].hi){
+      lo = mid + 1;
+    }
+    else{
+      return codePointClasses[mid].cls;
+    }
+  }
+
+  return CP_WORD;
+}
+
+U32 Utf8Length(const string& s)
+{
+  U32 i, n;
+
+  n = 0;
+  for(i = 0; i < s.length(); i++){
+    if(((unsigned char)s[i] & 0xC0) != 0x80){
+      n++;
+    }
+  }
+
+  return n;
+}
+
+U32 Utf8Boundary(const string& s, U32 maxBytes)
+{
+  return Utf8Boundary(s.data(), s.length(), maxBytes);
+}
+
+U32 Utf8Boundary(const char* s, U64 len, U32 maxBytes)
+{
+  U32 i;
+
+  if(len <= maxBytes){
+    return len;
+  }
+
+  //back up over continuation bytes to the lead of the sequence maxBytes falls in
+  for(i = maxBytes; (i > 0) && (((unsigned char)s[i] & 0xC0) == 0x80); i--);
+
+  return i;
+}
@@ -0,0 +1,40 @@
+/*
+  UTF-8 decoding and the Unicode tables behind the tokenizer (NgramModel::RawPass() and ToLower()). Only what the
+  tokenizer needs: every non-ASCII code point is either part of a word or stands for some ASCII character the rest
+  of the text pipeline already understands (a delimiter, an apostrophe, a hyphen, a digit), so the phrase and word
+  handling downstream stays byte-oriented and ASCII text tokenizes exactly as before.
+
+  The tables are generated from the Unicode 14 character database: letters, marks, format characters, letter
+  numerals and unassigned code points are word characters, other numbers are digits, and other punctuation,
+  symbols, separators and controls break words. Typographic apostrophes, dashes, quotes and sentence punctuation
+  from the common scripts are mapped to their ASCII equivalents by hand. Han and Hiragana are written without
+  spaces, so each of their characters is a word of its own (as in the UAX #29 default word boundaries); Thai and
+  the like would need a dictionary, and their runs are left whole.
+
+  Case folding is the simple (one to one) folding of CaseFolding.txt, kept as runs of code points that fold by the
+  same offset, eg Latin Extended-A's alternating upper/lower pairs are single runs of stride 2.
+*/
+
+#ifndef UNICODE_TEXT_HPP
+#define UNICODE_TEXT_HPP
+
+#include "nGram.hpp"
+
+#define UTF8_INVALID 0xFFFFFFFF  //decoded value of a byte that does not start a well-formed sequence
+
+//CodePointClass() results that are not themselves the ASCII character to substitute
+#define CP_WORD 0          //part of a word, kept as is
+#define CP_DROP 1          //ignorable (soft hyphen, byte order mark, direction marks), removed
+#define CP_PHRASE_BREAK 2  //ends a phrase, like a double hyphen
+#define CP_WORD_BREAK 3    //ends a word, like a space
+#define CP_IDEOGRAPH 4     //a word by itself
+
+U32 DecodeUtf8(const char* s, U32& cp);  //bytes taken by the sequence at s (null terminated); 1 and UTF8_INVALID if ill-formed
+U32 EncodeUtf8(U32 cp, char out[4]);     //bytes written
+U32 FoldCase(U32 cp);                    //simple case folding; cp itself if it has none
+char CodePointClass(U32 cp);             //for cp >= 0x80: one of the CP_ codes above, or the ASCII character it stands for
+U32 Utf8Length(const string& s);         //code points, ie bytes that are not continuation bytes
+U32 Utf8Boundary(const string& s, U32 maxBytes);  //longest prefix of at most maxBytes that does not split a sequence
+U32 Utf8Boundary(const char* s, U64 len, U32 maxBytes);  //the same over the len bytes at s
+
+#endif
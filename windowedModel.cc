@@ -0,0 +1,205 @@
+#include "windowedModel.hpp"
+
+WindowedModel::WindowedModel(int nEpochs, double decayRate)
+{
+  maxEpochs = (nEpochs > 0) ? nEpochs : 1;
+  decay = decayRate;
+  //the window spans a factor decay^-maxEpochs in scale, which must leave room under WINDOW_REBASE_SCALE after a rebase
+  if((decay <= 0.0) || (decay > 1.0) || (maxEpochs * -log10(decay) > 100.0)){
+    cout << "ERROR window decay " << decayRate << " is out of range for " << maxEpochs << " epochs, using no decay" << endl;
+    decay = 1.0;
+  }
+  nextScale = 1.0;
+}
+
+WindowedModel::~WindowedModel()
+{
+  while(!ring.empty()){
+    delete ring.front();
+    ring.pop_front();
+  }
+}
+
+int WindowedModel::NumEpochs(void)
+{
+  return (int)ring.size();
+}
+
+//no PruneDocuments() here: a word that is rare in one epoch need not be rare in the window
+bool WindowedModel::AddEpoch(const vector<string>& paths)
+{
+  vector<vector<string> > docs;
+  vector<vector<IntKey> > keyDocs;
+
+  if(!counts.TokenizeCorpus(paths,docs,pool)){
+    return false;
+  }
+  counts.DocumentsToKeySequences(docs,keyDocs,pool);
+  AddEpoch(keyDocs);
+
+  return true;
+}
+
+void WindowedModel::AddEpoch(const vector<vector<IntKey> >& keyDocs)
+{
+  int n;
+  WindowEpoch* epoch = new WindowEpoch;
+  NgramTable* tables[NGRAMS+1];
+
+  for(n = 0; n <= NGRAMS; n++){
+    tables[n] = &epoch->tables[n];
+  }
+  counts.CountDocuments(keyDocs,pool,tables);
+
+  if((int)ring.size() >= maxEpochs){
+    ExpireOldest();
+  }
+  epoch->scale = nextScale;
+  nextScale /= decay;
+  FoldEpoch(*epoch);
+  ring.push_back(epoch);
+
+  if(nextScale > WINDOW_REBASE_SCALE){
+    Rebase();
+  }
+}
+
+void WindowedModel::ExpireOldest(void)
+{
+  if(ring.empty()){
+    return;
+  }
+
+  UnfoldEpoch(*ring.front());
+  delete ring.front();
+  ring.pop_front();
+}
+
+void WindowedModel::FoldEpoch(WindowEpoch& epoch)
+{
+  int n;
+  OuterTableIt outer;
+  InnerTableIt inner;
+  NgramTable* aggregate[NGRAMS+1] = {NULL, &counts.unigramTable, &counts.bigramTable, &counts.trigramTable, &counts.quadgramTable};
+
+  counts.tablesFrozen = false;
+  for(n = 1; n <= NGRAMS; n++){
+    for(outer = epoch.tables[n].begin(); outer != epoch.tables[n].end(); ++outer){
+      NgramRow& row = (*aggregate[n])[outer->first];
+      for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+        row[inner->first] += inner->second * epoch.scale;
+      }
+    }
+  }
+}
+
+//subtracts an epoch back out of the aggregate, erasing whatever it was the last contributor to
+void WindowedModel::UnfoldEpoch(WindowEpoch& epoch)
+{
+  int n;
+  double residue;
+  OuterTableIt outer, row;
+  InnerTableIt inner, entry;
+  NgramTable* aggregate[NGRAMS+1] = {NULL, &counts.unigramTable, &counts.bigramTable, &counts.trigramTable, &counts.quadgramTable};
+
+  counts.tablesFrozen = false;
+  residue = 0.5 * epoch.scale;
+  for(n = 1; n <= NGRAMS; n++){
+    for(outer = epoch.tables[n].begin(); outer != epoch.tables[n].end(); ++outer){
+      row = aggregate[n]->find(outer->first);
+      if(row == aggregate[n]->end()){
+        cout << "ERROR expired epoch context " << outer->first << " missing from the " << n << "-gram window aggregate" << endl;
+        continue;
+      }
+      for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+        entry = row->second.find(inner->first);
+        if(entry == row->second.end()){
+          continue;
+        }
+        entry->second -= inner->second * epoch.scale;
+        if(entry->second < residue){
+          row->second.erase(entry);
+        }
+      }
+      if(row->second.empty()){
+        aggregate[n]->erase(row);
+      }
+    }
+  }
+}
+
+//rescales the aggregate and every live epoch so the oldest epoch's scale is 1 again
+void WindowedModel::Rebase(void)
+{
+  int n;
+  U32 e;
+  double f;
+  OuterTableIt outer;
+  InnerTableIt inner;
+  NgramTable* aggregate[NGRAMS+1] = {NULL, &counts.unigramTable, &counts.bigramTable, &counts.trigramTable, &counts.quadgramTable};
+
+  if(ring.empty()){
+    nextScale = 1.0;
+    return;
+  }
+
+  f = 1.0 / ring.front()->scale;
+  for(n = 1; n <= NGRAMS; n++){
+    for(outer = aggregate[n]->begin(); outer != aggregate[n]->end(); ++outer){
+      for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+        inner->second *= f;
+      }
+    }
+  }
+  for(e = 0; e < ring.size(); e++){
+    ring[e]->scale *= f;
+  }
+  nextScale *= f;
+}
+
+/*
+  The window's counts in units of the newest epoch (which weighs 1), normalized, with backoff weights and the flat
+  snapshot built. Lambdas are copied from counts.lambdas; nothing is re-estimated.
+*/
+NgramModel* WindowedModel::Snapshot(void)
+{
+  int n;
+  double w;
+  NgramModel* model;
+  OuterTableIt outer;
+  InnerTableIt inner;
+  NgramTable* aggregate[NGRAMS+1] = {NULL, &counts.unigramTable, &counts.bigramTable, &counts.trigramTable, &counts.quadgramTable};
+  NgramTable* tables[NGRAMS+1];
+
+  if(ring.empty() || counts.unigramTable.empty()){
+    cout << "ERROR no epochs in the window to snapshot" << endl;
+    return NULL;
+  }
+
+  model = new NgramModel;
+  tables[0] = NULL;
+  tables[1] = &model->unigramTable;
+  tables[2] = &model->bigramTable;
+  tables[3] = &model->trigramTable;
+  tables[4] = &model->quadgramTable;
+  model->idCounter = counts.idCounter;
+  model->KeyStringTable = counts.KeyStringTable;
+  model->StringKeyTable = counts.StringKeyTable;
+  model->lambdas = counts.lambdas;
+
+  w = 1.0 / ring.back()->scale;
+  for(n = 1; n <= NGRAMS; n++){
+    *tables[n] = *aggregate[n];
+    for(outer = tables[n]->begin(); outer != tables[n]->end(); ++outer){
+      for(inner = outer->second.begin(); inner != outer->second.end(); ++inner){
+        inner->second *= w;
+      }
+    }
+  }
+
+  model->NormalizeTables();
+  model->ComputeBackoffWeights();
+  model->FreezeTables();
+
+  return model;
+}
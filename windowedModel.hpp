@@ -0,0 +1,59 @@
+/*
+  Sliding-window model over the last nEpochs epochs of text (eg days), so a drifting distribution is tracked
+  without retraining from zero. Each epoch's raw counts are kept as a delta in a ring, and the aggregate of the
+  window is kept in counts' tables. Adding an epoch folds its delta into the aggregate; once the ring is full the
+  oldest delta is subtracted back out first, and entries and contexts that drop to zero are erased. A roll
+  therefore costs time proportional to the two epochs involved, never to the whole model.
+
+  With decay < 1 an epoch of age a (the newest has age 0) weighs decay^a. Rather than scaling the whole aggregate
+  down on every roll, each new epoch goes in scaled up by 1/decay relative to the one before, and Snapshot()
+  divides by the newest epoch's scale. Every live contribution to an entry is at least one unit of the scale it was
+  added with, and scales only grow, so after an expiry anything under half the expired epoch's scale is rounding
+  residue and is erased. When the scales near the top of the double range the aggregate is rebased, an O(model)
+  pass that happens at most once per 100 decades of scale growth (the window itself may span at most 100).
+
+  Snapshot() normalizes a copy of the window into a ready model (O(model)), eg to hand to ModelHandle::Publish().
+  Word keys are stable across epochs and are never reclaimed, so the vocabulary only grows.
+*/
+
+#ifndef WINDOWED_MODEL_HPP
+#define WINDOWED_MODEL_HPP
+
+#include "workPool.hpp"
+
+#define WINDOW_REBASE_SCALE 1e200  //rebase the epoch scales once the next one passes this
+
+class WindowedModel{
+  public:
+    NgramModel counts;  //vocabulary of the window, and its aggregate raw counts in the tables (in scaled units)
+
+    WindowedModel(int nEpochs, double decayRate = 1.0);
+    ~WindowedModel();
+
+    bool AddEpoch(const vector<string>& paths);  //tokenizes and counts the files as one new epoch
+    void AddEpoch(const vector<vector<IntKey> >& keyDocs);  //documents already keyed against counts' vocabulary
+    void ExpireOldest(void);
+    int NumEpochs(void);
+    NgramModel* Snapshot(void);  //normalized copy of the window, owned by the caller; NULL if the window is empty
+
+  private:
+    typedef struct windowEpoch{
+      NgramTable tables[NGRAMS+1];  //raw counts, by order
+      double scale;                 //what the counts were multiplied by going into the aggregate
+    } WindowEpoch;
+
+    int maxEpochs;
+    double decay;
+    double nextScale;
+    deque<WindowEpoch*> ring;  //oldest at the front
+    WorkStealingPool pool;
+
+    void FoldEpoch(WindowEpoch& epoch);
+    void UnfoldEpoch(WindowEpoch& epoch);
+    void Rebase(void);
+
+    WindowedModel(const WindowedModel&);
+    WindowedModel& operator=(const WindowedModel&);
+};
+
+#endif
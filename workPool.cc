@@ -0,0 +1,97 @@
+#include "workPool.hpp"
+#include <thread>
+
+WorkStealingPool::WorkStealingPool(int numWorkers)
+{
+  int i;
+
+  nWorkers = numWorkers;
+  if(nWorkers <= 0){
+    nWorkers = (int)std::thread::hardware_concurrency();
+  }
+  if(nWorkers <= 0){
+    nWorkers = 1;
+  }
+
+  for(i = 0; i < nWorkers; i++){
+    queues.push_back(new WorkQueue);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  for(U32 i = 0; i < queues.size(); i++){
+    delete queues[i];
+  }
+  queues.clear();
+}
+
+int WorkStealingPool::NumWorkers(void)
+{
+  return nWorkers;
+}
+
+bool WorkStealingPool::PopTask(int worker, int& task)
+{
+  std::lock_guard<std::mutex> guard(queues[worker]->lock);
+
+  if(queues[worker]->tasks.empty()){
+    return false;
+  }
+  task = queues[worker]->tasks.back();
+  queues[worker]->tasks.pop_back();
+
+  return true;
+}
+
+//scan the other workers, starting with the next one, and take the smallest remaining task of the first non-empty deque
+bool WorkStealingPool::StealTask(int thief, int& task)
+{
+  int i, victim;
+
+  for(i = 1; i < nWorkers; i++){
+    victim = (thief + i) % nWorkers;
+    std::lock_guard<std::mutex> guard(queues[victim]->lock);
+    if(!queues[victim]->tasks.empty()){
+      task = queues[victim]->tasks.front();
+      queues[victim]->tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void WorkStealingPool::WorkerLoop(int worker, PoolTask& fn)
+{
+  int task;
+
+  while(PopTask(worker,task) || StealTask(worker,task)){
+    fn(task,worker);
+  }
+}
+
+void WorkStealingPool::Run(const vector<U64>& costs, PoolTask fn)
+{
+  int i;
+  vector<int> order;
+  vector<std::thread> threads;
+
+  for(i = 0; i < (int)costs.size(); i++){
+    order.push_back(i);
+  }
+  //ascending by cost, so dealing round-robin leaves each worker's largest tasks at the back of its deque
+  std::stable_sort(order.begin(), order.end(), [&costs](int a, int b){ return costs[a] < costs[b]; });
+  for(i = 0; i < (int)order.size(); i++){
+    queues[i % nWorkers]->tasks.push_back(order[i]);
+  }
+
+  //the calling thread is worker 0
+  for(i = 1; i < nWorkers; i++){
+    threads.push_back(std::thread(&WorkStealingPool::WorkerLoop, this, i, std::ref(fn)));
+  }
+  WorkerLoop(0,fn);
+  for(i = 0; i < (int)threads.size(); i++){
+    threads[i].join();
+  }
+}
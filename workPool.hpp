@@ -0,0 +1,49 @@
+/*
+  Small work-stealing thread pool for batches of independent, known-size tasks (corpus files and file chunks,
+  per-document counting, etc). Tasks are dealt round-robin by descending cost, so every worker starts on its
+  largest tasks; a worker that runs dry steals from the cold end of another worker's deque. This keeps all cores
+  busy when task sizes are very skewed, e.g. a corpus of thousands of small files and a few huge ones.
+
+  Tasks are fixed for the duration of a Run() (nothing is spawned from inside a task), so a worker that finds
+  every deque empty can simply exit.
+*/
+
+#ifndef WORK_POOL_HPP
+#define WORK_POOL_HPP
+
+#include "nGram.hpp"
+#include <deque>
+#include <functional>
+#include <mutex>
+
+using std::deque;
+
+typedef std::function<void(int task, int worker)> PoolTask;
+
+class WorkStealingPool{
+  public:
+    WorkStealingPool(int numWorkers = 0);  //0 means one worker per hardware thread
+    ~WorkStealingPool();
+
+    int NumWorkers(void);
+    //runs fn(task,worker) once for every task index in [0,costs.size()), returning when all have completed
+    void Run(const vector<U64>& costs, PoolTask fn);
+
+  private:
+    typedef struct workQueue{
+      std::mutex lock;
+      deque<int> tasks;  //owner pops from the back (largest first), thieves take from the front
+    } WorkQueue;
+
+    int nWorkers;
+    vector<WorkQueue*> queues;
+
+    bool PopTask(int worker, int& task);
+    bool StealTask(int thief, int& task);
+    void WorkerLoop(int worker, PoolTask& fn);
+
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator=(const WorkStealingPool&);
+};
+
+#endif